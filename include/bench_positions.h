@@ -0,0 +1,108 @@
+/**
+ * Fixed position sets for the solve benchmark.
+ * Generated by `connectfour_bench --generate`, do not edit by hand.
+ * @author Samuel I. Gunadi
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace con4game
+{
+	/** A benchmark position and the reference result of searching it. */
+	struct Bench_position
+	{
+		/** Moves leading to the position, as 1-based column digits. */
+		const char* moves;
+		/** Search depth in plies. */
+		int depth;
+		/** Expected best column. */
+		int column;
+		/** Expected score. */
+		int score;
+	};
+
+	/** A named set of benchmark positions. */
+	struct Bench_set
+	{
+		const char* name;
+		const Bench_position* positions;
+		std::size_t count;
+	};
+
+	const Bench_position endgame_easy_positions[] =
+	{
+		{ "72674567661143747117126165", 8, 1, 214 },
+		{ "13715315355533713447777151", 8, 1, 340 },
+		{ "52313474211246213173265726644", 8, 3, 17 },
+		{ "22217414727651531521575761", 8, 3, 233 },
+		{ "15662165151323645245757621", 8, 0, 371 },
+		{ "3636247677746737611126134215214", 8, 3, 162 },
+		{ "73467216755772542212744466", 8, 1, 146 },
+		{ "22731565233636635162117625525", 8, 2, 597 },
+		{ "3422167743753255665165223332", 8, 6, 325 },
+		{ "137377444725347422117563236", 8, 4, 518 },
+		{ "55411773524424215364665645", 8, 1, 339 },
+		{ "766725264226323624435361744", 8, 0, 162 },
+		{ "76767342222734773662425461611", 8, 3, 417 },
+		{ "7677523677764163325423112132", 8, 4, 276 },
+		{ "67253135631232112752774477351", 8, 5, 325 },
+		{ "2444477225337734116257766421", 8, 4, 98 },
+		{ "565552763111117315243335773722", 8, 5, 178 },
+		{ "7511136631436212337324172557", 8, 4, 452 },
+		{ "763155347144476364711546563", 8, 4, 418 },
+		{ "32634362236536377521476557", 8, 1, 437 },
+		{ "675577317463666645742744423", 8, 1, 130 },
+		{ "413735435137344722432411725775", 8, 1, 742 },
+		{ "4612613456534777237372351631271", 8, 4, 386 },
+		{ "4137741255231222253651776546", 8, 3, 130 },
+	};
+
+	const Bench_position midgame_hard_positions[] =
+	{
+		{ "5466737437275", 10, 3, 390 },
+		{ "5321222553136612323", 10, 0, 343 },
+		{ "7517464211444", 10, 4, 105 },
+		{ "712426565371", 10, 2, 270 },
+		{ "142417657461444665", 10, 1, 235 },
+		{ "6466762275155137734", 10, 1, 280 },
+		{ "6427561341436112", 10, 2, 341 },
+		{ "411343211614615747", 10, 2, 341 },
+		{ "13314365213243", 10, 3, 537 },
+		{ "4316465725257", 10, 3, 509 },
+		{ "36227154631452", 10, 4, 197 },
+		{ "2167462223373", 10, 3, 262 },
+		{ "727447316337117436", 10, 3, 307 },
+		{ "51714215567215466", 10, 1, 323 },
+		{ "75177527126441", 10, 3, 181 },
+		{ "7424344612351766", 10, 3, 244 },
+	};
+
+	const Bench_position opening_positions[] =
+	{
+		{ "5441", 10, 2, 200 },
+		{ "147324", 10, 3, 119 },
+		{ "2613", 10, 2, 118 },
+		{ "174744", 10, 3, 183 },
+		{ "133", 10, 2, 107 },
+		{ "766", 10, 3, 102 },
+		{ "13", 10, 2, 101 },
+		{ "6463", 10, 3, 154 },
+		{ "244", 10, 3, 105 },
+		{ "32", 10, 2, 118 },
+		{ "571", 10, 4, 100 },
+		{ "777222", 10, 3, 135 },
+		{ "621517", 10, 1, 136 },
+		{ "52", 10, 4, 137 },
+		{ "11144", 10, 5, 134 },
+		{ "6614", 10, 3, 101 },
+	};
+
+	const Bench_set bench_sets[] =
+	{
+		{ "endgame_easy", endgame_easy_positions, sizeof(endgame_easy_positions) / sizeof(Bench_position) },
+		{ "midgame_hard", midgame_hard_positions, sizeof(midgame_hard_positions) / sizeof(Bench_position) },
+		{ "opening", opening_positions, sizeof(opening_positions) / sizeof(Bench_position) },
+	};
+
+} // namespace con4game
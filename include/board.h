@@ -1,8 +1,14 @@
 #pragma once
 
+#include "evaluation.h"
 #include "global.h"
+#include "nnue.h"
+#include "search.h"
+#include "transposition_table.h"
 
 #include <array>
+#include <chrono>
+#include <memory>
 #include <stack>
 #include <vector>
 #include <utility>
@@ -56,7 +62,7 @@ public:
 	* Check whether a player has won the game.
 	* @return non-zero if has won
 	*/
-	uint64_t has_won(uint64_t newboard);
+	static uint64_t has_won(uint64_t newboard);
 
 	/**
 	 * Check whether a player has won the game.
@@ -81,6 +87,22 @@ public:
 	*/
 	bool is_legal(uint64_t newboard) const;
 
+	/**
+	 * Get the empty squares that would complete four in a row for the given counters.
+	 * Squares anywhere on the board count, not only those a counter can be dropped into.
+	 */
+	static uint64_t winning_squares(uint64_t counters, uint64_t occupied);
+
+	/**
+	 * Get the squares a counter can be dropped into, the lowest empty square of every column that has room.
+	 */
+	uint64_t playable_squares() const;
+
+	/**
+	 * Get the number of counters on the board.
+	 */
+	int get_plies() const;
+
 	/**
 	 * Undo last move.
 	 * @return true if successful
@@ -94,6 +116,81 @@ public:
 	 */
 	int find_best_move(int player);
 
+	/*
+	 * Find the best move for the specified player with a fixed search depth.
+	 * @param player  the player
+	 * @param depth   the search depth in plies
+	 * @return the best column for that player
+	 */
+	int find_best_move(int player, int depth);
+
+	/*
+	 * Find the best move for the specified player within the given limits.
+	 * @param player  the player
+	 * @param limits  the depth, time and stop limits
+	 * @return the best column for that player
+	 */
+	int find_best_move(int player, const Search_limits& limits);
+
+	/**
+	 * Get a key which identifies the position, i.e., the counters and the player to move.
+	 * @return the key, below 2^49.
+	 */
+	uint64_t get_key() const;
+
+	/**
+	 * Set the search features.
+	 */
+	void set_options(const Search_options& options);
+
+	/**
+	 * Get the search features.
+	 */
+	const Search_options& get_options() const;
+
+	/**
+	 * Use the given transposition table, which may be shared with other boards searched on the same thread.
+	 * Without one, a table of TRANSPOSITION_TABLE_MB is allocated by the first search that needs it.
+	 * @param table  the table
+	 */
+	void set_transposition_table(const std::shared_ptr<Transposition_table>& table);
+
+	/**
+	 * Get the transposition table.
+	 * @return the table, null before the first search that uses it.
+	 */
+	Transposition_table* get_transposition_table() const;
+
+	/**
+	 * Use the given network when the options select Evaluator::NNUE. Its accumulators are updated
+	 * by every move and undo from then on, so a board without a network does not pay for them.
+	 * @param network  the network, null to drop it
+	 */
+	void set_network(const std::shared_ptr<const Nnue>& network);
+
+	/**
+	 * Get the network.
+	 * @return the network, null if none is set.
+	 */
+	const Nnue* get_network() const;
+
+	/**
+	 * Use the given weights for the classic evaluation, e.g. weights tuned by connectfour_tune.
+	 * @param weights  the weights, get_classic_weights() by default
+	 */
+	void set_eval_weights(const Eval_weights& weights);
+
+	/**
+	 * Get the weights of the classic evaluation.
+	 */
+	const Eval_weights& get_eval_weights() const;
+
+	/**
+	 * Get the result and statistics of the last search.
+	 * @return the statistics, valid until the next search.
+	 */
+	const Search_stats& get_search_stats() const;
+
 protected:
 	/**
 	 * The recursive Negamax algorithm.
@@ -101,11 +198,35 @@ protected:
 	 */
 	std::pair<int, int> negamax_alpha_beta_pruning(int depth, int alpha, int beta, int player, int sign);
 
+	/**
+	 * The MTD(f) driver: null-window searches around a guess until the lower and upper bounds meet.
+	 * The transposition table carries the bounds found by one probe over to the next.
+	 * @param depth  the search depth
+	 * @param guess  the first test value, usually the score of the previous iteration
+	 * @return the best column and its score, or column -1 if the search was stopped.
+	 */
+	std::pair<int, int> mtdf(int depth, int guess, int player);
+
+	/**
+	 * Get the transposition table key of the current position for a search by the given player.
+	 * The evaluation is from the searching player's view, so the player is part of the key.
+	 */
+	uint64_t search_key(int player) const;
+
+	/**
+	 * Check whether the running search has to be abandoned.
+	 * @return true if the stop flag is set or the time budget is spent.
+	 */
+	bool should_stop();
+
 	/** The evaluation function. */
 	int evaluate(int player);
 
-	/** Helper function for the evaluation function. */
-	int evaluate(int row, int column, int player);
+	/**
+	 * Get the tag of the evaluation that evaluate() uses, for the transposition table:
+	 * the evaluator in the high half and a hash of its weights or network in the low half.
+	 */
+	uint64_t get_evaluation_id() const;
 
 private:
 	/**
@@ -151,9 +272,74 @@ private:
 	std::array<int, BOARD_WIDTH> height;
 
 	/**
-	 * How many board states that have been evaluated.
+	 * Statistics of the last or running search.
+	 */
+	Search_stats stats;
+
+	/**
+	 * The search features.
+	 */
+	Search_options options;
+
+	/**
+	 * The transposition table, shared between copies of the board.
+	 */
+	std::shared_ptr<Transposition_table> table;
+
+	/**
+	 * The network, shared between copies of the board, may be null.
+	 */
+	std::shared_ptr<const Nnue> network;
+
+	/**
+	 * The first layer of the network for the counters on the board, valid if there is a network.
+	 */
+	Nnue_accumulator accumulator;
+
+	/**
+	 * The weights of the classic evaluation.
+	 */
+	Eval_weights weights;
+
+	/**
+	 * The table used by the running search, null if disabled.
+	 */
+	Transposition_table* active_table;
+
+	/**
+	 * The number of plies at the root of the running search.
+	 */
+	int root_plies;
+
+	/**
+	 * The depth of the running iteration, which bounds how far extensions may lengthen a line.
+	 */
+	int root_depth;
+
+	/**
+	 * The stop flag of the running search, may be null.
+	 */
+	const std::atomic<bool>* stop_flag;
+
+	/**
+	 * When the running search runs out of time, if it has a time budget.
+	 */
+	std::chrono::steady_clock::time_point deadline;
+
+	/**
+	 * Whether the running search has a time budget.
+	 */
+	bool has_deadline;
+
+	/**
+	 * Whether the running search may be abandoned, i.e., an earlier depth has completed.
+	 */
+	bool can_abort;
+
+	/**
+	 * Set once the running search has been abandoned.
 	 */
-	int iterations;
+	bool aborted;
 };
 
 } // namespace con4game
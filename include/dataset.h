@@ -0,0 +1,136 @@
+#pragma once
+
+#include "platform.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+
+/**
+ * A labelled position of a training set, as it is stored in a record file.
+ */
+struct Training_record
+{
+	/** A result for the player to move. */
+	enum Result : uint8_t { LOSS, DRAW, WIN, UNKNOWN };
+
+	/** The counters of player 1 and player 2, as Board::get_board() holds them. */
+	uint64_t bitboard[2];
+	/** The score of the search for the player to move, in the units of the engine that searched. */
+	int32_t score;
+	/** The index of the bitboard of the player to move. */
+	uint8_t side;
+	/** The result with perfect play, UNKNOWN if the position was not solved. */
+	uint8_t exact;
+	/** The result of the game the position was taken from. */
+	uint8_t outcome;
+	uint8_t reserved;
+};
+
+static_assert(sizeof(Training_record) == 24, "records are stored as they are in memory");
+
+/**
+ * Writes records to a series of files (shards) named PREFIX-0000.c4r, PREFIX-0001.c4r, and so on.
+ * A shard starts with a header and ends after a given number of records, so that the shards of a large set
+ * can be moved, mapped and shuffled separately. Records are collected in a buffer and written in large blocks.
+ * A writer is not thread-safe; give every thread its own prefix.
+ * @author Samuel I. Gunadi
+ */
+class Record_writer
+{
+public:
+	/**
+	 * @param prefix         the path of the shards without the shard number
+	 * @param shard_records  the number of records per shard
+	 * @param buffer_records the number of records collected before they are written
+	 */
+	Record_writer(const std::string& prefix, long long shard_records, std::size_t buffer_records = 1 << 16);
+
+	/** Flush the buffer. */
+	~Record_writer();
+
+	/**
+	 * Add a record.
+	 * @return false if writing failed, see get_error()
+	 */
+	bool write(const Training_record& record);
+
+	/**
+	 * Write the buffered records and close the shard.
+	 * @return false if writing failed, see get_error()
+	 */
+	bool close();
+
+	/**
+	 * Get the number of records added.
+	 */
+	long long get_count() const;
+
+	/**
+	 * Get the number of shards created.
+	 */
+	int get_shards() const;
+
+	/**
+	 * Get the message of the first failure, empty if there was none.
+	 */
+	const std::string& get_error() const;
+
+private:
+	/** Write the buffered records, opening the next shard first if necessary. */
+	bool flush();
+
+	std::string prefix;
+	long long shard_records;
+	std::vector<Training_record> buffer;
+	std::ofstream file;
+	/** Records in the open shard. */
+	long long in_shard;
+	long long count;
+	int shards;
+	std::string error;
+};
+
+/**
+ * A record file mapped into memory, read-only in effect: the pages are read on first access.
+ * @author Samuel I. Gunadi
+ */
+class Record_file
+{
+public:
+	/**
+	 * Map a shard written by Record_writer.
+	 * @param path   the file
+	 * @param error  receives a message if the file is not a record file
+	 * @return the file, null if mapping fails
+	 */
+	static std::unique_ptr<Record_file> open(const std::string& path, std::string& error);
+
+	/**
+	 * Get the records.
+	 */
+	const Training_record* get_records() const;
+
+	/**
+	 * Get the number of records.
+	 */
+	std::size_t get_count() const;
+
+private:
+	explicit Record_file(std::unique_ptr<Large_memory> memory);
+
+	std::unique_ptr<Large_memory> memory;
+};
+
+/**
+ * Get the name of shard `index` of a prefix, PREFIX-NNNN.c4r.
+ */
+std::string get_shard_name(const std::string& prefix, int index);
+
+} // namespace con4game
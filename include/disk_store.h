@@ -0,0 +1,156 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace con4game
+{
+
+class Transposition_table;
+
+/**
+ * Second level of the transposition table, on disk.
+ *
+ * The store is a bucketed table much larger than the hot table in memory, split into shard files.
+ * A disk bucket is addressed by the hot bucket index followed by the low check bits, so that
+ * an entry evicted from the hot table, which keeps no full key, can still be placed and found again.
+ * Entries are stored in the packed format of the hot table.
+ *
+ * Both directions go through one I/O thread, so the search never waits for the disk:
+ * - evicted entries are collected into batches, and each batch is sorted and merged into the files
+ *   page by page in ascending order, so that the writes sweep sequentially through every shard;
+ * - a lookup queues a read, and the I/O thread copies an entry it finds back into the hot table,
+ *   where a later visit of the position finds it.
+ * The shard files are kept between runs if their header matches the table shape.
+ * @author Samuel I. Gunadi
+ */
+class Disk_store
+{
+public:
+	/** Counters of the disk traffic. */
+	struct Stats
+	{
+		/** Entries handed over for writing. */
+		long long spilled = 0;
+		/** Batches merged into the files. */
+		long long write_batches = 0;
+		long long bytes_written = 0;
+		long long bytes_read = 0;
+		/** Lookups queued. */
+		long long reads = 0;
+		/** Lookups dropped because the queue was full. */
+		long long reads_dropped = 0;
+		/** Lookups that found the entry and copied it into the hot table. */
+		long long read_hits = 0;
+	};
+
+	/**
+	 * Open or create the shard files.
+	 * @param directory  an existing directory for the shard files
+	 * @param size_mb    the total size of the files in megabytes, rounded down to a power of two buckets
+	 * @param shards     the number of shard files, a power of two
+	 */
+	Disk_store(const std::string& directory, std::size_t size_mb, int shards = 16);
+	/** Non-copyable. */
+	Disk_store(const Disk_store&) = delete;
+	/** Write the pending entries and close the files. */
+	~Disk_store();
+
+	/**
+	 * Check whether the files could be opened.
+	 */
+	bool is_open() const;
+
+	/**
+	 * Get why the files could not be opened.
+	 */
+	const std::string& get_error() const;
+
+	/**
+	 * Connect the hot table. Called by Transposition_table::attach_disk.
+	 * Existing files that were written for a hot table of another size are emptied.
+	 * @param table        the hot table that lookups fill
+	 * @param bucket_bits  log2 of the number of hot buckets
+	 */
+	void bind(Transposition_table* table, int bucket_bits);
+
+	/**
+	 * Queue an entry evicted from the hot table.
+	 * @param bucket  the hot bucket index
+	 * @param word    the packed entry
+	 */
+	void spill(uint64_t bucket, uint64_t word);
+
+	/**
+	 * Queue a lookup. If found, the entry is copied into the hot table.
+	 * @param bucket  the hot bucket index
+	 * @param check   the check bits of the key
+	 */
+	void request(uint64_t bucket, uint32_t check);
+
+	/**
+	 * Wait until every queued entry is written and every queued lookup is done.
+	 */
+	void flush();
+
+	/** Get the counters. */
+	Stats get_stats() const;
+
+	/** Get the size of the files in bytes. */
+	std::size_t get_size() const;
+
+private:
+	/** A queued lookup. */
+	struct Read_request
+	{
+		uint64_t bucket;
+		uint32_t check;
+	};
+
+	/** Index of the disk bucket of a hot bucket and check. */
+	uint64_t disk_bucket(uint64_t bucket, uint32_t check) const;
+
+	/** Read or write a range of a shard file. */
+	bool read_at(int shard, uint64_t offset, void* data, std::size_t bytes);
+	bool write_at(int shard, uint64_t offset, const void* data, std::size_t bytes);
+
+	/** Merge a batch of (disk bucket, word) pairs into the files. */
+	void write_batch(std::vector<std::pair<uint64_t, uint64_t>>& batch);
+
+	/** Serve one lookup. */
+	void read_entry(const Read_request& request);
+
+	/** Body of the I/O thread. */
+	void run();
+
+	std::string directory;
+	std::string error;
+	/** File handles (descriptors, or HANDLEs on Windows), one per shard. */
+	std::vector<intptr_t> files;
+	int shard_bits;
+	/** log2 of the number of disk buckets. */
+	int disk_bits;
+	/** log2 of the number of hot buckets, -1 until bound. */
+	int hot_bits;
+	Transposition_table* table;
+
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	/** Entries collected for the next batch. */
+	std::vector<std::pair<uint64_t, uint64_t>> collecting;
+	std::deque<std::vector<std::pair<uint64_t, uint64_t>>> batches;
+	std::deque<Read_request> reads;
+	bool busy;
+	bool stopping;
+	Stats stats;
+	std::thread worker;
+};
+
+} // namespace con4game
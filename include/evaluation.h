@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace con4game
+{
+
+/** The directions of a window of four squares. */
+enum Window_direction { VERTICAL, HORIZONTAL, DIAGONAL_UP, DIAGONAL_DOWN };
+
+const int WINDOW_DIRECTIONS = 4;
+
+/**
+ * Weights of the classic evaluation, by direction and by the number of counters (1 to 4) in a window.
+ * A window scores the `own` weight for the evaluated player if the opponent has no counter in it,
+ * and the `other` weight, which is subtracted, if the player has none in it.
+ */
+struct Eval_weights
+{
+	int32_t own[WINDOW_DIRECTIONS][4];
+	int32_t other[WINDOW_DIRECTIONS][4];
+	/**
+	 * Whether the evaluated player is the player to move, as for the weights connectfour_tune learns,
+	 * rather than the searching player, as for the hand-set ones. Such weights are learned from unfinished
+	 * games only, so a finished game is scored -SCORE_EVAL_MAX without them and the weights of four counters are unused.
+	 */
+	bool player_to_move;
+};
+
+/**
+ * The windows of a position by direction and by the number of counters in them (1 to 4),
+ * counting only the windows that hold counters of one player.
+ */
+struct Window_counts
+{
+	/** Windows of the evaluated player without an opponent counter. */
+	uint8_t own[WINDOW_DIRECTIONS][4];
+	/** Windows of the opponent without a counter of the evaluated player. */
+	uint8_t other[WINDOW_DIRECTIONS][4];
+};
+
+/**
+ * Get the hand-set weights: the number of counters to the fourth power in every direction, nothing for the opponent.
+ */
+Eval_weights get_classic_weights();
+
+/**
+ * Get a hash of weights, which tells them apart in the tag of a transposition table.
+ */
+uint32_t hash_eval_weights(const Eval_weights& weights);
+
+/**
+ * Count the windows of four squares of a position.
+ * All windows of a direction are counted at once: the counters of the four squares of every window
+ * are added bit-sliced into three bitboards, which hold the tally of the window at the bit of its first square.
+ * @param own    the counters of the evaluated player
+ * @param other  the counters of the opponent
+ * @param counts receives the counts
+ */
+void count_windows(uint64_t own, uint64_t other, Window_counts& counts);
+
+/**
+ * Score window counts with weights, for the evaluated player, clamped to ±SCORE_EVAL_MAX.
+ */
+int evaluate_windows(const Window_counts& counts, const Eval_weights& weights);
+
+/**
+ * Score a position for the first player with the pattern tables of Evaluator::PATTERN; the score of the
+ * second player is its negation. Every window of four squares is extracted from the bitboards as a pattern
+ * index, the counters of both players in its four squares, and scored by a table generated at compile time
+ * for the rows the window covers, which rewards a threat of three on a row of the player's parity.
+ * @param first   the counters of the first player
+ * @param second  the counters of the second player
+ */
+int evaluate_patterns(uint64_t first, uint64_t second);
+
+/**
+ * Write weights as text, replacing the file in a single rename.
+ * @return true if successful
+ */
+bool save_eval_weights(const std::string& path, const Eval_weights& weights);
+
+/**
+ * Read weights written by save_eval_weights. Directions and a view missing from the file keep their values.
+ * @param error  receives a message if loading fails
+ * @return true if successful
+ */
+bool load_eval_weights(const std::string& path, Eval_weights& weights, std::string& error);
+
+} // namespace con4game
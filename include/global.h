@@ -27,5 +27,20 @@ namespace con4game
 	const int WINDOW_HEIGHT = STONE_SIZE * BOARD_HEIGHT + TEXT_SIZE * 3;
 
 	const int MAX_SEARCH_DEPTH = 8;
+	/** Default transposition table size in megabytes. */
+	const int TRANSPOSITION_TABLE_MB = 16;
+	/** Snapshot of the transposition table the game loads at start and saves at exit. */
+	const char* const TRANSPOSITION_TABLE_FILE = "connectfour.tt";
+	/** Network the game evaluates positions with, if the file exists at start; a trained one is data/connectfour.nnue. */
+	const char* const NNUE_FILE = "connectfour.nnue";
+	/** Weights of the classic evaluation the game loads at start if the file exists; tuned ones are data/connectfour.weights. */
+	const char* const EVAL_WEIGHTS_FILE = "connectfour.weights";
+	/** Bound of the search window; negating it must not overflow. */
+	const int SCORE_INFINITY = 1000000;
+	/** Score of a decided game, above every heuristic score and below SCORE_INFINITY; it must fit the 16-bit score of a table entry. */
+	const int SCORE_WIN = 30000;
+	/** Bound of heuristic scores, which every evaluator stays within so that a decided game outranks them. */
+	const int SCORE_EVAL_MAX = 25000;
+	static_assert(SCORE_EVAL_MAX < SCORE_WIN && SCORE_WIN < SCORE_INFINITY, "a decided game outranks every heuristic score and stays inside the search window");
 
 } // namespace con4game
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace con4game
+{
+
+/**
+ * Severity of a log message.
+ */
+enum class Log_level { DEBUG, INFO, WARNING, CRITICAL };
+
+/**
+ * Asynchronous logger.
+ * Producers format their message into a fixed-size record and push it into a bounded lock-free ring buffer.
+ * A background thread adds the timestamp and severity and writes the records to the output.
+ * When the buffer is full the message is dropped and counted instead of blocking the producer.
+ * @author Samuel I. Gunadi
+ */
+class Logger
+{
+public:
+	/** Maximum message length, longer messages are truncated. */
+	static const int MESSAGE_SIZE = 112;
+	/** Number of records in the ring buffer, a power of two. */
+	static const int CAPACITY = 1024;
+
+	/**
+	 * Get the process-wide logger.
+	 */
+	static Logger& get();
+
+	/** Non-copyable. */
+	Logger(const Logger&) = delete;
+	/** Drains the buffer and stops the background thread. */
+	~Logger();
+
+	/**
+	 * Queue a printf-style message. Never blocks.
+	 * @param level   the severity
+	 * @param format  the printf format string
+	 */
+	void write(Log_level level, const char* format, ...);
+
+	/**
+	 * Check whether messages of the given severity are written.
+	 */
+	bool is_enabled(Log_level level) const;
+
+	/**
+	 * Set the lowest severity that is written.
+	 * The default is DEBUG in debug builds and INFO otherwise.
+	 */
+	void set_level(Log_level level);
+
+	/**
+	 * Set the output stream, stdout by default. The logger does not close it.
+	 */
+	void set_output(std::FILE* output);
+
+	/**
+	 * Wait until every queued message has been written.
+	 */
+	void flush();
+
+	/**
+	 * Get the number of messages dropped because the buffer was full.
+	 */
+	uint64_t get_dropped() const;
+
+private:
+	/** A queued message. */
+	struct Record
+	{
+		/** Sequence number of the slot, see push and pop. */
+		std::atomic<uint64_t> sequence;
+		Log_level level;
+		int64_t time_ns;
+		char message[MESSAGE_SIZE];
+	};
+
+	Logger();
+
+	/** Take the oldest record and write it. @return false if the buffer is empty. */
+	bool pop();
+
+	/** Body of the background thread. */
+	void run();
+
+	std::unique_ptr<std::array<Record, CAPACITY>> records;
+	/** Next slot to write, shared by the producers. */
+	std::atomic<uint64_t> head;
+	/** Next slot to read, owned by the background thread. */
+	uint64_t tail;
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> queued;
+	std::atomic<uint64_t> dropped;
+	/** Dropped count already reported in the output. */
+	uint64_t reported_dropped;
+	std::atomic<int> level;
+	std::atomic<std::FILE*> output;
+	std::atomic<bool> running;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::thread worker;
+};
+
+} // namespace con4game
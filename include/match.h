@@ -0,0 +1,219 @@
+#pragma once
+
+#include "board.h"
+#include "mcts.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+
+/**
+ * The search an engine plays with.
+ * ALPHA_BETA: the negamax search of Board.
+ * MCTS:       Monte Carlo tree search.
+ */
+enum class Engine_type { ALPHA_BETA, MCTS };
+
+/**
+ * Configuration of one engine taking part in a match.
+ * @author Samuel I. Gunadi
+ */
+struct Engine_config
+{
+	/** Display name, the configuration text by default. */
+	std::string name;
+	/** The search the engine plays with. */
+	Engine_type type = Engine_type::ALPHA_BETA;
+	/** Limits of every move search. */
+	Search_limits limits;
+	/** Search features. */
+	Search_options options;
+	/** Transposition table size in megabytes, or the node pool size of MCTS. */
+	int hash_mb = TRANSPOSITION_TABLE_MB;
+	/** Threads searching the tree of an MCTS engine. */
+	int threads = 1;
+	/** Random games that evaluate a leaf of an MCTS engine. */
+	int playout_batch = 1;
+	/** The network of Evaluator::NNUE, shared by all workers. */
+	std::shared_ptr<const Nnue> network;
+	/** The weights of Evaluator::CLASSIC. */
+	Eval_weights weights = get_classic_weights();
+	/** Page size and NUMA placement of the transposition table. */
+	Memory_options memory;
+	/** Name of a shared memory segment holding the transposition table, empty for a private table per worker. */
+	std::string shared_table;
+};
+
+/**
+ * Win, draw and loss counts of the first engine, and the time both engines spent.
+ */
+struct Match_stats
+{
+	long long wins = 0;
+	long long draws = 0;
+	long long losses = 0;
+	/** Moves searched by each engine. */
+	long long moves[2] = { 0, 0 };
+	/** Time spent searching by each engine. */
+	long long time_ns[2] = { 0, 0 };
+	/** Leaf evaluations of each engine, the playouts of MCTS. */
+	long long leaf_evals[2] = { 0, 0 };
+
+	long long games() const;
+	void add(const Match_stats& other);
+};
+
+/**
+ * Elo difference of the first engine with the bounds of its 95% confidence interval.
+ */
+struct Elo_estimate
+{
+	double score;
+	double elo;
+	double lower;
+	double upper;
+};
+
+/**
+ * Parameters of a sequential probability ratio test between two Elo hypotheses.
+ */
+struct Sprt_config
+{
+	/** Elo difference of the null hypothesis. */
+	double elo0 = 0;
+	/** Elo difference of the alternative hypothesis. */
+	double elo1 = 5;
+	/** Probability of accepting H1 when H0 is true. */
+	double alpha = 0.05;
+	/** Probability of accepting H0 when H1 is true. */
+	double beta = 0.05;
+
+	/** Log-likelihood ratio at which H0 is accepted. */
+	double lower_bound() const;
+	/** Log-likelihood ratio at which H1 is accepted. */
+	double upper_bound() const;
+};
+
+/**
+ * Resumable state of an SPRT run.
+ */
+struct Sprt_state
+{
+	/** Engine configuration texts, to refuse resuming a different test. */
+	std::string configs[2];
+	int opening_plies = 2;
+	Sprt_config sprt;
+	Match_stats stats;
+	/** Index of the next game to play. */
+	long long next_game = 0;
+};
+
+/**
+ * Parse an engine configuration of comma separated key=value pairs, e.g. "depth=8,time=100".
+ * Known keys: engine (alphabeta or mcts), depth, time (milliseconds per move), playouts (MCTS playouts per move),
+ * threads (MCTS search threads), batch (MCTS random games per leaf), tt (0 or 1), root (alphabeta or mtdf),
+ * lmr (0 or 1, late move reductions), ext (0 or 1, threat extensions), threats (0 or 1, zugzwang rules),
+ * eval (classic, nnue or pattern), nnue (network file, implies eval=nnue; NNUE_FILE by default), weights (classic evaluation weights file), hash (megabytes),
+ * huge (0 or 1, huge pages), numa (default, interleave or local), shm (shared table name), name.
+ * @param text    the configuration text
+ * @param config  receives the configuration
+ * @param error   receives a message if parsing fails
+ * @return true if every key was understood.
+ */
+bool parse_engine_config(const std::string& text, Engine_config& config, std::string& error);
+
+/**
+ * Enumerate every opening of the given number of plies that does not end the game.
+ * @return the openings as 1-based column digit strings.
+ */
+std::vector<std::string> make_openings(int plies);
+
+/**
+ * Estimate the Elo difference from a match result using the trinomial score variance.
+ */
+Elo_estimate estimate_elo(const Match_stats& stats);
+
+/**
+ * Compute the generalized SPRT log-likelihood ratio of a match result,
+ * using the normal approximation of the trinomial score distribution.
+ * @return the log-likelihood ratio of H1 against H0, 0 while the variance is still zero.
+ */
+double sprt_llr(const Match_stats& stats, const Sprt_config& sprt);
+
+/**
+ * Save an SPRT state as text, replacing the file in a single rename.
+ * @return true if successful
+ */
+bool save_sprt_state(const std::string& path, const Sprt_state& state);
+
+/**
+ * Load an SPRT state saved by save_sprt_state.
+ * @return true if successful
+ */
+bool load_sprt_state(const std::string& path, Sprt_state& state);
+
+/**
+ * Plays games between two engine configurations on Board objects, without the GUI.
+ * Every opening is played twice with colours swapped.
+ * @author Samuel I. Gunadi
+ */
+class Match
+{
+public:
+	/**
+	 * @param first     the engine whose results are reported
+	 * @param second    the opponent
+	 * @param openings  the opening set, must not be empty
+	 * @param threads   the number of games played in parallel
+	 * @param pin       pin every worker thread to its own CPU, spreading them over the NUMA nodes
+	 */
+	Match(const Engine_config& first, const Engine_config& second, const std::vector<std::string>& openings, int threads, bool pin = false);
+
+	/**
+	 * Map the shared table of every alpha-beta engine configured with shm=NAME. Call it before play(),
+	 * whose workers all use these tables; the mappings are kept until the match is destroyed.
+	 * @param error  receives a message if a segment cannot be opened
+	 * @return true if successful
+	 */
+	bool open_shared_tables(std::string& error);
+
+	/**
+	 * Play a range of games. Game `i` uses opening `i / 2` (wrapping around),
+	 * with the first engine moving first in even games. Engines without a shared table get one table per worker.
+	 * @param first_game  index of the first game
+	 * @param count       the number of games
+	 * @return the combined statistics of these games.
+	 */
+	Match_stats play(long long first_game, long long count) const;
+
+	/**
+	 * Play a single game.
+	 * @param index   the game index
+	 * @param stats   receives the result and timing
+	 * @param tables  the transposition table of each engine, cleared before the game unless it is shared
+	 * @param trees   the search tree of each MCTS engine, cleared before the game
+	 */
+	void play_game(long long index, Match_stats& stats, const std::shared_ptr<Transposition_table> tables[2],
+		const std::unique_ptr<Mcts> trees[2]) const;
+
+	/**
+	 * Describe how the last play() allocated the tables of an engine and pinned its workers.
+	 */
+	std::string get_memory_description(int engine) const;
+
+private:
+	Engine_config engines[2];
+	std::vector<std::string> openings;
+	int threads;
+	bool pin;
+	/** The tables mapped by open_shared_tables(), null for engines without one. */
+	std::shared_ptr<Transposition_table> shared_tables[2];
+	/** What the workers of the last play() reported about their tables. */
+	mutable std::string memory_descriptions[2];
+	mutable int pinned_workers;
+};
+
+} // namespace con4game
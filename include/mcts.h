@@ -0,0 +1,169 @@
+#pragma once
+
+#include "board.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace con4game
+{
+
+/**
+ * Monte Carlo tree search (UCT) engine, an alternative to the negamax search of Board.
+ *
+ * Every iteration descends the tree by the UCB1 formula, expands the leaf it reaches with all of its moves,
+ * plays a random game from one of the new children with play_random_games,
+ * and adds the result to every node on the path. The move played is the most visited child of the root.
+ *
+ * Nodes come from a preallocated pool and the children of a node are contiguous in it,
+ * so a node only keeps the index of its first child and their count. When the pool is full
+ * the tree stops growing and the search continues with playouts from its leaves.
+ *
+ * With several threads every thread descends the same tree (tree parallelisation) without locks:
+ * the statistics are atomic counters, a descent counts its visit on the way down so that
+ * the pending playout scores as a loss (virtual loss) and steers the other threads to other branches,
+ * and a leaf is expanded by the thread that claims it with a compare-and-swap while the others play out from it.
+ *
+ * The search is also a solver (MCTS-solver): a node whose move wins at once, or leaves the opponent a win
+ * in one move by the threat masks of Board, is proven when it is created, and proofs are propagated up the tree.
+ * A node is won if its player to move has no move that is not lost, lost if that player has a won move,
+ * and drawn if every move is proven and none is won. Selection skips proven children, a descent that reaches
+ * a proven node counts its result without a playout, and the search ends as soon as the root is proven.
+ *
+ * A leaf can be evaluated by a batch of random games instead of one (leaf parallelisation),
+ * which play_random_games plays several at a time in the lanes of vector registers.
+ *
+ * The tree is kept between moves: if the next search starts from a position one or two plies
+ * below the old root, the subtree of that position is copied to the front of a second pool and the pools swap.
+ * @author Samuel I. Gunadi
+ */
+class Mcts
+{
+public:
+	/**
+	 * Allocate the node pools.
+	 * @param size_mb  the memory of both pools together in megabytes
+	 * @param threads  the number of threads searching the tree
+	 */
+	explicit Mcts(std::size_t size_mb, int threads = 1);
+
+	/**
+	 * Find the best move for the specified player within the given limits.
+	 * Without a time budget or a playout limit, a default number of playouts is played.
+	 * The depth limit does not apply.
+	 * @param board   the position
+	 * @param player  the player to move
+	 * @param limits  the time budget, stop flag and playout limit
+	 * @return the best column for that player
+	 */
+	int find_best_move(const Board& board, int player, const Search_limits& limits);
+
+	/**
+	 * Get the result and statistics of the last search.
+	 * nodes counts the tree nodes created, leaf_evals the playouts, depth the deepest path taken,
+	 * proven_nodes the nodes proven, and score is the result of the chosen move from -1000 (lost) to 1000 (won),
+	 * exactly -1000, 0 or 1000 if the move is proven.
+	 */
+	const Search_stats& get_search_stats() const;
+
+	/**
+	 * Get the number of nodes of the last search's tree that were kept from the previous search.
+	 */
+	std::size_t get_reused_nodes() const;
+
+	/**
+	 * Get the number of nodes in the tree.
+	 */
+	std::size_t get_tree_size() const;
+
+	/**
+	 * Get the number of threads searching the tree.
+	 */
+	int get_threads() const;
+
+	/**
+	 * Set the number of random games that evaluate a leaf, 1 by default.
+	 * A batch counts as that many visits of every node on its path.
+	 */
+	void set_playout_batch(int games);
+
+	/**
+	 * Forget the tree, e.g., before a new game.
+	 */
+	void clear();
+
+private:
+	/** Index of no node. */
+	static const uint32_t NONE = 0xffffffff;
+	/** First child index of a node whose children are being created. */
+	static const uint32_t EXPANDING = NONE - 1;
+
+	/** The proven result of a node for the player who made the move leading to it, OPEN if it is not proven. */
+	enum Node_state : uint8_t { OPEN, WON, LOST, DRAWN };
+
+	/**
+	 * A tree node. Its statistics are from the view of the player who made the move leading to it.
+	 */
+	struct Node
+	{
+		/** Index of the first child, NONE if the node has not been expanded, EXPANDING while it is. */
+		std::atomic<uint32_t> first_child;
+		/** Descents through the node, including those whose playout has not finished yet. */
+		std::atomic<uint32_t> visits;
+		/** Sum of the playout results in half points: 2 for a win, 1 for a draw. */
+		std::atomic<uint32_t> score;
+		/** The column played to reach the node. */
+		uint8_t move;
+		uint8_t child_count;
+		/** Node_state, which only changes from OPEN to a proven result. */
+		std::atomic<uint8_t> state;
+	};
+
+	/** Shared state of the threads of a search. */
+	struct Search_state;
+
+	/** Run iterations until the search ends, counting playouts, depth and proofs in the thread's statistics. */
+	void search(const Board& board, Search_state& state, uint64_t random_state, Search_stats& thread_stats);
+
+	/** Initialise a node. */
+	void make_node(Node& node, int move, int state);
+
+	/** Allocate contiguous nodes, NONE if the pool is full. */
+	uint32_t allocate(std::size_t count);
+
+	/**
+	 * Create the children of a node for the position on the board, unless another thread is doing so.
+	 * @return the number of nodes proven: the children and the node itself
+	 */
+	int expand(Node& node, Board& board);
+
+	/**
+	 * Prove an expanded node from the results of its children, if they decide it.
+	 * @return true if the node was proven now
+	 */
+	bool prove(Node& node);
+
+	/** Pick the child to descend to by the UCB1 formula among those not proven, NONE if every child is proven. */
+	uint32_t select(const Node& node, uint32_t first_child) const;
+
+	/** Move the root to the node of the given position if the tree holds it, otherwise start a new tree. */
+	void reuse_tree(const Board& board);
+
+	/** The active pool and the pool the kept subtree is copied to. */
+	std::unique_ptr<Node[]> pools[2];
+	std::size_t capacity;
+	int active;
+	std::atomic<std::size_t> used;
+	uint32_t root;
+	/** The position at the root. */
+	Board root_board;
+	std::size_t reused_nodes;
+	int threads;
+	int playout_batch;
+	uint64_t random_state;
+	Search_stats stats;
+};
+
+} // namespace con4game
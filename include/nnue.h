@@ -0,0 +1,129 @@
+#pragma once
+
+#include "global.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace con4game
+{
+
+/** Inputs of the network from one player's view: that player's counters on the 42 squares, then the other player's. */
+const int NNUE_INPUTS = 2 * SIZE;
+/** Neurons of the first layer for each view. */
+const int NNUE_HIDDEN = 32;
+/** Scale of the first layer: an accumulator value of NNUE_ACTIVATION_SCALE is an activation of 1, where it is clipped. */
+const int NNUE_ACTIVATION_SCALE = 127;
+/** Scale of the output weights. */
+const int NNUE_OUTPUT_SCALE = 64;
+/** Score of a network output (a logit of the expected result) of 1. */
+const int NNUE_SCORE_SCALE = 400;
+
+/**
+ * The quantised parameters of a network, as they are stored in a network file.
+ */
+struct Nnue_weights
+{
+	/** First layer weights, the column of an input is added to the accumulator when the input becomes 1. */
+	int16_t input_weights[NNUE_INPUTS][NNUE_HIDDEN];
+	int16_t input_biases[NNUE_HIDDEN];
+	/** Output weights, for the view of the player to move followed by the view of the other player. */
+	int8_t output_weights[2 * NNUE_HIDDEN];
+	int32_t output_bias;
+};
+
+/**
+ * The first layer of the network for both views of a position, by the index of the player's bitboard.
+ */
+struct Nnue_accumulator
+{
+	int16_t values[2][NNUE_HIDDEN];
+};
+
+/**
+ * A small efficiently updatable neural network (NNUE) that evaluates a position from the counters on the board.
+ *
+ * Its first layer sums the weight columns of the occupied squares into an accumulator for each player's view,
+ * so that a move adds one column to each view and undoing it subtracts them again, instead of recomputing the layer.
+ * The output is a weighted sum of the clipped accumulators, the view of the player to move first,
+ * and estimates the logit of that player's expected result.
+ *
+ * Weights and accumulators are 16-bit integers and the output weights 8-bit integers,
+ * summed with AVX2 if the build enables it, e.g. /arch:AVX2 or -mavx2, and one value at a time otherwise.
+ * @author Samuel I. Gunadi
+ */
+class Nnue
+{
+public:
+	/**
+	 * Make a network from its parameters.
+	 */
+	explicit Nnue(const Nnue_weights& weights);
+
+	/**
+	 * Read a network file written by save().
+	 * @param path   the file
+	 * @param error  receives a message if loading fails
+	 * @return the network, null if the file could not be read or is not a network of this size.
+	 */
+	static std::shared_ptr<const Nnue> load(const std::string& path, std::string& error);
+
+	/**
+	 * Write the network to a file.
+	 * @return true if successful
+	 */
+	bool save(const std::string& path) const;
+
+	/**
+	 * Get the parameters of the network.
+	 */
+	const Nnue_weights& get_weights() const;
+
+	/**
+	 * Get a hash of the parameters, which tells networks apart in the tag of a transposition table.
+	 */
+	uint32_t get_hash() const;
+
+	/**
+	 * Compute the accumulators of a position from scratch.
+	 * @param accumulator  receives the first layer of both views
+	 * @param bitboard     the counters of both players
+	 */
+	void refresh(Nnue_accumulator& accumulator, const uint64_t bitboard[2]) const;
+
+	/**
+	 * Update the accumulators for a counter dropped on a square.
+	 * @param accumulator  the first layer of both views
+	 * @param bit          the bit index of the square on the board
+	 * @param player       the index of the bitboard of the counter
+	 */
+	void add(Nnue_accumulator& accumulator, int bit, int player) const;
+
+	/**
+	 * Update the accumulators for a counter taken off a square.
+	 */
+	void remove(Nnue_accumulator& accumulator, int bit, int player) const;
+
+	/**
+	 * Evaluate a position from its accumulators.
+	 * @param accumulator  the first layer of both views
+	 * @param player       the index of the bitboard of the player to move
+	 * @return the score for that player, NNUE_SCORE_SCALE times the logit of the expected result,
+	 *         clamped to ±SCORE_EVAL_MAX so that it stays below a decided game.
+	 */
+	int evaluate(const Nnue_accumulator& accumulator, int player) const;
+
+	/**
+	 * Get the input of a counter on a square from a player's view.
+	 * @param bit     the bit index of the square on the board
+	 * @param own     true if the counter is the player's own
+	 */
+	static int get_input(int bit, bool own);
+
+private:
+	Nnue_weights weights;
+	uint32_t hash;
+};
+
+} // namespace con4game
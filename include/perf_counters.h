@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace con4game
+{
+
+/**
+ * Hardware performance counters of the calling thread.
+ * Uses perf_event_open on Linux. Counters the kernel or the container does not allow
+ * are reported as unavailable, and on other platforms none are available.
+ * @author Samuel I. Gunadi
+ */
+class Perf_counters
+{
+public:
+	/** The measured events. */
+	enum Event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, EVENT_COUNT };
+
+	/** Open the counters, disabled. */
+	Perf_counters();
+	/** Non-copyable. */
+	Perf_counters(const Perf_counters&) = delete;
+	/** Close the counters. */
+	~Perf_counters();
+
+	/**
+	 * Check whether at least one counter could be opened.
+	 */
+	bool is_available() const;
+
+	/**
+	 * Check whether a counter could be opened.
+	 */
+	bool is_available(Event event) const;
+
+	/**
+	 * Get why counters are missing, empty if all are available.
+	 */
+	const std::string& get_error() const;
+
+	/**
+	 * Reset and enable all counters.
+	 */
+	void start();
+
+	/**
+	 * Disable all counters and read them, scaled up if the kernel multiplexed them.
+	 */
+	void stop();
+
+	/**
+	 * Get the count of an event between the last start and stop, 0 if unavailable.
+	 */
+	uint64_t get(Event event) const;
+
+	/**
+	 * Get the name of an event, suitable as a JSON key.
+	 */
+	static const char* get_name(Event event);
+
+private:
+	int fds[EVENT_COUNT];
+	uint64_t counts[EVENT_COUNT];
+	std::string error;
+};
+
+} // namespace con4game
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+
+/**
+ * Where the pages of a large allocation are placed on machines with several NUMA nodes.
+ * DEFAULT:    the operating system's choice, usually the node that touches a page first.
+ * INTERLEAVE: pages round-robin over all nodes, for memory shared by threads on every node.
+ * LOCAL:      pages on the node of the allocating thread, for per-thread memory of pinned threads.
+ */
+enum class Numa_policy { DEFAULT, INTERLEAVE, LOCAL };
+
+/**
+ * How a large allocation is requested from the operating system.
+ */
+struct Memory_options
+{
+	/** Back the memory with huge pages if the system allows it, to reduce TLB misses. */
+	bool huge_pages = true;
+	/** NUMA placement of the pages. */
+	Numa_policy numa = Numa_policy::DEFAULT;
+};
+
+/**
+ * A large, zeroed block of memory allocated directly from the operating system.
+ *
+ * On Linux huge pages are tried first with MAP_HUGETLB (reserved pages), then with
+ * madvise(MADV_HUGEPAGE) on 2 MB aligned memory (transparent huge pages).
+ * On Windows large pages need the "Lock pages in memory" privilege.
+ * The NUMA policy is applied with mbind on Linux and VirtualAllocExNuma on Windows.
+ * Whatever could not be done falls back silently, and get_description() tells what took effect.
+ * @author Samuel I. Gunadi
+ */
+class Large_memory
+{
+public:
+	/**
+	 * Allocate a block.
+	 * @param bytes    the size
+	 * @param options  how to allocate it
+	 */
+	Large_memory(std::size_t bytes, const Memory_options& options);
+	/**
+	 * Map a whole file copy-on-write: pages are read on first access,
+	 * and changes stay private to the process and never reach the file.
+	 * @param path   the file
+	 * @param error  receives a message if mapping fails
+	 * @return the mapping, or nullptr if mapping fails
+	 */
+	static std::unique_ptr<Large_memory> map_file(const std::string& path, std::string& error);
+	/**
+	 * Map a named shared memory segment (shm_open on POSIX, a paging file backed mapping on Windows),
+	 * creating it zero-filled if it does not exist. Every process mapping the name sees the same memory.
+	 * @param name     the segment name, without a leading slash
+	 * @param bytes    the size if the segment is created, otherwise the size of the existing segment is used
+	 * @param created  receives true if this call created the segment
+	 * @param error    receives a message if mapping fails
+	 * @return the mapping, or nullptr if mapping fails
+	 */
+	static std::unique_ptr<Large_memory> open_shared(const std::string& name, std::size_t bytes, bool& created, std::string& error);
+	/**
+	 * Remove a named shared memory segment. Existing mappings stay valid.
+	 * @return true if successful
+	 */
+	static bool remove_shared(const std::string& name);
+	/** Non-copyable. */
+	Large_memory(const Large_memory&) = delete;
+	/** Release the block. */
+	~Large_memory();
+
+	/** Get the start of the block, aligned to at least 64 bytes. */
+	void* get() const;
+
+	/** Get the size requested. */
+	std::size_t get_size() const;
+
+	/** Check whether the block is backed by huge pages (as far as the system tells). */
+	bool has_huge_pages() const;
+
+	/**
+	 * Describe the page size and NUMA policy that took effect, e.g. "transparent huge pages, interleaved over 2 nodes".
+	 */
+	const std::string& get_description() const;
+
+private:
+	Large_memory();
+
+	/** Start of the mapping. */
+	void* base;
+	/** Size of the mapping. */
+	std::size_t mapped;
+	std::size_t size;
+	/** Offset of the aligned block in the mapping. */
+	std::size_t offset;
+	bool huge;
+	/** How to release the mapping. */
+	int kind;
+	std::string description;
+};
+
+/**
+ * Get the number of NUMA nodes with memory, 1 if unknown.
+ */
+int get_numa_node_count();
+
+/**
+ * Get the NUMA node of a logical CPU, 0 if unknown.
+ */
+int get_numa_node(int cpu);
+
+/**
+ * List the logical CPUs in the order threads should be pinned to them:
+ * round-robin over the NUMA nodes, so that consecutive threads spread over all nodes.
+ */
+std::vector<int> get_cpu_order();
+
+/**
+ * Pin the calling thread to a logical CPU.
+ * @return true if successful
+ */
+bool pin_current_thread(int cpu);
+
+/**
+ * Rename a file over another one, replacing it in a single step: readers see either the old or the new file,
+ * and a crash leaves one of them. rename() does that on POSIX; on Windows it fails if the target exists,
+ * so MoveFileEx with MOVEFILE_REPLACE_EXISTING is used there.
+ * @param from  the file to rename, usually a temporary next to the target
+ * @param to    the target
+ * @return true if successful
+ */
+bool replace_file(const std::string& from, const std::string& to);
+
+/**
+ * Get the name of a NUMA policy, as accepted by parse_numa_policy.
+ */
+const char* get_numa_policy_name(Numa_policy policy);
+
+/**
+ * Parse "default", "interleave" or "local".
+ * @return true if the name is known
+ */
+bool parse_numa_policy(const std::string& name, Numa_policy& policy);
+
+} // namespace con4game
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "board.h"
+
+#include <cstdint>
+
+namespace con4game
+{
+
+/**
+ * Results of a batch of random games, counted by the index of the winner's bitboard.
+ */
+struct Playout_counts
+{
+	long long wins[2] = { 0, 0 };
+	long long draws = 0;
+
+	long long games() const;
+};
+
+/**
+ * Implementations of play_random_games.
+ * SCALAR: one game at a time, always available.
+ * AVX2:   four games in lock-step, their bitboards held in the 64-bit lanes of a 256-bit register.
+ * AVX512: eight games in lock-step in a 512-bit register.
+ * The vector kernels exist only if the build enables the instruction set, e.g. /arch:AVX2 or -mavx2.
+ */
+enum class Playout_kernel { SCALAR, AVX2, AVX512 };
+
+/**
+ * Check whether this build contains a kernel.
+ */
+bool is_playout_kernel_available(Playout_kernel kernel);
+
+/**
+ * Get the widest kernel this build contains.
+ */
+Playout_kernel get_best_playout_kernel();
+
+/**
+ * Get the name of a kernel: scalar, avx2 or avx512.
+ */
+const char* get_playout_kernel_name(Playout_kernel kernel);
+
+/**
+ * Play random games from a position: every move is drawn uniformly from the columns that have room,
+ * until a player connects four or the board is full.
+ * Game i draws its moves from its own generator, seeded from the seed and i,
+ * so every kernel gives the same counts for the same seed.
+ * @param board   the position, the game must not be over
+ * @param games   the number of games
+ * @param seed    the seed of the games' generators
+ * @param kernel  the implementation, which must be available
+ * @return the results of the games.
+ */
+Playout_counts play_random_games(const Board& board, long long games, uint64_t seed,
+	Playout_kernel kernel = get_best_playout_kernel());
+
+} // namespace con4game
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "board.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+namespace con4game
+{
+
+/**
+ * Limits of a single proof search; the result is unknown if one is reached.
+ */
+struct Proof_limits
+{
+	/** Maximum number of searched nodes, 0 for no limit. */
+	long long max_nodes = 0;
+	/** Time budget in milliseconds, 0 for no limit. */
+	int time_ms = 0;
+	/** If set, the solve stops as soon as possible once the flag becomes true. */
+	const std::atomic<bool>* stop = nullptr;
+};
+
+/**
+ * Depth-first proof-number search (df-pn): decides whether the player to move can force a win.
+ *
+ * Every position carries a proof number phi and a disproof number delta from the view of its player to move:
+ * the least number of leaves that still have to be solved to show that the player reaches the goal,
+ * respectively that the player cannot. The attacker's goal is to win, the defender's goal is to stop the win,
+ * so a draw counts as a success for the defender. The search always expands the child that is cheapest to solve,
+ * which makes it follow narrow forcing lines instead of a fixed depth.
+ *
+ * Positions are classified with the threat masks of Board before they are searched:
+ * a player with a playable winning square has won, a player facing two has lost,
+ * a single threat leaves only the block, and moves directly below an opponent's winning square are skipped.
+ *
+ * The numbers are kept in a fixed-size table of 4-entry buckets. A full bucket replaces the entry
+ * with the smallest subtree, and when the table is 90% full the entries with the smallest subtrees
+ * are dropped until about half remain (small tree garbage collection).
+ * @author Samuel I. Gunadi
+ */
+class Proof_search
+{
+public:
+	/** Outcome of a solve, for the player to move. */
+	enum class Result { WIN, NO_WIN, UNKNOWN };
+
+	/** Statistics and result of a single solve. */
+	struct Stats
+	{
+		Result result = Result::UNKNOWN;
+		/** A winning column if the result is WIN, otherwise -1. */
+		int column = -1;
+		/** Positions searched. */
+		long long nodes = 0;
+		/** Distinct positions in the proof or disproof tree, 0 if the result is UNKNOWN. */
+		long long proof_size = 0;
+		/** Wall-clock time of the proof search in nanoseconds, without counting the proof tree. */
+		long long elapsed_ns = 0;
+		/** Garbage collections and the entries they dropped. */
+		long long gc_runs = 0;
+		long long gc_freed = 0;
+		/** Entries overwritten in full buckets. */
+		long long replacements = 0;
+		/** Entries in the table after the solve. */
+		std::size_t entries = 0;
+	};
+
+	/**
+	 * Allocate an empty table.
+	 * @param size_mb  the size in megabytes, rounded down to a power of two buckets
+	 */
+	explicit Proof_search(std::size_t size_mb);
+
+	/**
+	 * Decide whether the player to move can force a win.
+	 * The table is kept between solves.
+	 * @param board   the position
+	 * @param limits  the limits of the solve
+	 * @return WIN, NO_WIN (the opponent wins or the game is drawn), or UNKNOWN if a limit was reached.
+	 */
+	Result solve(const Board& board, const Proof_limits& limits = Proof_limits());
+
+	/**
+	 * Get the result and statistics of the last solve.
+	 */
+	const Stats& get_stats() const;
+
+	/**
+	 * Empty the table.
+	 */
+	void clear();
+
+	/**
+	 * Get the number of entries the table holds.
+	 */
+	std::size_t get_capacity() const;
+
+private:
+	/** Entries per bucket. */
+	static const int BUCKET_SIZE = 4;
+
+	/** A table entry; key 0 marks a free slot, since no position has key 0. */
+	struct Entry
+	{
+		uint64_t key;
+		uint32_t phi;
+		uint32_t delta;
+		/** Nodes searched below the position, a measure of what the entry saves. */
+		uint32_t work;
+	};
+
+	/** A classified position. */
+	struct Node
+	{
+		/** Proof and disproof numbers, final if the position is decided, otherwise initial estimates. */
+		uint32_t phi;
+		uint32_t delta;
+		/** Whether the position is decided without searching. */
+		bool terminal;
+		/** A winning column of the player to move, -1 if there is none. */
+		int win_column;
+		/** The moves worth searching. */
+		int moves[BOARD_WIDTH];
+		int move_count;
+	};
+
+	/** Classify the current position. */
+	void classify(Board& board, Node& node) const;
+
+	/** Get the numbers of the current position from the table, or classify it. */
+	void lookup(Board& board, uint32_t& phi, uint32_t& delta);
+
+	/** Get the table key of a position. */
+	uint64_t get_key(const Board& board) const;
+
+	/** Get the bucket index of a key. */
+	std::size_t get_bucket(uint64_t key) const;
+
+	/** Find the entry of a key, null if it is not in the table. */
+	const Entry* find(uint64_t key) const;
+
+	/** Store the numbers of a position. */
+	void store(uint64_t key, uint32_t phi, uint32_t delta, long long work);
+
+	/** Drop the entries with the smallest subtrees until about half of the table is free. */
+	void collect_garbage();
+
+	/** Multiple iterative deepening: search until phi >= phi_limit or delta >= delta_limit. */
+	void mid(Board& board, uint32_t phi_limit, uint32_t delta_limit);
+
+	/**
+	 * Count the distinct positions of the proof or disproof tree below the current, decided, position.
+	 * @param column  receives the winning column if the player to move wins, otherwise -1
+	 */
+	long long count_proof(Board& board, std::unordered_set<uint64_t>& visited, int& column);
+
+	/** Check whether the running solve has to be abandoned. */
+	bool should_stop();
+
+	std::vector<Entry> entries;
+	/** 64 minus log2 of the number of buckets. */
+	int bucket_shift;
+	std::size_t used;
+	/** Parity of the plies at which the attacker of the running solve is to move. */
+	int attacker_parity;
+	Stats stats;
+	Proof_limits limits;
+	std::chrono::steady_clock::time_point deadline;
+	bool aborted;
+};
+
+} // namespace con4game
@@ -0,0 +1,139 @@
+/**
+ * Defines the types shared by the search routines and their callers.
+ * @author Samuel I. Gunadi
+ */
+
+#pragma once
+
+#include "global.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+
+namespace con4game
+{
+	/**
+	 * Limits of a single search.
+	 */
+	struct Search_limits
+	{
+		/** Maximum search depth in plies. */
+		int depth = MAX_SEARCH_DEPTH;
+		/**
+		 * Time budget in milliseconds, 0 for no limit.
+		 * With a budget the search deepens iteratively and returns the result of the last completed depth.
+		 */
+		int time_ms = 0;
+		/** If set, the search stops as soon as possible once the flag becomes true. */
+		const std::atomic<bool>* stop = nullptr;
+		/** Maximum number of playouts of a Monte Carlo search, 0 for its default when there is no time budget. */
+		long long playouts = 0;
+	};
+
+	/**
+	 * How the root of each iteration is searched.
+	 * ALPHA_BETA: one search with the full window.
+	 * MTDF:       a series of null-window searches that narrow the score down from the last
+	 *             iteration's score (MTD(f)), relying on the transposition table between them.
+	 */
+	enum class Root_strategy { ALPHA_BETA, MTDF };
+
+	/**
+	 * How the search scores the positions at its horizon.
+	 * CLASSIC: the sum over the unblocked windows of four squares of the player's counters in them to the fourth power.
+	 * NNUE:    the network set on the board with Board::set_network, the classic evaluation if there is none.
+	 * PATTERN: lookup tables of the patterns of both players' counters in every window of four squares,
+	 *          which also weigh threats by the parity of their row.
+	 */
+	enum class Evaluator { CLASSIC, NNUE, PATTERN };
+
+	/**
+	 * Search features that can be switched on and off.
+	 */
+	struct Search_options
+	{
+		/** Store and reuse results in the transposition table. */
+		bool use_transposition_table = true;
+		/** How the root is searched. */
+		Root_strategy root_strategy = Root_strategy::ALPHA_BETA;
+		/**
+		 * Search quiet moves late in the move order one ply shallower with a null window,
+		 * and again at full depth only if they beat alpha.
+		 */
+		bool late_move_reductions = false;
+		/** Search forced blocks and moves that create a threat of winning one ply deeper. */
+		bool threat_extensions = false;
+		/**
+		 * Score won games and positions decided by the zugzwang rules of Threat_analysis as wins,
+		 * and stop searching them, instead of evaluating them with the heuristic.
+		 */
+		bool use_threat_analysis = false;
+		/** How positions at the horizon are scored. */
+		Evaluator evaluator = Evaluator::CLASSIC;
+	};
+
+	/**
+	 * How the move of a search was chosen.
+	 * IMMEDIATE_WIN means the player could win in one move.
+	 * BLOCK means the move prevents the opponent from winning in one move.
+	 * SEARCH means the move was found by searching.
+	 */
+	enum class Move_source { IMMEDIATE_WIN, BLOCK, SEARCH };
+
+	/**
+	 * Statistics and result of a single search.
+	 */
+	struct Search_stats
+	{
+		/** The chosen column, -1 if there was none. */
+		int column = -1;
+		/** Score of the chosen column from the point of view of the searching player. */
+		int score = 0;
+		/** Deepest completed depth, 0 if the move was chosen without searching. */
+		int depth = 0;
+		/** How the move was chosen. */
+		Move_source source = Move_source::SEARCH;
+		/** Interior nodes visited. */
+		long long nodes = 0;
+		/** Positions evaluated at the search horizon or at the end of the game. */
+		long long leaf_evals = 0;
+		/** Beta cut-offs, by the index of the move that caused them in the move loop. */
+		std::array<long long, BOARD_WIDTH> cutoffs_by_move = {};
+		/** Transposition table lookups. */
+		long long tt_probes = 0;
+		/** Transposition table lookups that found the position. */
+		long long tt_hits = 0;
+		/** Nodes whose search the transposition table made unnecessary. */
+		long long tt_cutoffs = 0;
+		/** Searches of the root, one per iteration with ALPHA_BETA, one per null-window probe with MTDF. */
+		long long root_searches = 0;
+		/** Moves searched at reduced depth. */
+		long long reductions = 0;
+		/** Reduced moves that beat alpha and were searched again at full depth. */
+		long long reduction_researches = 0;
+		/** Moves searched one ply deeper. */
+		long long extensions = 0;
+		/** Positions the zugzwang rules decided, ending the line. */
+		long long threat_cutoffs = 0;
+		/** Tree nodes proven won, lost or drawn by a Monte Carlo search. */
+		long long proven_nodes = 0;
+		/** Interior nodes visited, by distance from the root in plies. */
+		std::array<long long, SIZE + 1> nodes_by_ply = {};
+		/** Wall-clock time of the search in nanoseconds. */
+		long long elapsed_ns = 0;
+
+		/** Visited nodes per second, counting interior nodes and leaves. */
+		double nodes_per_second() const
+		{
+			return elapsed_ns > 0 ? 1e9 * (nodes + leaf_evals) / elapsed_ns : 0.0;
+		}
+
+		/** Effective branching factor, the depth-th root of the number of visited nodes. */
+		double branching_factor() const
+		{
+			return depth > 0 ? std::pow((double) (nodes + leaf_evals), 1.0 / depth) : 0.0;
+		}
+	};
+
+} // namespace con4game
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "board.h"
+
+#include <cstdint>
+
+namespace con4game
+{
+
+/** Squares of the 1st, 3rd and 5th row from the bottom. */
+const uint64_t ODD_ROWS = BOTTOM * 0x15;
+/** Squares of the 2nd, 4th and 6th row from the bottom. */
+const uint64_t EVEN_ROWS = BOTTOM * 0x2A;
+
+/**
+ * Threats of both players classified by row parity, and the outcome of the zugzwang rules.
+ *
+ * A threat is an empty square that would complete four in a row. When the board fills up,
+ * the player who does not move first in a column gets its even squares by answering every move there
+ * (claimeven), so odd threats are worth something to player 1 and even threats to player 2.
+ * Two rules decide a position whatever the search depth:
+ * - claimeven: with player 1 to move and every column holding an even number of counters,
+ *   player 2 takes all even squares by answering in the same column. If player 1 has no four
+ *   within its counters and the odd squares, and player 2 has one within its counters and the even squares,
+ *   player 2 wins.
+ * - odd threat: with player 2 to move, every column but one holding an even number of counters,
+ *   and an odd threat of player 1 in that column whose square below is empty and reached after an even
+ *   number of moves there, player 1 answers in the same column until player 2 has to play below the threat.
+ *   If player 2 has no four within its counters and the squares it gets that way, player 1 wins.
+ * @author Samuel I. Gunadi
+ */
+struct Threat_analysis
+{
+	/** Threats of player 1 (index 0) and player 2 (index 1) on odd rows. */
+	uint64_t odd_threats[2];
+	/** Threats of player 1 (index 0) and player 2 (index 1) on even rows. */
+	uint64_t even_threats[2];
+	/** The player who wins by the rules above, 0 if they do not decide the position. */
+	int winner;
+};
+
+/**
+ * Classify the threats of a position and apply the zugzwang rules.
+ * The position must not be won already.
+ */
+Threat_analysis analyse_threats(const Board& board);
+
+} // namespace con4game
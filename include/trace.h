@@ -0,0 +1,66 @@
+/**
+ * Scoped tracing spans exported as Chrome trace event JSON (chrome://tracing, Perfetto).
+ * Tracing is compiled in only when CON4_TRACE is defined; otherwise the macros expand to nothing.
+ *
+ *   CON4_TRACE_SCOPE("name");             records the enclosing scope
+ *   CON4_TRACE_SCOPE_ARG("name", value);  same, with an integer argument
+ *   CON4_TRACE_DUMP("trace.json");        writes every recorded span
+ *
+ * Span names must be string literals, they are stored as pointers.
+ * @author Samuel I. Gunadi
+ */
+
+#pragma once
+
+#ifdef CON4_TRACE
+
+#include <chrono>
+#include <cstdint>
+
+namespace con4game
+{
+
+/**
+ * Records the lifetime of a scope into the trace buffer of the calling thread.
+ */
+class Trace_scope
+{
+public:
+	explicit Trace_scope(const char* name, int64_t arg = INT64_MIN)
+	: name(name)
+	, arg(arg)
+	, start(std::chrono::steady_clock::now())
+	{
+	}
+	Trace_scope(const Trace_scope&) = delete;
+	~Trace_scope();
+
+private:
+	const char* name;
+	int64_t arg;
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Write every span recorded so far, from all threads, as Chrome trace JSON.
+ * Threads should not be recording while the trace is written.
+ * @param path  the output file
+ * @return true if successful
+ */
+bool trace_dump(const char* path);
+
+} // namespace con4game
+
+#define CON4_TRACE_CONCAT_IMPL(a, b) a##b
+#define CON4_TRACE_CONCAT(a, b) CON4_TRACE_CONCAT_IMPL(a, b)
+#define CON4_TRACE_SCOPE(name) ::con4game::Trace_scope CON4_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define CON4_TRACE_SCOPE_ARG(name, arg) ::con4game::Trace_scope CON4_TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#define CON4_TRACE_DUMP(path) ::con4game::trace_dump(path)
+
+#else
+
+#define CON4_TRACE_SCOPE(name) ((void) 0)
+#define CON4_TRACE_SCOPE_ARG(name, arg) ((void) 0)
+#define CON4_TRACE_DUMP(path) ((void) 0)
+
+#endif
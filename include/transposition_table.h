@@ -0,0 +1,252 @@
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace con4game
+{
+
+class Disk_store;
+
+/**
+ * Hash table of search results.
+ *
+ * The table is made of 64-byte buckets, each one cache line holding eight 8-byte entries.
+ * An entry keeps 32 check bits of the hashed key, the score, the remaining depth,
+ * the bound type, the best move and the generation (search) it was written in.
+ * The first seven entries of a bucket are depth-preferred, the last one is always replaced.
+ * Entries of older generations are replaced first.
+ *
+ * The single-slot layout treats every entry as its own always-replace slot,
+ * for comparison with the bucketed layout at the same memory size.
+ *
+ * The memory comes straight from the operating system, on huge pages if possible,
+ * and can be interleaved over NUMA nodes or kept on the node of the allocating thread.
+ *
+ * A table can be saved to a snapshot file and mapped back later for a warm start.
+ * The snapshot header records the format version, the board geometry and the table shape,
+ * and a snapshot which does not match this build is refused.
+ *
+ * Several processes can share one table in a named shared memory segment without locks.
+ * Entries are single words accessed atomically, and the check bits are XORed with the data,
+ * so an entry mixed from two writes does not match any key. Two writers racing for one entry
+ * can only make one of the results get lost, which the search tolerates.
+ *
+ * A Disk_store can back the table as a second level for solves that need more than memory.
+ * @author Samuel I. Gunadi
+ */
+class Transposition_table
+{
+public:
+	/** Entries per bucket. */
+	static const int BUCKET_SIZE = 8;
+
+	/**
+	 * How the stored score relates to the true score.
+	 * LOWER: the score is a lower bound (the search failed high).
+	 * UPPER: the score is an upper bound (the search failed low).
+	 */
+	enum class Bound { NONE, LOWER, UPPER, EXACT };
+
+	/** How entries are organised. */
+	enum class Layout { BUCKETED, SINGLE_SLOT };
+
+	/** Content of a found entry. */
+	struct Probe_result
+	{
+		int score;
+		int depth;
+		Bound bound;
+		/** The best column, -1 if unknown. */
+		int move;
+	};
+
+	/**
+	 * Allocate a cleared table.
+	 * @param size_mb  the size in megabytes, rounded down to a power of two buckets
+	 * @param layout   the entry layout
+	 * @param memory   how to allocate the memory
+	 */
+	explicit Transposition_table(std::size_t size_mb, Layout layout = Layout::BUCKETED, const Memory_options& memory = Memory_options());
+
+	/** Non-copyable. */
+	Transposition_table(const Transposition_table&) = delete;
+
+	/** Detach the disk store, if any. */
+	~Transposition_table();
+
+	/**
+	 * Map a snapshot written by save(). The file is mapped copy-on-write,
+	 * so its buckets are read on first use and the file itself is never changed.
+	 * On Windows the buckets are copied instead, since a mapped view keeps save() from replacing the file.
+	 * The table keeps the evaluation tag it was saved with, so the first search with another evaluation clears it.
+	 * @param path   the snapshot file
+	 * @param error  receives a message if loading fails
+	 * @return the table, or nullptr if the file is missing, truncated or of another format or board size
+	 */
+	static std::shared_ptr<Transposition_table> load(const std::string& path, std::string& error);
+
+	/**
+	 * Attach to the table in a named shared memory segment, creating it if it does not exist.
+	 * On Linux the segment stays until remove_shared() is called, on Windows until the last process detaches.
+	 * @param name     the segment name
+	 * @param size_mb  the size if the segment is created, otherwise the existing size is used
+	 * @param error    receives a message if attaching fails
+	 * @return the table, or nullptr if the segment cannot be opened or holds something else
+	 */
+	static std::shared_ptr<Transposition_table> open_shared(const std::string& name, std::size_t size_mb, std::string& error);
+
+	/**
+	 * Remove a named shared memory segment. Attached processes keep their mappings.
+	 * @return true if successful
+	 */
+	static bool remove_shared(const std::string& name);
+
+	/**
+	 * Back the table with a disk store, for the bucketed layout.
+	 * Evicted entries with at least `min_depth` remaining are written to disk,
+	 * and misses of nodes with at least `min_depth` remaining are looked up there.
+	 * Shallower entries, which are cheap to recompute and by far the most numerous, never touch the disk.
+	 * @param store      the disk store, nullptr to detach
+	 * @param min_depth  the remaining depth from which entries go to disk
+	 */
+	void attach_disk(const std::shared_ptr<Disk_store>& store, int min_depth);
+
+	/** Get the disk store, nullptr if none. */
+	Disk_store* get_disk() const;
+
+	/**
+	 * Write the table to a snapshot file, replacing it in a single rename.
+	 * @return true if successful
+	 */
+	bool save(const std::string& path) const;
+
+	/** Empty the table. */
+	void clear();
+
+	/**
+	 * Get the evaluation the stored scores come from, as Board tags it.
+	 * @return the tag, 0 if the table has not been searched with one.
+	 */
+	uint64_t get_evaluation() const;
+
+	/**
+	 * Tag the table with the evaluation of the scores stored from now on. Scores of another evaluator
+	 * or other weights would be taken as cutoffs, so a table tagged with another evaluation is cleared.
+	 * @param id  the tag, not 0
+	 */
+	void set_evaluation(uint64_t id);
+
+	/** Start a new search, which ages the entries of earlier searches. */
+	void new_search();
+
+	/**
+	 * Look up a position.
+	 * With a disk store attached, a miss of a node with at least the disk depth remaining
+	 * queues a lookup on disk, which copies the entry into the table if it is found there.
+	 * @param key     the position key
+	 * @param result  receives the entry if found
+	 * @param depth   the remaining depth of the node
+	 * @return true if found
+	 */
+	bool probe(uint64_t key, Probe_result& result, int depth = 0) const;
+
+	/**
+	 * Store a search result.
+	 * @param key    the position key
+	 * @param score  the score, within ±SCORE_WIN so that it fits in 16 bits
+	 * @param depth  the remaining depth of the search
+	 * @param bound  the bound type
+	 * @param move   the best column, -1 if unknown
+	 */
+	void store(uint64_t key, int score, int depth, Bound bound, int move);
+
+	/**
+	 * Hint the CPU to load the bucket of a position into the cache.
+	 */
+	void prefetch(uint64_t key) const;
+
+	/** Get the size of the table in bytes. */
+	std::size_t get_size() const;
+
+	/** Get the layout. */
+	Layout get_layout() const;
+
+	/** Check whether the table is shared with other processes. */
+	bool is_shared() const;
+
+	/** Describe the page size and NUMA policy the memory got. */
+	const std::string& get_memory_description() const;
+
+private:
+	friend class Disk_store;
+
+	/** An unpacked entry. */
+	struct Entry
+	{
+		uint32_t check;
+		int16_t score;
+		uint8_t depth;
+		/** Bits 0-1 bound, bits 2-4 move (7 = none), bits 5-7 generation. */
+		uint8_t meta;
+	};
+
+	/**
+	 * One cache line of entries, each packed into a single word that is read and written atomically.
+	 * Bits 32-63 hold the score, depth and meta, bits 0-31 the check bits XORed with bits 32-63.
+	 */
+	struct Bucket
+	{
+		std::atomic<uint64_t> entries[BUCKET_SIZE];
+	};
+
+	/** Wrap memory holding a table of the given shape. */
+	Transposition_table(std::unique_ptr<Large_memory> memory, std::size_t offset, int bucket_bits, Layout layout, uint8_t generation);
+
+	/** Pack an entry into a word. */
+	static uint64_t pack(const Entry& entry);
+
+	/** Unpack a word, of which the check bits only match if it was written whole. */
+	static Entry unpack(uint64_t word);
+
+	/** Get log2 of the number of buckets that fit in a size. */
+	static int get_bucket_bits(std::size_t size_mb);
+
+	/** Mix the key so that both the index and the check bits are well distributed. */
+	static uint64_t hash(uint64_t key);
+
+	/** Find the bucket index of a hashed key. */
+	uint64_t bucket_index(uint64_t hashed) const;
+
+	/** Find the bucket of a hashed key. */
+	Bucket& bucket_of(uint64_t hashed) const;
+
+	/**
+	 * Put an entry into a bucket, spilling the entry it replaces to disk if that is deep enough.
+	 */
+	void place(uint64_t index, const Entry& entry);
+
+	/** Find the entry of a hashed key in the single-slot layout. */
+	std::atomic<uint64_t>& slot_of(uint64_t hashed) const;
+
+	std::unique_ptr<Large_memory> memory;
+	Bucket* buckets;
+	/** log2 of the number of buckets. */
+	int bucket_bits;
+	Layout layout;
+	std::atomic<uint8_t> generation;
+	/** True if the table lives in a shared memory segment. */
+	bool shared;
+	std::shared_ptr<Disk_store> disk;
+	int disk_min_depth;
+	/** The evaluation tag of a table that is not shared. */
+	std::atomic<uint64_t> own_evaluation;
+	/** The evaluation tag, own_evaluation or the one in the header of the shared segment. */
+	std::atomic<uint64_t>* evaluation;
+};
+
+} // namespace con4game
@@ -0,0 +1,528 @@
+#include "board.h"
+#include "bench_positions.h"
+#include "disk_store.h"
+#include "log.h"
+#include "perf_counters.h"
+#include "platform.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/** Stage buckets used when generating the position sets. */
+struct Bench_bucket
+{
+	const char* name;
+	int min_plies;
+	int max_plies;
+	int depth;
+	int count;
+};
+
+const Bench_bucket buckets[] =
+{
+	{ "endgame_easy", 26, 34, 8, 24 },
+	{ "midgame_hard", 12, 20, 10, 16 },
+	{ "opening", 2, 6, 10, 16 },
+};
+
+/** Aggregated timing of one set. */
+struct Set_result
+{
+	std::size_t positions = 0;
+	std::size_t correct = 0;
+	long long nodes = 0;
+	long long time_ns = 0;
+	long long tt_probes = 0;
+	long long tt_hits = 0;
+	long long root_searches = 0;
+	long long reductions = 0;
+	long long reduction_researches = 0;
+	long long extensions = 0;
+	long long threat_cutoffs = 0;
+	uint64_t counters[Perf_counters::EVENT_COUNT] = {};
+};
+
+/**
+ * Replay a move string on an empty board.
+ * @return the player to move, or 0 if the string is invalid.
+ */
+int replay(Board& board, const char* moves)
+{
+	board.reset();
+	int player = 1;
+	for (const char* c = moves; *c; c++)
+	{
+		int col = *c - '1';
+		if (col < 0 || col >= BOARD_WIDTH || !board.is_playable(col))
+		{
+			return 0;
+		}
+		board.place(col);
+		player = 3 - player;
+	}
+	return player;
+}
+
+/**
+ * Empty the transposition table so that every search starts from the same state.
+ */
+void clear_table(Board& board)
+{
+	if (board.get_transposition_table())
+	{
+		board.get_transposition_table()->clear();
+	}
+}
+
+/**
+ * Check whether either player can win in one move, which the search short-circuits.
+ */
+bool has_immediate_win(Board& board)
+{
+	const uint64_t* bitboard = board.get_board();
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		if (!board.is_playable(col))
+		{
+			continue;
+		}
+		int row = 0;
+		while (board.at(row, col) != 0)
+		{
+			row++;
+		}
+		uint64_t bit = 1ULL << (row + col * H1);
+		if (board.has_won(bitboard[0] | bit) || board.has_won(bitboard[1] | bit))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void generate(std::ostream& out)
+{
+	std::mt19937 rng(20170401);
+	Board board;
+	for (const Bench_bucket& bucket : buckets)
+	{
+		std::vector<std::string> accepted;
+		out << "\tconst Bench_position " << bucket.name << "_positions[] =" << std::endl << "\t{" << std::endl;
+		while ((int) accepted.size() < bucket.count)
+		{
+			int plies = std::uniform_int_distribution<int>(bucket.min_plies, bucket.max_plies)(rng);
+			std::string moves;
+			board.reset();
+			bool valid = true;
+			for (int i = 0; i < plies && valid; i++)
+			{
+				int col = std::uniform_int_distribution<int>(0, BOARD_WIDTH - 1)(rng);
+				if (!board.is_playable(col))
+				{
+					i--;
+					continue;
+				}
+				board.place(col);
+				moves.push_back((char) ('1' + col));
+				valid = board.test_win() == 0;
+			}
+			if (!valid || has_immediate_win(board))
+			{
+				continue;
+			}
+			bool duplicate = false;
+			for (const std::string& other : accepted)
+			{
+				duplicate = duplicate || other == moves;
+			}
+			if (duplicate)
+			{
+				continue;
+			}
+			accepted.push_back(moves);
+			int player = plies % 2 + 1;
+			clear_table(board);
+			int column = board.find_best_move(player, bucket.depth);
+			out << "\t\t{ \"" << moves << "\", " << bucket.depth << ", " << column << ", " << board.get_search_stats().score << " }," << std::endl;
+		}
+		out << "\t};" << std::endl << std::endl;
+	}
+	out << "\tconst Bench_set bench_sets[] =" << std::endl << "\t{" << std::endl;
+	for (const Bench_bucket& bucket : buckets)
+	{
+		out << "\t\t{ \"" << bucket.name << "\", " << bucket.name << "_positions, sizeof(" << bucket.name << "_positions) / sizeof(Bench_position) }," << std::endl;
+	}
+	out << "\t};" << std::endl;
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_bench [--set NAME] [--output FILE] [--hash MB] [--tt-layout bucket|single] [--no-tt]" << std::endl
+		<< "                        [--root alphabeta|mtdf] [--lmr] [--extensions] [--threats]" << std::endl
+		<< "                        [--no-huge-pages] [--numa default|interleave|local] [--cpu N]" << std::endl
+		<< "                        [--load-tt FILE] [--save-tt FILE] [--shared NAME] [--remove-shared]" << std::endl
+		<< "                        [--disk DIR] [--disk-mb MB] [--disk-depth D] [--generate]" << std::endl
+		<< "  --set NAME     only run the named set (endgame_easy, midgame_hard, opening)" << std::endl
+		<< "  --hash MB      transposition table size (default " << TRANSPOSITION_TABLE_MB << ")" << std::endl
+		<< "  --tt-layout    bucketed (default) or single-slot transposition table" << std::endl
+		<< "  --no-tt        search without the transposition table" << std::endl
+		<< "  --root R       root search: alphabeta (default) or mtdf (null-window probes)" << std::endl
+		<< "  --lmr          reduce quiet late moves; results are then checked against the full-width references" << std::endl
+		<< "  --extensions   extend forced blocks and threats; results are likewise checked against the references" << std::endl
+		<< "  --threats      end lines that are won or decided by the zugzwang rules; likewise checked" << std::endl
+		<< "  --no-huge-pages  allocate the table on normal pages" << std::endl
+		<< "  --numa POLICY  NUMA placement of the table (default: default)" << std::endl
+		<< "  --cpu N        pin the benchmark to CPU N before allocating the table" << std::endl
+		<< "  --load-tt FILE start from a saved table (warm start)" << std::endl
+		<< "  --save-tt FILE save the table after the last position" << std::endl
+		<< "  --shared NAME  use the table in the shared memory segment NAME, created if missing" << std::endl
+		<< "  --remove-shared  remove the shared memory segment after the run" << std::endl
+		<< "                 with --load-tt, --save-tt or --shared the table is kept between positions" << std::endl
+		<< "  --disk DIR     back the table with shard files in DIR, kept between positions and runs" << std::endl
+		<< "  --disk-mb MB   total size of the shard files (default 1024)" << std::endl
+		<< "  --disk-depth D remaining depth from which entries go to disk (default 6)" << std::endl
+		<< "  --output FILE  write the JSON report to FILE (default - for stdout)" << std::endl
+		<< "  --generate     print a freshly generated bench_positions.h table" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Solve benchmark over the fixed position sets in bench_positions.h.
+ * Writes one JSON document with per-position and per-set results.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	std::string only_set;
+	std::string output = "-";
+	int hash_mb = TRANSPOSITION_TABLE_MB;
+	Transposition_table::Layout layout = Transposition_table::Layout::BUCKETED;
+	Search_options options;
+	Memory_options memory;
+	int cpu = -1;
+	std::string load_path;
+	std::string save_path;
+	std::string shared_name;
+	bool remove_shared = false;
+	std::string disk_directory;
+	int disk_mb = 1024;
+	int disk_depth = 6;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--set") == 0 && i + 1 < argc)
+		{
+			only_set = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--hash") == 0 && i + 1 < argc)
+		{
+			hash_mb = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--tt-layout") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "bucket") == 0)
+		{
+			layout = Transposition_table::Layout::BUCKETED;
+			i++;
+		}
+		else if (std::strcmp(argv[i], "--tt-layout") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "single") == 0)
+		{
+			layout = Transposition_table::Layout::SINGLE_SLOT;
+			i++;
+		}
+		else if (std::strcmp(argv[i], "--no-tt") == 0)
+		{
+			options.use_transposition_table = false;
+		}
+		else if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "alphabeta") == 0)
+		{
+			options.root_strategy = Root_strategy::ALPHA_BETA;
+			i++;
+		}
+		else if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "mtdf") == 0)
+		{
+			options.root_strategy = Root_strategy::MTDF;
+			i++;
+		}
+		else if (std::strcmp(argv[i], "--lmr") == 0)
+		{
+			options.late_move_reductions = true;
+		}
+		else if (std::strcmp(argv[i], "--extensions") == 0)
+		{
+			options.threat_extensions = true;
+		}
+		else if (std::strcmp(argv[i], "--threats") == 0)
+		{
+			options.use_threat_analysis = true;
+		}
+		else if (std::strcmp(argv[i], "--no-huge-pages") == 0)
+		{
+			memory.huge_pages = false;
+		}
+		else if (std::strcmp(argv[i], "--numa") == 0 && i + 1 < argc && parse_numa_policy(argv[i + 1], memory.numa))
+		{
+			i++;
+		}
+		else if (std::strcmp(argv[i], "--cpu") == 0 && i + 1 < argc)
+		{
+			cpu = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--load-tt") == 0 && i + 1 < argc)
+		{
+			load_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--save-tt") == 0 && i + 1 < argc)
+		{
+			save_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--shared") == 0 && i + 1 < argc)
+		{
+			shared_name = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--remove-shared") == 0)
+		{
+			remove_shared = true;
+		}
+		else if (std::strcmp(argv[i], "--disk") == 0 && i + 1 < argc)
+		{
+			disk_directory = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--disk-mb") == 0 && i + 1 < argc)
+		{
+			disk_mb = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--disk-depth") == 0 && i + 1 < argc)
+		{
+			disk_depth = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--generate") == 0)
+		{
+			generate(std::cout);
+			return EXIT_SUCCESS;
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::ofstream file;
+	if (output != "-")
+	{
+		file.open(output);
+		if (!file)
+		{
+			std::cerr << "cannot open " << output << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = output != "-" ? file : std::cout;
+
+	Perf_counters counters;
+	if (!counters.is_available())
+	{
+		std::cerr << "hardware counters unavailable (" << counters.get_error() << "), reporting time only" << std::endl;
+	}
+	else if (!counters.get_error().empty())
+	{
+		std::cerr << "some hardware counters unavailable (" << counters.get_error() << ")" << std::endl;
+	}
+
+	bool pinned = cpu >= 0 && pin_current_thread(cpu);
+	if (cpu >= 0 && !pinned)
+	{
+		std::cerr << "cannot pin to cpu " << cpu << std::endl;
+	}
+	Board board;
+	board.set_options(options);
+	if (!shared_name.empty())
+	{
+		std::string error;
+		std::shared_ptr<Transposition_table> table = Transposition_table::open_shared(shared_name, hash_mb, error);
+		if (!table)
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+		board.set_transposition_table(table);
+		hash_mb = (int) (table->get_size() >> 20);
+	}
+	else if (load_path.empty())
+	{
+		board.set_transposition_table(std::make_shared<Transposition_table>(hash_mb, layout, memory));
+	}
+	else
+	{
+		std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+		std::string error;
+		std::shared_ptr<Transposition_table> table = Transposition_table::load(load_path, error);
+		if (!table)
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+		board.set_transposition_table(table);
+		std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - start_clock;
+		hash_mb = (int) (table->get_size() >> 20);
+		std::cerr << "loaded " << load_path << " in " << load_time.count() << " s" << std::endl;
+	}
+	if (!disk_directory.empty())
+	{
+		std::shared_ptr<Disk_store> disk = std::make_shared<Disk_store>(disk_directory, disk_mb);
+		board.get_transposition_table()->attach_disk(disk, disk_depth);
+		if (!disk->is_open())
+		{
+			std::cerr << disk->get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	const std::string& memory_description = board.get_transposition_table()->get_memory_description();
+	std::cerr << "transposition table " << hash_mb << " MB: " << memory_description << std::endl;
+	bool all_correct = true;
+	bool first_set = true;
+	out << "{\"hash_mb\":" << hash_mb << ",\"memory\":\"" << memory_description << "\",\"pinned\":" << (pinned ? "true" : "false")
+		<< "," << std::endl << "\"sets\":[";
+	for (const Bench_set& set : bench_sets)
+	{
+		if (!only_set.empty() && only_set != set.name)
+		{
+			continue;
+		}
+		Set_result total;
+		out << (first_set ? "" : ",") << std::endl << "{\"name\":\"" << set.name << "\",\"positions\":[";
+		first_set = false;
+		for (std::size_t i = 0; i < set.count; i++)
+		{
+			const Bench_position& position = set.positions[i];
+			int player = replay(board, position.moves);
+			if (player == 0)
+			{
+				std::cerr << "invalid position " << position.moves << std::endl;
+				return EXIT_FAILURE;
+			}
+			if (load_path.empty() && save_path.empty() && shared_name.empty())
+			{
+				clear_table(board);
+			}
+			counters.start();
+			board.find_best_move(player, position.depth);
+			counters.stop();
+			const Search_stats& stats = board.get_search_stats();
+			// other root strategies may settle on another column of the same score
+			bool correct = stats.score == position.score
+				&& (stats.column == position.column || options.root_strategy != Root_strategy::ALPHA_BETA);
+
+			total.positions++;
+			total.correct += correct ? 1 : 0;
+			total.nodes += stats.nodes + stats.leaf_evals;
+			total.time_ns += stats.elapsed_ns;
+			total.tt_probes += stats.tt_probes;
+			total.tt_hits += stats.tt_hits;
+			total.root_searches += stats.root_searches;
+			total.reductions += stats.reductions;
+			total.reduction_researches += stats.reduction_researches;
+			total.extensions += stats.extensions;
+			total.threat_cutoffs += stats.threat_cutoffs;
+			for (int event = 0; event < Perf_counters::EVENT_COUNT; event++)
+			{
+				total.counters[event] += counters.get((Perf_counters::Event) event);
+			}
+			out << (i == 0 ? "" : ",") << std::endl
+				<< "{\"moves\":\"" << position.moves << "\",\"depth\":" << position.depth
+				<< ",\"column\":" << stats.column << ",\"score\":" << stats.score
+				<< ",\"expected_column\":" << position.column << ",\"expected_score\":" << position.score
+				<< ",\"correct\":" << (correct ? "true" : "false")
+				<< ",\"nodes\":" << stats.nodes << ",\"leaf_evals\":" << stats.leaf_evals
+				<< ",\"tt_probes\":" << stats.tt_probes << ",\"tt_hits\":" << stats.tt_hits
+				<< ",\"root_searches\":" << stats.root_searches << ",\"reductions\":" << stats.reductions
+				<< ",\"reduction_researches\":" << stats.reduction_researches << ",\"extensions\":" << stats.extensions
+				<< ",\"threat_cutoffs\":" << stats.threat_cutoffs
+				<< ",\"ebf\":" << stats.branching_factor() << ",\"time_ns\":" << stats.elapsed_ns << "}";
+		}
+		all_correct = all_correct && total.correct == total.positions;
+		double seconds = 1e-9 * total.time_ns;
+		out << "]," << std::endl
+			<< "\"count\":" << total.positions << ",\"correct\":" << total.correct
+			<< ",\"mean_time_s\":" << seconds / total.positions
+			<< ",\"mean_nodes\":" << (double) total.nodes / total.positions
+			<< ",\"mean_root_searches\":" << (double) total.root_searches / total.positions
+			<< ",\"reductions\":" << total.reductions << ",\"reduction_researches\":" << total.reduction_researches
+			<< ",\"extensions\":" << total.extensions << ",\"threat_cutoffs\":" << total.threat_cutoffs
+			<< ",\"nodes_per_second\":" << (seconds > 0 ? total.nodes / seconds : 0.0)
+			<< ",\"tt_hit_rate\":" << (total.tt_probes > 0 ? (double) total.tt_hits / total.tt_probes : 0.0)
+			<< ",\"per_node\":{";
+		// hardware counters per searched node, interior nodes and leaves
+		bool first_counter = true;
+		for (int event = 0; event < Perf_counters::EVENT_COUNT; event++)
+		{
+			if (counters.is_available((Perf_counters::Event) event))
+			{
+				out << (first_counter ? "" : ",") << "\"" << Perf_counters::get_name((Perf_counters::Event) event) << "\":"
+					<< (total.nodes > 0 ? (double) total.counters[event] / total.nodes : 0.0);
+				first_counter = false;
+			}
+		}
+		out << "}}";
+		std::cerr << set.name << ": " << total.correct << "/" << total.positions << " correct, "
+			<< seconds / total.positions << " s/position, " << (seconds > 0 ? total.nodes / seconds : 0.0) << " nodes/s, "
+			<< (total.tt_probes > 0 ? 100.0 * total.tt_hits / total.tt_probes : 0.0) << "% tt hits, "
+			<< (double) total.nodes / total.positions << " nodes and " << (double) total.root_searches / total.positions
+			<< " root searches/position";
+		if (options.late_move_reductions || options.threat_extensions)
+		{
+			std::cerr << ", " << total.reductions << " reductions (" << total.reduction_researches << " searched again), "
+				<< total.extensions << " extensions";
+		}
+		if (options.use_threat_analysis)
+		{
+			std::cerr << ", " << total.threat_cutoffs << " decided by zugzwang";
+		}
+		std::cerr << std::endl;
+	}
+	out << "]";
+	Disk_store* disk = board.get_transposition_table()->get_disk();
+	if (disk)
+	{
+		disk->flush();
+		Disk_store::Stats disk_stats = disk->get_stats();
+		out << "," << std::endl << "\"disk\":{\"size_mb\":" << (disk->get_size() >> 20) << ",\"min_depth\":" << disk_depth
+			<< ",\"spilled\":" << disk_stats.spilled << ",\"write_batches\":" << disk_stats.write_batches
+			<< ",\"bytes_written\":" << disk_stats.bytes_written << ",\"bytes_read\":" << disk_stats.bytes_read
+			<< ",\"reads\":" << disk_stats.reads << ",\"reads_dropped\":" << disk_stats.reads_dropped
+			<< ",\"read_hits\":" << disk_stats.read_hits
+			<< ",\"hit_rate\":" << (disk_stats.reads > 0 ? (double) disk_stats.read_hits / disk_stats.reads : 0.0) << "}";
+		std::cerr << "disk: " << disk_stats.spilled << " entries spilled in " << disk_stats.write_batches << " batches, "
+			<< (disk_stats.bytes_written >> 20) << " MB written, " << (disk_stats.bytes_read >> 20) << " MB read, "
+			<< disk_stats.read_hits << "/" << disk_stats.reads << " lookups hit, " << disk_stats.reads_dropped << " dropped" << std::endl;
+	}
+	out << "}" << std::endl;
+	if (!save_path.empty() && board.get_transposition_table() && !board.get_transposition_table()->save(save_path))
+	{
+		std::cerr << "cannot save " << save_path << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (remove_shared && !shared_name.empty() && !Transposition_table::remove_shared(shared_name))
+	{
+		std::cerr << "cannot remove " << shared_name << std::endl;
+	}
+	CON4_TRACE_DUMP("bench_trace.json");
+	return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,13 +1,33 @@
 #include "board.h"
-#include "game.h"
+#include "log.h"
+#include "threat_analysis.h"
+#include "trace.h"
+#include <algorithm>
 #include <chrono>
-#include <iostream>
-#include <thread>
 
 namespace con4game
 {
+namespace
+{
+
+/** Plies a line may be extended by in total. */
+const int MAX_EXTENSION_PLIES = 2;
+
+} // namespace
 
 Board::Board()
+: stats()
+, options()
+, table()
+, network()
+, weights(get_classic_weights())
+, active_table(nullptr)
+, root_plies(0)
+, root_depth(0)
+, stop_flag(nullptr)
+, has_deadline(false)
+, can_abort(false)
+, aborted(false)
 {
 	reset();
 }
@@ -41,6 +61,10 @@ void Board::place(int col)
 {
 	if (is_playable(col))
 	{
+		if (network)
+		{
+			network->add(accumulator, height[col], plies_num & 1);
+		}
 		bitboard[plies_num & 1] ^= 1ULL << height[col]++;
 		moves[plies_num++] = col;
 	}
@@ -52,6 +76,10 @@ void Board::reset()
 	bitboard[0] = bitboard[1] = 0;
 	for (int i = 0; i < BOARD_WIDTH; i++)
 		height[i] = H1 * i;
+	if (network)
+	{
+		network->refresh(accumulator, bitboard);
+	}
 }
 
 
@@ -97,6 +125,11 @@ bool Board::is_legal(uint64_t newboard) const
 	return (newboard & TOP) == 0;
 }
 
+int Board::get_plies() const
+{
+	return plies_num;
+}
+
 bool Board::undo_last_move()
 {
 	if (plies_num == 0)
@@ -105,85 +138,408 @@ bool Board::undo_last_move()
 	}
 	int col = moves[--plies_num];
 	bitboard[plies_num & 1] ^= 1ULL << --height[col];
+	if (network)
+	{
+		network->remove(accumulator, height[col], plies_num & 1);
+	}
 	return true;
 }
 
 int Board::find_best_move(int player)
 {
-	iterations = 0;
+	return find_best_move(player, MAX_SEARCH_DEPTH);
+}
+
+int Board::find_best_move(int player, int depth)
+{
+	Search_limits limits;
+	limits.depth = depth;
+	return find_best_move(player, limits);
+}
+
+int Board::find_best_move(int player, const Search_limits& limits)
+{
+	CON4_TRACE_SCOPE("find_best_move");
+	stats = Search_stats();
+	root_plies = plies_num;
 	int opponent = 3 - player;
 	// measure time
 	std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
 
-	// Rule #1. If player can win in 1 turn, do it.
-	for (int col_index = 0; col_index < BOARD_WIDTH; col_index++)
 	{
-		if (!is_playable(col_index))
+		CON4_TRACE_SCOPE("immediate_win_check");
+		// Rule #1. If player can win in 1 turn, do it.
+		for (int col_index = 0; col_index < BOARD_WIDTH; col_index++)
 		{
-			continue;
+			if (!is_playable(col_index))
+			{
+				continue;
+			}
+			uint64_t player_board = bitboard[player - 1] ^ (1ULL << height[col_index]);
+			if (has_won(player_board))
+			{
+				stats.column = col_index;
+				stats.source = Move_source::IMMEDIATE_WIN;
+				stats.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_clock).count();
+				return col_index;
+			}
+		}
+
+		// Rule #2. If opponent player can win in 1 turn, prevent it.
+		for (int col_index = 0; col_index < BOARD_WIDTH; col_index++)
+		{
+			if (!is_playable(col_index))
+			{
+				continue;
+			}
+			uint64_t opponent_board = bitboard[opponent - 1] ^ (1ULL << height[col_index]);
+			if (has_won(opponent_board))
+			{
+				stats.column = col_index;
+				stats.source = Move_source::BLOCK;
+				stats.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_clock).count();
+				return col_index;
+			}
+
 		}
-		uint64_t player_board = bitboard[player - 1] ^ (1ULL << height[col_index]);
-		if (has_won(player_board))
+	}
+
+	active_table = nullptr;
+	if (options.use_transposition_table)
+	{
+		if (!table)
 		{
-			std::cout << std::endl << "[DEBUG] Player can win in 1 turn. Take it." << std::endl << "[DEBUG] column: " << col_index << std::endl;
-			return col_index;
+			table = std::make_shared<Transposition_table>(TRANSPOSITION_TABLE_MB);
 		}
+		active_table = table.get();
+		active_table->set_evaluation(get_evaluation_id());
+		active_table->new_search();
 	}
 
-	// Rule #2. If opponent player can win in 1 turn, prevent it.
-	for (int col_index = 0; col_index < BOARD_WIDTH; col_index++)
+	stop_flag = limits.stop;
+	has_deadline = limits.time_ms > 0;
+	deadline = start_clock + std::chrono::milliseconds(limits.time_ms);
+	can_abort = false;
+	aborted = false;
+
+	std::pair<int, int> result(-1, 0);
+	// Without a time budget, search the requested depth directly.
+	int first_depth = has_deadline || stop_flag ? 1 : limits.depth;
+	for (int depth = first_depth; depth <= limits.depth; depth++)
 	{
-		if (!is_playable(col_index))
+		CON4_TRACE_SCOPE_ARG("search_depth", depth);
+		root_depth = depth;
+		std::pair<int, int> iteration;
+		if (options.root_strategy == Root_strategy::MTDF)
 		{
-			continue;
+			iteration = mtdf(depth, result.second, player);
+		}
+		else
+		{
+			stats.root_searches++;
+			iteration = negamax_alpha_beta_pruning(depth, -SCORE_INFINITY, SCORE_INFINITY, player, 1);
 		}
-		uint64_t opponent_board = bitboard[opponent - 1] ^ (1ULL << height[col_index]);
-		if (has_won(opponent_board))
+		if (aborted)
 		{
-			std::cout << std::endl << "[DEBUG] Opponent player can win in 1 turn. Prevent it." << std::endl << "[DEBUG] column: " << col_index << std::endl;
-			return col_index;
+			break;
 		}
+		result = iteration;
+		stats.depth = depth;
+		can_abort = true;
+	}
+	stats.column = result.first;
+	stats.score = result.second;
+	stop_flag = nullptr;
+	has_deadline = false;
 
+	std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+	stats.elapsed_ns = clock_diff.count();
+
+	Logger::get().write(Log_level::DEBUG, "search column %d score %d depth %d nodes %lld leaves %lld time %.3f s%s",
+		stats.column, stats.score, stats.depth, stats.nodes, stats.leaf_evals, 1e-9 * stats.elapsed_ns, aborted ? " (stopped)" : "");
+	return result.first;
+}
+
+std::pair<int, int> Board::mtdf(int depth, int guess, int player)
+{
+	std::pair<int, int> result(-1, guess);
+	int lower = -SCORE_INFINITY;
+	int upper = SCORE_INFINITY;
+	int value = guess;
+	int step = 1;
+	while (lower < upper)
+	{
+		// Test whether the score is at least beta. The evaluation spans a wide range,
+		// so a bound that keeps moving the same way is pushed in doubling steps,
+		// and once both bounds are known the interval is halved.
+		int beta = guess;
+		if (lower > -SCORE_INFINITY && upper < SCORE_INFINITY)
+		{
+			beta = lower + (upper - lower + 1) / 2;
+		}
+		else if (lower > -SCORE_INFINITY)
+		{
+			beta = std::max(value + 1, lower + step);
+			step *= 2;
+		}
+		else if (upper < SCORE_INFINITY)
+		{
+			beta = std::min(value, upper + 1 - step);
+			step *= 2;
+		}
+		stats.root_searches++;
+		std::pair<int, int> probe = negamax_alpha_beta_pruning(depth, beta - 1, beta, player, 1);
+		if (aborted)
+		{
+			return std::pair<int, int>(-1, 0);
+		}
+		value = probe.second;
+		if (value < beta)
+		{
+			upper = value;
+		}
+		else
+		{
+			// only a fail-high proves that the column reaches the score
+			lower = value;
+			result = probe;
+		}
 	}
+	return result;
+}
+
+const Search_stats& Board::get_search_stats() const
+{
+	return stats;
+}
+
+uint64_t Board::get_key() const
+{
+	// the counters of the player to move plus all counters plus the bottom row:
+	// every column becomes the player's counters below a single separating bit
+	return bitboard[plies_num & 1] + (bitboard[0] | bitboard[1]) + BOTTOM;
+}
 
-	std::cout << std::endl << "[DEBUG] Finding the best move using Negamax algorithm..." << std::endl;
+uint64_t Board::search_key(int player) const
+{
+	return get_key() | (player == 2 ? 1ULL << 63 : 0);
+}
 
-	std::pair<int, int> result = negamax_alpha_beta_pruning(MAX_SEARCH_DEPTH, INT_MIN, INT_MAX, player, 1);
+void Board::set_options(const Search_options& new_options)
+{
+	options = new_options;
+}
 
-	std::cout << std::endl << "[DEBUG] Finished finding best move." << std::endl << "[DEBUG] iterations: " << iterations << std::endl << "[DEBUG] column: " << result.first << std::endl << "[DEBUG] score: " << result.second  << std::endl;
+const Search_options& Board::get_options() const
+{
+	return options;
+}
 
-	std::chrono::time_point<std::chrono::steady_clock> end_clock = std::chrono::steady_clock::now();
-	std::chrono::duration<long long, std::nano> clock_diff = end_clock - start_clock;
+void Board::set_transposition_table(const std::shared_ptr<Transposition_table>& new_table)
+{
+	table = new_table;
+}
 
-	std::cout << "[DEBUG] time taken: " << (1e-9 * clock_diff.count()) << " s" << std::endl;
-	return result.first;
+Transposition_table* Board::get_transposition_table() const
+{
+	return table.get();
+}
+
+void Board::set_network(const std::shared_ptr<const Nnue>& new_network)
+{
+	network = new_network;
+	if (network)
+	{
+		network->refresh(accumulator, bitboard);
+	}
+}
+
+const Nnue* Board::get_network() const
+{
+	return network.get();
+}
+
+void Board::set_eval_weights(const Eval_weights& new_weights)
+{
+	weights = new_weights;
+}
+
+const Eval_weights& Board::get_eval_weights() const
+{
+	return weights;
+}
+
+uint64_t Board::winning_squares(uint64_t counters, uint64_t occupied)
+{
+	// vertical: three counters below
+	uint64_t squares = (counters << 1) & (counters << 2) & (counters << 3);
+	// horizontal and both diagonals: three counters in any of the four windows through the square
+	const uint64_t shifts[] = { H1, BOARD_HEIGHT, H2 };
+	for (uint64_t shift : shifts)
+	{
+		uint64_t pair = (counters << shift) & (counters << 2 * shift);
+		squares |= pair & (counters << 3 * shift);
+		squares |= pair & (counters >> shift);
+		pair = (counters >> shift) & (counters >> 2 * shift);
+		squares |= pair & (counters << shift);
+		squares |= pair & (counters >> 3 * shift);
+	}
+	// the shifts that cross a column edge end in the unused top row
+	return squares & ~occupied & (ALL1 ^ TOP);
+}
+
+uint64_t Board::playable_squares() const
+{
+	return ((bitboard[0] | bitboard[1]) + BOTTOM) & (ALL1 ^ TOP);
+}
+
+bool Board::should_stop()
+{
+	if (!can_abort)
+	{
+		return false;
+	}
+	if (stop_flag && stop_flag->load(std::memory_order_relaxed))
+	{
+		return true;
+	}
+	return has_deadline && std::chrono::steady_clock::now() >= deadline;
 }
 
 std::pair<int, int> Board::negamax_alpha_beta_pruning(int depth, int alpha, int beta, int player, int sign)
 {
 	// stop if maximum search depth has been reached, or if the game is over
-	if (depth <= 0 || test_win())
+	int outcome = test_win();
+	if (options.use_threat_analysis && outcome != 3 && plies_num > root_plies)
 	{
+		// a won game, or one the zugzwang rules decide, scores above every heuristic score
+		int winner = outcome != 0 ? outcome : analyse_threats(*this).winner;
+		if (winner != 0)
+		{
+			stats.leaf_evals++;
+			stats.threat_cutoffs += outcome == 0 ? 1 : 0;
+			return std::pair<int, int>(-1, sign * (winner == player ? SCORE_WIN : -SCORE_WIN));
+		}
+	}
+	if (depth <= 0 || outcome != 0)
+	{
+		stats.leaf_evals++;
 		int score = evaluate(player);
 		return std::pair<int, int>(-1, sign * score);
 	}
 
-	iterations++;
+	stats.nodes++;
+	stats.nodes_by_ply[plies_num - root_plies]++;
+
+	// poll the clock only every 1024 nodes
+	if (aborted || ((stats.nodes & 1023) == 0 && should_stop()))
+	{
+		aborted = true;
+		return std::pair<int, int>(-1, 0);
+	}
+
+	int hash_move = -1;
+	uint64_t key = 0;
+	if (active_table)
+	{
+		key = search_key(player);
+		Transposition_table::Probe_result entry;
+		stats.tt_probes++;
+		if (active_table->probe(key, entry, depth))
+		{
+			stats.tt_hits++;
+			hash_move = entry.move >= 0 && is_playable(entry.move) ? entry.move : -1;
+			// the root always searches, so that it returns a column
+			if (plies_num > root_plies && entry.depth >= depth)
+			{
+				if (entry.bound == Transposition_table::Bound::LOWER)
+				{
+					alpha = std::max(alpha, entry.score);
+				}
+				else if (entry.bound == Transposition_table::Bound::UPPER)
+				{
+					beta = std::min(beta, entry.score);
+				}
+				if (entry.bound == Transposition_table::Bound::EXACT || alpha >= beta)
+				{
+					stats.tt_cutoffs++;
+					return std::pair<int, int>(entry.move, entry.score);
+				}
+			}
+		}
+	}
+
+	// the window the moves are searched with, after the table has narrowed it: a result at or below its alpha
+	// is only an upper bound, even if it is above the alpha the node was called with
+	int alpha_original = alpha;
+
+	// squares where either side would win, to tell tactical moves from quiet ones
+	bool tactics = options.late_move_reductions || options.threat_extensions;
+	uint64_t own_wins = 0;
+	uint64_t opponent_threats = 0;
+	if (tactics && depth > 1)
+	{
+		uint64_t occupied = bitboard[0] | bitboard[1];
+		own_wins = winning_squares(bitboard[plies_num & 1], occupied);
+		opponent_threats = winning_squares(bitboard[(plies_num & 1) ^ 1], occupied) & playable_squares();
+	}
 
 	int best_column = -1;
-	int best_value = INT_MIN;
-	for (int col_index = 0; col_index < BOARD_WIDTH; col_index++)
+	int best_value = -SCORE_INFINITY;
+	int move_index = 0;
+	// the move from the table first, then from left to right
+	for (int order = -1; order < (int) BOARD_WIDTH; order++)
 	{
+		int col_index = order < 0 ? hash_move : order;
 		// full
-		if (!is_playable(col_index))
+		if (col_index < 0 || (order >= 0 && col_index == hash_move) || !is_playable(col_index))
 		{
 			continue;
 		}
+		move_index++;
+		uint64_t square = 1ULL << height[col_index];
 		place(col_index);
-		int value = -negamax_alpha_beta_pruning(depth - 1, -beta, -alpha, player, -sign).second;
+		if (active_table && depth > 1)
+		{
+			active_table->prefetch(search_key(player));
+		}
+		// a forced block of the opponent's threat, or a move that creates a threat of winning next move
+		bool tactical = false;
+		if (tactics && depth > 1)
+		{
+			uint64_t threats = winning_squares(bitboard[(plies_num & 1) ^ 1], bitboard[0] | bitboard[1]) & ~own_wins & playable_squares();
+			tactical = (square & opponent_threats) != 0 || threats != 0;
+		}
+		int value;
+		// the line through the child, plies from the root plus the remaining depth, may grow to MAX_EXTENSION_PLIES
+		// beyond the iteration depth, so that a long series of threats cannot blow the search up
+		if (tactical && options.threat_extensions && plies_num - root_plies + depth <= root_depth + MAX_EXTENSION_PLIES)
+		{
+			stats.extensions++;
+			value = -negamax_alpha_beta_pruning(depth, -beta, -alpha, player, -sign).second;
+		}
+		else if (!tactical && options.late_move_reductions && depth >= 3 && move_index > 3 && opponent_threats == 0)
+		{
+			stats.reductions++;
+			value = -negamax_alpha_beta_pruning(depth - 2, -alpha - 1, -alpha, player, -sign).second;
+			if (value > alpha && !aborted)
+			{
+				stats.reduction_researches++;
+				value = -negamax_alpha_beta_pruning(depth - 1, -beta, -alpha, player, -sign).second;
+			}
+		}
+		else
+		{
+			value = -negamax_alpha_beta_pruning(depth - 1, -beta, -alpha, player, -sign).second;
+		}
 
 		undo_last_move();
 
+		if (aborted)
+		{
+			break;
+		}
+
 		if (value > best_value)
 		{
 			best_value = value;
@@ -195,131 +551,73 @@ std::pair<int, int> Board::negamax_alpha_beta_pruning(int depth, int alpha, int
 		// beta cut-off
 		if (alpha >= beta)
 		{
+			stats.cutoffs_by_move[move_index - 1]++;
 			break;
 		}
 
 	}
-	return std::pair<int, int>(best_column, best_value);
-}
 
-int Board::evaluate(int row, int column, int player)
-{
-	int score = 0;
-	bool unblocked = true;
-	int tally = 0;
-	int opponent = 3 - player;
-	if (row < BOARD_HEIGHT - 3)
+	if (active_table && !aborted)
 	{
-		//check up
-		unblocked = true;
-		tally = 0;
-
-		for (int row_index = row; row_index < row + 4; row_index++)
+		Transposition_table::Bound bound = Transposition_table::Bound::EXACT;
+		if (best_value <= alpha_original)
 		{
-			if (at(row_index, column) == opponent)
-			{
-				unblocked = false;
-			}
-			if (at(row_index, column) == player)
-			{
-				tally++;
-			}
+			bound = Transposition_table::Bound::UPPER;
 		}
-		if (unblocked == true)
+		else if (best_value >= beta)
 		{
-			score = score + (tally * tally * tally * tally);
-		}
-		if (column < BOARD_WIDTH - 3)
-		{
-			// check up and to the right
-			unblocked = true;
-			tally = 0;
-			for (int row_index = row, column_index = column; row_index < row + 4; row_index++, column_index++)
-			{
-				if (at(row_index, column_index) == opponent)
-				{
-					unblocked = false;
-				}
-				if (at(row_index, column_index) == player)
-				{
-					tally++;
-				}
-			}
-			if (unblocked == true)
-			{
-				score = score + (tally * tally * tally * tally);
-			}
+			bound = Transposition_table::Bound::LOWER;
 		}
+		active_table->store(key, best_value, depth, bound, best_column);
 	}
-	if (column < BOARD_WIDTH - 3)
-	{
-		// check right
-		unblocked = true;
-		tally = 0;
-		for (int column_index = column; column_index < column + 4; column_index++)
-		{
-			if (at(row, column_index) == opponent)
-			{
-				unblocked = false;
-			}
-			if (at(row, column_index) == player)
-			{
-				tally++;
-			}
-		}
-		if (unblocked == true)
-		{
-			score = score + (tally * tally * tally * tally);
-		}
-		if (row > 2)
-		{
-			// check down and to the right
-			unblocked = true;
-			tally = 0;
-			for (int row_index = row, column_index = column; column_index < column + 4; row_index--, column_index++)
-			{
-				if (at(row_index, column_index) == opponent)
-				{
-					unblocked = false;
-				}
-				if (at(row_index, column_index) == player)
-				{
-					tally++;
-				}
-			}
-			if (unblocked == true)
-			{
-				score = score + (tally * tally * tally * tally);
-			}
-		}
-	}
-	return score;
+	return std::pair<int, int>(best_column, best_value);
 }
 
 int Board::evaluate(int player)
 {
-	int score = 0;
-	int opponent = 3 - player;
-	for (int row_index = 0; row_index < BOARD_HEIGHT; row_index++)
+	if (network && options.evaluator == Evaluator::NNUE)
 	{
-		if (row_index <= BOARD_HEIGHT - 4)
-		{
-			for (int column_index = 0; column_index < BOARD_WIDTH; column_index++)
-			{
-				score += evaluate(row_index, column_index, player);
-			}
-		}
-		else
+		// the network scores the position for the player to move; it is trained on unfinished games,
+		// so a game the last move has won is scored without it
+		int mover = plies_num & 1;
+		int score = has_won(bitboard[mover ^ 1]) ? -SCORE_EVAL_MAX : network->evaluate(accumulator, mover);
+		return mover == player - 1 ? score : -score;
+	}
+	if (options.evaluator == Evaluator::PATTERN)
+	{
+		int score = evaluate_patterns(bitboard[0], bitboard[1]);
+		return player == 1 ? score : -score;
+	}
+	Window_counts counts;
+	if (weights.player_to_move)
+	{
+		// tuned weights score the position for the player to move, like the network
+		int mover = plies_num & 1;
+		int score = -SCORE_EVAL_MAX;
+		// they are learned from unfinished games, so a game the last move has won is scored without them
+		if (!has_won(bitboard[mover ^ 1]))
 		{
-			for (int column_index = 0; column_index <= BOARD_WIDTH - 4; column_index++)
-			{
-				score += evaluate(row_index, column_index, player);
-			}
+			count_windows(bitboard[mover], bitboard[mover ^ 1], counts);
+			score = evaluate_windows(counts, weights);
 		}
+		return mover == player - 1 ? score : -score;
 	}
-	return score;
+	count_windows(bitboard[player - 1], bitboard[2 - player], counts);
+	return evaluate_windows(counts, weights);
 }
 
+uint64_t Board::get_evaluation_id() const
+{
+	if (network && options.evaluator == Evaluator::NNUE)
+	{
+		return ((uint64_t) Evaluator::NNUE + 1) << 32 | network->get_hash();
+	}
+	if (options.evaluator == Evaluator::PATTERN)
+	{
+		return ((uint64_t) Evaluator::PATTERN + 1) << 32;
+	}
+	return ((uint64_t) Evaluator::CLASSIC + 1) << 32 | hash_eval_weights(weights);
+}
 
 std::vector<std::pair<int, int>> Board::get_markers() const
 {
@@ -0,0 +1,349 @@
+#include "dataset.h"
+#include "log.h"
+#include "match.h"
+#include "proof_search.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * What the generator plays and records.
+ */
+struct Datagen_config
+{
+	/** The engine playing both sides. */
+	Engine_config engine;
+	long long games = 1000;
+	int threads = 1;
+	/** Shards are named PREFIX-tNN-NNNN.c4r, by worker thread. */
+	std::string output = "selfplay";
+	long long shard_records = 1 << 22;
+	/** Every game opens with a uniform number of random moves up to this, which are not recorded. */
+	int random_plies = 8;
+	/** Probability that a searched move is replaced by a random one. */
+	double random_move = 0.05;
+	/** Probability that a searched position is recorded; positions whose move was not searched never are. */
+	double sample = 1.0;
+	/** Positions with at most this many empty squares are solved. */
+	int solve_empty = 24;
+	/** Node limit of each proof search of a solve. */
+	long long solve_nodes = 20000;
+	/** Size of the proof table of every worker. */
+	int solve_mb = 16;
+	unsigned seed = 1;
+};
+
+/**
+ * Counts of the generator, added up over the workers.
+ */
+struct Datagen_stats
+{
+	long long games = 0;
+	long long records = 0;
+	/** Records whose exact result is known. */
+	long long solved = 0;
+	/** Records whose position was solved, known or not. */
+	long long solve_attempts = 0;
+	int shards = 0;
+	std::string error;
+};
+
+/** Pick a random column that has room. */
+int get_random_move(const Board& board, std::mt19937_64& rng)
+{
+	int col;
+	do
+	{
+		col = (int) (rng() % BOARD_WIDTH);
+	} while (!board.is_playable(col));
+	return col;
+}
+
+/**
+ * Find the result of the player to move with perfect play: win if a proof search shows a forced win,
+ * otherwise a draw if some move leaves the opponent without one, otherwise a loss.
+ * @return the result, UNKNOWN if a proof search reached its node limit
+ */
+Training_record::Result solve_exact(Proof_search& solver, Board& board, long long max_nodes)
+{
+	Proof_limits limits;
+	limits.max_nodes = max_nodes;
+	Proof_search::Result result = solver.solve(board, limits);
+	if (result != Proof_search::Result::NO_WIN)
+	{
+		return result == Proof_search::Result::WIN ? Training_record::WIN : Training_record::UNKNOWN;
+	}
+	Training_record::Result exact = Training_record::LOSS;
+	for (int col = 0; col < BOARD_WIDTH && exact == Training_record::LOSS; col++)
+	{
+		if (!board.is_playable(col))
+		{
+			continue;
+		}
+		board.place(col);
+		// the move cannot win, so a finished game is a draw
+		result = board.test_win() == 3 ? Proof_search::Result::NO_WIN : solver.solve(board, limits);
+		exact = result == Proof_search::Result::NO_WIN ? Training_record::DRAW
+			: result == Proof_search::Result::UNKNOWN ? Training_record::UNKNOWN : Training_record::LOSS;
+		board.undo_last_move();
+	}
+	return exact;
+}
+
+/**
+ * Play one game and write its sampled positions once the outcome is known.
+ */
+void play_game(const Datagen_config& config, Board& board, Mcts* tree, Proof_search& solver, std::mt19937_64& rng,
+	Record_writer& writer, Datagen_stats& stats)
+{
+	board.reset();
+	if (board.get_transposition_table())
+	{
+		board.get_transposition_table()->clear();
+	}
+	if (tree)
+	{
+		tree->clear();
+	}
+	std::vector<Training_record> records;
+	std::uniform_real_distribution<double> chance(0, 1);
+	int random_plies = (int) (rng() % (config.random_plies + 1));
+	int test = 0;
+	while (test == 0)
+	{
+		int side = board.get_plies() & 1;
+		int col;
+		if (board.get_plies() < random_plies)
+		{
+			col = get_random_move(board, rng);
+		}
+		else
+		{
+			col = tree ? tree->find_best_move(board, side + 1, config.engine.limits)
+				: board.find_best_move(side + 1, config.engine.limits);
+			const Search_stats& search_stats = tree ? tree->get_search_stats() : board.get_search_stats();
+			// wins and forced blocks are played without a search, so they have no score
+			if (search_stats.source == Move_source::SEARCH && chance(rng) < config.sample)
+			{
+				const uint64_t* bitboard = board.get_board();
+				Training_record record;
+				record.bitboard[0] = bitboard[0];
+				record.bitboard[1] = bitboard[1];
+				record.score = search_stats.score;
+				record.side = (uint8_t) side;
+				record.exact = Training_record::UNKNOWN;
+				record.outcome = Training_record::UNKNOWN;
+				record.reserved = 0;
+				if ((int) SIZE - board.get_plies() <= config.solve_empty)
+				{
+					record.exact = solve_exact(solver, board, config.solve_nodes);
+					stats.solve_attempts++;
+					stats.solved += record.exact != Training_record::UNKNOWN ? 1 : 0;
+				}
+				records.push_back(record);
+			}
+			if (chance(rng) < config.random_move)
+			{
+				col = get_random_move(board, rng);
+			}
+		}
+		board.place(col);
+		test = board.test_win();
+	}
+	for (Training_record& record : records)
+	{
+		record.outcome = test == 3 ? Training_record::DRAW : test - 1 == record.side ? Training_record::WIN : Training_record::LOSS;
+		writer.write(record);
+	}
+	stats.games++;
+	stats.records += (long long) records.size();
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_datagen [--engine CONFIG] [--games N] [--threads N] [--output PREFIX] [--shard-records N]" << std::endl
+		<< "                          [--random-plies N] [--random-move P] [--sample P] [--solve-empty N] [--solve-nodes N]" << std::endl
+		<< "                          [--solve-hash MB] [--seed S]" << std::endl
+		<< "  Plays randomised self-play games and records positions with the engine's search score," << std::endl
+		<< "  the exact result when a proof search finds it cheaply, and the result of the game." << std::endl
+		<< "  --engine CONFIG    the engine, as for connectfour_selfplay (default depth=8,threats=1)" << std::endl
+		<< "  --games N          games to play (default 1000)" << std::endl
+		<< "  --threads N        games played in parallel, each thread writing its own shards (default all CPUs)" << std::endl
+		<< "  --output PREFIX    shards are written to PREFIX-tNN-NNNN.c4r (default selfplay)" << std::endl
+		<< "  --shard-records N  records per shard (default 4194304)" << std::endl
+		<< "  --random-plies N   open every game with up to N random moves, which are not recorded (default 8)" << std::endl
+		<< "  --random-move P    probability of replacing a searched move by a random one (default 0.05)" << std::endl
+		<< "  --sample P         probability of recording a searched position (default 1)" << std::endl
+		<< "  --solve-empty N    solve positions with at most N empty squares (default 24, 0 for none)" << std::endl
+		<< "  --solve-nodes N    node limit of every proof search of a solve (default 20000)" << std::endl
+		<< "  --solve-hash MB    proof table size per thread (default 16)" << std::endl
+		<< "  --seed S           seed of the random moves (default 1)" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Training data generator. Every thread plays games with its own engine, board and proof table,
+ * and writes its own shards, so the threads share nothing but the game counter.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	Datagen_config config;
+	config.threads = (int) std::thread::hardware_concurrency();
+	std::string engine_text = "depth=8,threats=1";
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+		{
+			engine_text = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--games") == 0 && i + 1 < argc)
+		{
+			config.games = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			config.threads = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			config.output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--shard-records") == 0 && i + 1 < argc)
+		{
+			config.shard_records = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--random-plies") == 0 && i + 1 < argc)
+		{
+			config.random_plies = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--random-move") == 0 && i + 1 < argc)
+		{
+			config.random_move = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+		{
+			config.sample = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--solve-empty") == 0 && i + 1 < argc)
+		{
+			config.solve_empty = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--solve-nodes") == 0 && i + 1 < argc)
+		{
+			config.solve_nodes = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--solve-hash") == 0 && i + 1 < argc)
+		{
+			config.solve_mb = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			config.seed = (unsigned) std::strtoul(argv[++i], nullptr, 10);
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	std::string error;
+	if (!parse_engine_config(engine_text, config.engine, error))
+	{
+		std::cerr << error << std::endl;
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	if (config.games <= 0 || config.shard_records <= 0 || config.random_plies < 0 || config.random_plies >= (int) SIZE
+		|| config.solve_nodes <= 0 || config.solve_mb <= 0)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	if (config.threads < 1)
+	{
+		config.threads = 1;
+	}
+
+	std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+	Datagen_stats total;
+	std::mutex total_mutex;
+	std::atomic<long long> next_game(0);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < config.threads; i++)
+	{
+		workers.push_back(std::thread(
+			[&, i]
+			{
+				const Engine_config& engine = config.engine;
+				Board board;
+				board.set_options(engine.options);
+				board.set_network(engine.network);
+				board.set_eval_weights(engine.weights);
+				std::unique_ptr<Mcts> tree;
+				if (engine.type == Engine_type::MCTS)
+				{
+					tree.reset(new Mcts(engine.hash_mb, engine.threads));
+					tree->set_playout_batch(engine.playout_batch);
+				}
+				else if (engine.options.use_transposition_table)
+				{
+					board.set_transposition_table(std::make_shared<Transposition_table>(engine.hash_mb, Transposition_table::Layout::BUCKETED, engine.memory));
+				}
+				Proof_search solver(config.solve_mb);
+				std::mt19937_64 rng(config.seed * 1000003ULL + i);
+				char prefix[16];
+				std::snprintf(prefix, sizeof(prefix), "-t%02d", i);
+				Record_writer writer(config.output + prefix, config.shard_records);
+				Datagen_stats local;
+				for (long long game = next_game++; game < config.games && writer.get_error().empty(); game = next_game++)
+				{
+					play_game(config, board, tree.get(), solver, rng, writer, local);
+				}
+				writer.close();
+				std::lock_guard<std::mutex> lock(total_mutex);
+				total.games += local.games;
+				total.records += local.records;
+				total.solved += local.solved;
+				total.solve_attempts += local.solve_attempts;
+				total.shards += writer.get_shards();
+				if (total.error.empty())
+				{
+					total.error = writer.get_error();
+				}
+			}
+		));
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_clock;
+	if (!total.error.empty())
+	{
+		std::cerr << total.error << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << total.games << " games, " << total.records << " records in " << total.shards << " shards, "
+		<< total.solved << "/" << total.solve_attempts << " solved positions known exactly" << std::endl;
+	std::cout << elapsed.count() << " s, " << (elapsed.count() > 0 ? 60 * total.records / elapsed.count() : 0.0)
+		<< " records/min, " << config.threads << " threads" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include "dataset.h"
+#include "global.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace con4game
+{
+namespace
+{
+
+const char RECORD_MAGIC[8] = { 'C', 'O', 'N', '4', 'R', 'E', 'C', '\n' };
+/** Bump whenever the record format changes. */
+const uint32_t RECORD_VERSION = 1;
+/** Written in native byte order, to detect a file of a machine with the other one. */
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/**
+ * Header of a record file, followed by the records.
+ */
+struct Record_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t board_width;
+	uint32_t board_height;
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+} // namespace
+
+std::string get_shard_name(const std::string& prefix, int index)
+{
+	char number[24];
+	std::snprintf(number, sizeof(number), "-%04d.c4r", index);
+	return prefix + number;
+}
+
+Record_writer::Record_writer(const std::string& prefix, long long shard_records, std::size_t buffer_records)
+: prefix(prefix)
+, shard_records(shard_records > 0 ? shard_records : 1)
+, buffer()
+, file()
+, in_shard(0)
+, count(0)
+, shards(0)
+, error()
+{
+	buffer.reserve(buffer_records > 0 ? buffer_records : 1);
+}
+
+Record_writer::~Record_writer()
+{
+	close();
+}
+
+bool Record_writer::write(const Training_record& record)
+{
+	if (!error.empty())
+	{
+		return false;
+	}
+	buffer.push_back(record);
+	count++;
+	return buffer.size() < buffer.capacity() || flush();
+}
+
+bool Record_writer::close()
+{
+	bool flushed = flush();
+	if (file.is_open())
+	{
+		file.close();
+	}
+	return flushed;
+}
+
+bool Record_writer::flush()
+{
+	CON4_TRACE_SCOPE("records_flush");
+	std::size_t first = 0;
+	while (error.empty() && first < buffer.size())
+	{
+		if (!file.is_open() || in_shard == shard_records)
+		{
+			if (file.is_open())
+			{
+				file.close();
+			}
+			std::string path = get_shard_name(prefix, shards++);
+			file.open(path, std::ios::binary | std::ios::trunc);
+			Record_header header;
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+			header.version = RECORD_VERSION;
+			header.byte_order = BYTE_ORDER_MARK;
+			header.board_width = (uint32_t) BOARD_WIDTH;
+			header.board_height = (uint32_t) BOARD_HEIGHT;
+			header.record_size = sizeof(Training_record);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			in_shard = 0;
+			if (!file)
+			{
+				error = path + ": cannot be written";
+				break;
+			}
+		}
+		std::size_t block = (std::size_t) std::min<long long>((long long) (buffer.size() - first), shard_records - in_shard);
+		file.write(reinterpret_cast<const char*>(&buffer[first]), (std::streamsize) (block * sizeof(Training_record)));
+		if (!file)
+		{
+			error = get_shard_name(prefix, shards - 1) + ": cannot be written";
+		}
+		in_shard += (long long) block;
+		first += block;
+	}
+	buffer.clear();
+	return error.empty() && (!file.is_open() || file.flush());
+}
+
+long long Record_writer::get_count() const
+{
+	return count;
+}
+
+int Record_writer::get_shards() const
+{
+	return shards;
+}
+
+const std::string& Record_writer::get_error() const
+{
+	return error;
+}
+
+Record_file::Record_file(std::unique_ptr<Large_memory> memory)
+: memory(std::move(memory))
+{
+}
+
+std::unique_ptr<Record_file> Record_file::open(const std::string& path, std::string& error)
+{
+	std::unique_ptr<Large_memory> memory = Large_memory::map_file(path, error);
+	if (!memory)
+	{
+		return nullptr;
+	}
+	const Record_header* header = static_cast<const Record_header*>(memory->get());
+	if (memory->get_size() < sizeof(Record_header) || std::memcmp(header->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0)
+	{
+		error = path + ": not a record file";
+	}
+	else if (header->version != RECORD_VERSION || header->byte_order != BYTE_ORDER_MARK || header->record_size != sizeof(Training_record))
+	{
+		error = path + ": record format " + std::to_string(header->version) + " is not supported";
+	}
+	else if (header->board_width != BOARD_WIDTH || header->board_height != BOARD_HEIGHT)
+	{
+		error = path + ": records of a " + std::to_string(header->board_width) + "x" + std::to_string(header->board_height) + " board";
+	}
+	else if ((memory->get_size() - sizeof(Record_header)) % sizeof(Training_record) != 0)
+	{
+		error = path + ": record file is truncated";
+	}
+	else
+	{
+		return std::unique_ptr<Record_file>(new Record_file(std::move(memory)));
+	}
+	return nullptr;
+}
+
+const Training_record* Record_file::get_records() const
+{
+	return reinterpret_cast<const Training_record*>(static_cast<const char*>(memory->get()) + sizeof(Record_header));
+}
+
+std::size_t Record_file::get_count() const
+{
+	return (memory->get_size() - sizeof(Record_header)) / sizeof(Training_record);
+}
+
+} // namespace con4game
@@ -0,0 +1,414 @@
+#include "disk_store.h"
+#include "global.h"
+#include "trace.h"
+#include "transposition_table.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+const int BUCKET_BYTES = 64;
+const int WORDS_PER_BUCKET = BUCKET_BYTES / 8;
+/** Unit of the batched writes. */
+const int PAGE_BYTES = 4096;
+/** The shard header takes one page, so that the buckets stay page aligned. */
+const int HEADER_BYTES = PAGE_BYTES;
+/** Entries collected before a batch is handed to the I/O thread. */
+const std::size_t BATCH_ENTRIES = 1 << 16;
+/** Batches waiting at most; the search blocks when the disk falls this far behind. */
+const std::size_t MAX_BATCHES = 8;
+/** Lookups waiting at most; more are dropped. */
+const std::size_t MAX_READS = 4096;
+
+const char SHARD_MAGIC[8] = { 'C', 'O', 'N', '4', 'D', 'S', '\r', '\n' };
+/** Bump whenever the entry format or the score scale changes. */
+const uint32_t SHARD_VERSION = 2;
+
+struct Shard_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t board_width;
+	uint32_t board_height;
+	uint32_t disk_bits;
+	uint32_t shard_bits;
+	/** log2 of the number of hot buckets the entries were placed for. */
+	uint32_t hot_bits;
+};
+
+#if defined(_MSC_VER)
+HANDLE to_handle(intptr_t file)
+{
+	return reinterpret_cast<HANDLE>(file);
+}
+#endif
+
+/** Resize a file, leaving it sparse where the file system allows. */
+bool resize_file(intptr_t file, uint64_t bytes)
+{
+#if defined(_MSC_VER)
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG) bytes;
+	return SetFilePointerEx(to_handle(file), size, nullptr, FILE_BEGIN) && SetEndOfFile(to_handle(file));
+#else
+	return ftruncate((int) file, (off_t) bytes) == 0;
+#endif
+}
+
+} // namespace
+
+Disk_store::Disk_store(const std::string& directory, std::size_t size_mb, int shards)
+: directory(directory)
+, shard_bits(0)
+, disk_bits(0)
+, hot_bits(-1)
+, table(nullptr)
+, busy(false)
+, stopping(false)
+{
+	while ((2 << shard_bits) <= shards)
+	{
+		shard_bits++;
+	}
+	std::size_t bytes = (size_mb < 1 ? 1 : size_mb) << 20;
+	while (((std::size_t) BUCKET_BYTES << (disk_bits + 1)) <= bytes)
+	{
+		disk_bits++;
+	}
+	// a shard holds at least one page
+	disk_bits = std::max(disk_bits, shard_bits + 6);
+	for (int shard = 0; shard < (1 << shard_bits); shard++)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "/shard_%02d.c4tt", shard);
+		std::string path = directory + name;
+#if defined(_MSC_VER)
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			error = path + ": cannot open";
+			break;
+		}
+		files.push_back(reinterpret_cast<intptr_t>(handle));
+#else
+		int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			error = path + ": " + std::strerror(errno);
+			break;
+		}
+		files.push_back(fd);
+#endif
+	}
+	worker = std::thread(&Disk_store::run, this);
+}
+
+Disk_store::~Disk_store()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	worker.join();
+	for (intptr_t file : files)
+	{
+#if defined(_MSC_VER)
+		CloseHandle(to_handle(file));
+#else
+		close((int) file);
+#endif
+	}
+}
+
+bool Disk_store::is_open() const
+{
+	return error.empty();
+}
+
+const std::string& Disk_store::get_error() const
+{
+	return error;
+}
+
+void Disk_store::bind(Transposition_table* new_table, int bucket_bits)
+{
+	flush();
+	std::lock_guard<std::mutex> lock(mutex);
+	table = new_table;
+	if (!new_table || bucket_bits == hot_bits || !is_open())
+	{
+		return;
+	}
+	hot_bits = bucket_bits;
+	uint64_t shard_bytes = (uint64_t) BUCKET_BYTES << (disk_bits - shard_bits);
+	for (int shard = 0; shard < (int) files.size(); shard++)
+	{
+		Shard_header expected;
+		std::memset(&expected, 0, sizeof(expected));
+		std::memcpy(expected.magic, SHARD_MAGIC, sizeof(SHARD_MAGIC));
+		expected.version = SHARD_VERSION;
+		expected.board_width = (uint32_t) BOARD_WIDTH;
+		expected.board_height = (uint32_t) BOARD_HEIGHT;
+		expected.disk_bits = (uint32_t) disk_bits;
+		expected.shard_bits = (uint32_t) shard_bits;
+		expected.hot_bits = (uint32_t) hot_bits;
+		Shard_header found;
+		if (read_at(shard, 0, &found, sizeof(found)) && std::memcmp(&found, &expected, sizeof(found)) == 0)
+		{
+			continue;
+		}
+		// written for another shape, or new
+		if (!resize_file(files[shard], 0) || !resize_file(files[shard], HEADER_BYTES + shard_bytes)
+			|| !write_at(shard, 0, &expected, sizeof(expected)))
+		{
+			error = directory + ": cannot size the shard files";
+			return;
+		}
+	}
+}
+
+uint64_t Disk_store::disk_bucket(uint64_t bucket, uint32_t check) const
+{
+	// the hot bucket index selects a range of disk buckets, the low check bits one of them
+	if (disk_bits <= hot_bits)
+	{
+		return bucket >> (hot_bits - disk_bits);
+	}
+	int extra = disk_bits - hot_bits;
+	return (bucket << extra) | (check & ((1ULL << extra) - 1));
+}
+
+bool Disk_store::read_at(int shard, uint64_t offset, void* data, std::size_t bytes)
+{
+#if defined(_MSC_VER)
+	OVERLAPPED position = {};
+	position.Offset = (DWORD) offset;
+	position.OffsetHigh = (DWORD) (offset >> 32);
+	DWORD done = 0;
+	return ReadFile(to_handle(files[shard]), data, (DWORD) bytes, &done, &position) && done == bytes;
+#else
+	return pread((int) files[shard], data, bytes, (off_t) offset) == (ssize_t) bytes;
+#endif
+}
+
+bool Disk_store::write_at(int shard, uint64_t offset, const void* data, std::size_t bytes)
+{
+#if defined(_MSC_VER)
+	OVERLAPPED position = {};
+	position.Offset = (DWORD) offset;
+	position.OffsetHigh = (DWORD) (offset >> 32);
+	DWORD done = 0;
+	return WriteFile(to_handle(files[shard]), data, (DWORD) bytes, &done, &position) && done == bytes;
+#else
+	return pwrite((int) files[shard], data, bytes, (off_t) offset) == (ssize_t) bytes;
+#endif
+}
+
+void Disk_store::spill(uint64_t bucket, uint64_t word)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (hot_bits < 0 || !is_open())
+	{
+		return;
+	}
+	stats.spilled++;
+	collecting.push_back(std::make_pair(disk_bucket(bucket, Transposition_table::unpack(word).check), word));
+	if (collecting.size() >= BATCH_ENTRIES)
+	{
+		// back pressure instead of unbounded memory when the disk cannot keep up,
+		// except for the I/O thread itself, which spills when it copies entries into the hot table
+		if (std::this_thread::get_id() != worker.get_id())
+		{
+			idle.wait(lock, [this] { return batches.size() < MAX_BATCHES; });
+		}
+		batches.push_back(std::move(collecting));
+		collecting.clear();
+		collecting.reserve(BATCH_ENTRIES);
+		wake.notify_one();
+	}
+}
+
+void Disk_store::request(uint64_t bucket, uint32_t check)
+{
+	bool was_empty = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (hot_bits < 0 || !is_open())
+		{
+			return;
+		}
+		if (reads.size() >= MAX_READS)
+		{
+			stats.reads_dropped++;
+			return;
+		}
+		stats.reads++;
+		was_empty = reads.empty();
+		reads.push_back(Read_request { bucket, check });
+	}
+	// the I/O thread drains the whole queue once woken
+	if (was_empty)
+	{
+		wake.notify_one();
+	}
+}
+
+void Disk_store::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!collecting.empty())
+	{
+		batches.push_back(std::move(collecting));
+		collecting.clear();
+		wake.notify_one();
+	}
+	idle.wait(lock, [this] { return batches.empty() && reads.empty() && !busy; });
+}
+
+Disk_store::Stats Disk_store::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+std::size_t Disk_store::get_size() const
+{
+	return (std::size_t) BUCKET_BYTES << disk_bits;
+}
+
+void Disk_store::write_batch(std::vector<std::pair<uint64_t, uint64_t>>& batch)
+{
+	CON4_TRACE_SCOPE_ARG("disk_write", (long long) batch.size());
+	// stable, so that a later result of the same position is merged last
+	std::stable_sort(batch.begin(), batch.end(),
+		[](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b)
+		{
+			return a.first < b.first;
+		});
+	const int buckets_per_page = PAGE_BYTES / BUCKET_BYTES;
+	int shard_shift = disk_bits - shard_bits;
+	uint64_t page[PAGE_BYTES / 8];
+	long long written = 0;
+	long long read = 0;
+	std::size_t i = 0;
+	while (i < batch.size())
+	{
+		uint64_t page_index = batch[i].first / buckets_per_page;
+		int shard = (int) (batch[i].first >> shard_shift);
+		uint64_t offset = HEADER_BYTES + ((page_index * buckets_per_page) & ((1ULL << shard_shift) - 1)) * BUCKET_BYTES;
+		if (!read_at(shard, offset, page, sizeof(page)))
+		{
+			std::memset(page, 0, sizeof(page));
+		}
+		read += sizeof(page);
+		for (; i < batch.size() && batch[i].first / buckets_per_page == page_index; i++)
+		{
+			uint64_t* words = page + (batch[i].first % buckets_per_page) * WORDS_PER_BUCKET;
+			Transposition_table::Entry entry = Transposition_table::unpack(batch[i].second);
+			// the same position if present, otherwise an empty entry, otherwise the shallowest one
+			int target = -1;
+			int shallowest = 0;
+			for (int slot = 0; slot < WORDS_PER_BUCKET && target < 0; slot++)
+			{
+				Transposition_table::Entry other = Transposition_table::unpack(words[slot]);
+				if (words[slot] == 0 || other.check == entry.check)
+				{
+					target = other.check == entry.check && other.depth > entry.depth ? WORDS_PER_BUCKET : slot;
+				}
+				else if (other.depth < Transposition_table::unpack(words[shallowest]).depth)
+				{
+					shallowest = slot;
+				}
+			}
+			if (target < 0 && Transposition_table::unpack(words[shallowest]).depth <= entry.depth)
+			{
+				target = shallowest;
+			}
+			if (target >= 0 && target < WORDS_PER_BUCKET)
+			{
+				words[target] = batch[i].second;
+			}
+		}
+		write_at(shard, offset, page, sizeof(page));
+		written += sizeof(page);
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.write_batches++;
+	stats.bytes_written += written;
+	stats.bytes_read += read;
+}
+
+void Disk_store::read_entry(const Read_request& request)
+{
+	uint64_t index = disk_bucket(request.bucket, request.check);
+	int shard_shift = disk_bits - shard_bits;
+	int shard = (int) (index >> shard_shift);
+	uint64_t words[WORDS_PER_BUCKET];
+	if (!read_at(shard, HEADER_BYTES + (index & ((1ULL << shard_shift) - 1)) * BUCKET_BYTES, words, sizeof(words)))
+	{
+		return;
+	}
+	bool found = false;
+	for (int slot = 0; slot < WORDS_PER_BUCKET && !found; slot++)
+	{
+		Transposition_table::Entry entry = Transposition_table::unpack(words[slot]);
+		if (words[slot] != 0 && entry.check == request.check)
+		{
+			table->place(request.bucket, entry);
+			found = true;
+		}
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.bytes_read += sizeof(words);
+	stats.read_hits += found ? 1 : 0;
+}
+
+void Disk_store::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		wake.wait(lock, [this] { return stopping || !batches.empty() || !reads.empty(); });
+		if (stopping && batches.empty() && reads.empty())
+		{
+			return;
+		}
+		busy = true;
+		// lookups first, the search is waiting for them to be useful
+		if (!reads.empty())
+		{
+			Read_request request = reads.front();
+			reads.pop_front();
+			lock.unlock();
+			read_entry(request);
+			lock.lock();
+		}
+		else
+		{
+			std::vector<std::pair<uint64_t, uint64_t>> batch = std::move(batches.front());
+			batches.pop_front();
+			lock.unlock();
+			write_batch(batch);
+			lock.lock();
+		}
+		busy = false;
+		idle.notify_all();
+	}
+}
+
+} // namespace con4game
@@ -0,0 +1,490 @@
+#include "evaluation.h"
+#include "global.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+// every CPU with AVX2 has BMI2, MSVC defines no macro for the latter
+#define CON4_HAS_PEXT 1
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+/** Bump whenever the meaning of the weights changes. */
+const int WEIGHTS_VERSION = 2;
+
+const char* const DIRECTION_NAMES[WINDOW_DIRECTIONS] = { "vertical", "horizontal", "diagonal_up", "diagonal_down" };
+
+/** The windows of four squares on the board. */
+const int WINDOWS = (int) ((BOARD_HEIGHT - 3) * BOARD_WIDTH + BOARD_HEIGHT * (BOARD_WIDTH - 3) + 2 * (BOARD_HEIGHT - 3) * (BOARD_WIDTH - 3));
+
+/** The bit index distance between neighbouring squares of a window, by direction. */
+const int DIRECTION_SHIFTS[WINDOW_DIRECTIONS] = { 1, (int) H1, (int) H2, (int) BOARD_HEIGHT };
+
+/** Get the squares a window of a direction can start at, so that all four squares are on the board. */
+uint64_t make_window_starts(int direction)
+{
+	const int row_steps[WINDOW_DIRECTIONS] = { 1, 0, 1, -1 };
+	const int column_steps[WINDOW_DIRECTIONS] = { 0, 1, 1, 1 };
+	uint64_t starts = 0;
+	for (int col = 0; col < (int) BOARD_WIDTH; col++)
+	{
+		for (int row = 0; row < (int) BOARD_HEIGHT; row++)
+		{
+			int last_row = row + 3 * row_steps[direction];
+			int last_column = col + 3 * column_steps[direction];
+			if (last_row >= 0 && last_row < (int) BOARD_HEIGHT && last_column < (int) BOARD_WIDTH)
+			{
+				starts |= 1ULL << (col * H1 + row);
+			}
+		}
+	}
+	return starts;
+}
+
+const uint64_t WINDOW_STARTS[WINDOW_DIRECTIONS] =
+{
+	make_window_starts(VERTICAL), make_window_starts(HORIZONTAL), make_window_starts(DIAGONAL_UP), make_window_starts(DIAGONAL_DOWN)
+};
+
+int count_bits(uint64_t bits)
+{
+#if defined(_MSC_VER)
+	return (int) __popcnt64(bits);
+#else
+	return __builtin_popcountll(bits);
+#endif
+}
+
+/**
+ * Count the windows of one player by tally.
+ * @param counters  the player's counters
+ * @param open      the window starts without an opponent counter
+ * @param shift     the distance between the squares of a window
+ * @param counts    receives the windows with 1 to 4 counters
+ */
+void count_tallies(uint64_t counters, uint64_t open, int shift, uint8_t counts[4])
+{
+	uint64_t a = counters;
+	uint64_t b = counters >> shift;
+	uint64_t c = counters >> 2 * shift;
+	uint64_t d = counters >> 3 * shift;
+	// two half adders and a full adder give the tally of every window in bits `high`, `middle` and `low`
+	uint64_t sum_ab = a ^ b;
+	uint64_t carry_ab = a & b;
+	uint64_t sum_cd = c ^ d;
+	uint64_t carry_cd = c & d;
+	uint64_t low = sum_ab ^ sum_cd;
+	uint64_t carry_low = sum_ab & sum_cd;
+	uint64_t middle = carry_ab ^ carry_cd ^ carry_low;
+	uint64_t high = (carry_ab & carry_cd) | (carry_low & (carry_ab ^ carry_cd));
+	counts[0] = (uint8_t) count_bits(open & ~high & ~middle & low);
+	counts[1] = (uint8_t) count_bits(open & ~high & middle & ~low);
+	counts[2] = (uint8_t) count_bits(open & ~high & middle & low);
+	counts[3] = (uint8_t) count_bits(open & high);
+}
+
+/**
+ * Weights of the pattern tables by direction and by the number of counters (1 to 4) in a window
+ * without an opponent counter, the same for both players.
+ */
+constexpr int PATTERN_WEIGHTS[WINDOW_DIRECTIONS][4] =
+{
+	{ 1, 16, 81, 256 },
+	{ 1, 16, 81, 256 },
+	{ 1, 16, 81, 256 },
+	{ 1, 16, 81, 256 }
+};
+
+/**
+ * Added to a window of three counters by the row of its empty square, by player.
+ * The first player profits from threats on odd rows (counted from 1 at the bottom), the second from even rows:
+ * once the other columns are full, the player who has to move below a threat gives it away.
+ * A threat on the bottom row is an immediate win, which the search sees without help.
+ */
+constexpr int THREAT_ROW_WEIGHTS[2][BOARD_HEIGHT] =
+{
+	{ 0, 0, 96, 0, 64, 0 },
+	{ 0, 96, 0, 64, 0, 32 }
+};
+
+/**
+ * The window classes of the pattern tables: the windows of a class have the same direction
+ * and their squares on the same rows. A class per start row:
+ * vertical windows start on rows 0 to 2, horizontal ones on rows 0 to 5, diagonals up on rows 0 to 2,
+ * and diagonals down, read from left to right, on rows 3 to 5.
+ */
+const int VERTICAL_CLASSES = 0;
+const int HORIZONTAL_CLASSES = VERTICAL_CLASSES + 3;
+const int DIAGONAL_UP_CLASSES = HORIZONTAL_CLASSES + (int) BOARD_HEIGHT;
+const int DIAGONAL_DOWN_CLASSES = DIAGONAL_UP_CLASSES + 3;
+const int WINDOW_CLASSES = DIAGONAL_DOWN_CLASSES + 3;
+
+/** A pattern index holds the counters of the first player in the squares of a window in bits 0 to 3, the second's in bits 4 to 7. */
+const int PATTERNS = 256;
+
+/**
+ * Scores of every pattern of every window class for the first player.
+ */
+struct Pattern_tables
+{
+	int16_t values[WINDOW_CLASSES][PATTERNS];
+};
+
+constexpr int count_pattern_bits(int bits)
+{
+	int count = 0;
+	for (; bits != 0; bits &= bits - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Score a window without opponent counters for one player.
+ * @param own     the player's counters in the four squares, not 0
+ * @param rows    the rows of the four squares
+ * @param player  0 for the first player, 1 for the second
+ */
+constexpr int score_window(int own, int direction, const int rows[4], int player)
+{
+	int tally = count_pattern_bits(own);
+	int score = PATTERN_WEIGHTS[direction][tally - 1];
+	if (tally == 3)
+	{
+		for (int square = 0; square < 4; square++)
+		{
+			if ((own & (1 << square)) == 0)
+			{
+				score += THREAT_ROW_WEIGHTS[player][rows[square]];
+			}
+		}
+	}
+	return score;
+}
+
+constexpr Pattern_tables make_pattern_tables()
+{
+	Pattern_tables tables {};
+	for (int window_class = 0; window_class < WINDOW_CLASSES; window_class++)
+	{
+		int direction = VERTICAL;
+		int start = window_class - VERTICAL_CLASSES;
+		int step = 1;
+		if (window_class >= DIAGONAL_DOWN_CLASSES)
+		{
+			direction = DIAGONAL_DOWN;
+			start = window_class - DIAGONAL_DOWN_CLASSES + 3;
+			step = -1;
+		}
+		else if (window_class >= DIAGONAL_UP_CLASSES)
+		{
+			direction = DIAGONAL_UP;
+			start = window_class - DIAGONAL_UP_CLASSES;
+		}
+		else if (window_class >= HORIZONTAL_CLASSES)
+		{
+			direction = HORIZONTAL;
+			start = window_class - HORIZONTAL_CLASSES;
+			step = 0;
+		}
+		const int rows[4] = { start, start + step, start + 2 * step, start + 3 * step };
+		// a window with counters of both players scores nothing for either, which leaves the patterns of one player
+		for (int counters = 1; counters < 16; counters++)
+		{
+			tables.values[window_class][counters] = (int16_t) score_window(counters, direction, rows, 0);
+			tables.values[window_class][counters << 4] = (int16_t) -score_window(counters, direction, rows, 1);
+		}
+	}
+	return tables;
+}
+
+constexpr Pattern_tables PATTERN_TABLES = make_pattern_tables();
+
+static_assert(PATTERN_TABLES.values[HORIZONTAL_CLASSES + 2][0x07] == 81 + 96, "a threat of the first player on the third row earns its parity weight");
+static_assert(PATTERN_TABLES.values[HORIZONTAL_CLASSES + 2][0x70] == -81, "one of the second player does not");
+static_assert(PATTERN_TABLES.values[VERTICAL_CLASSES][0x11] == 0, "a window with counters of both players is blocked");
+
+constexpr int get_max_pattern_value(const Pattern_tables& tables)
+{
+	int max = 0;
+	for (int window_class = 0; window_class < WINDOW_CLASSES; window_class++)
+	{
+		for (int pattern = 0; pattern < PATTERNS; pattern++)
+		{
+			int value = tables.values[window_class][pattern];
+			max = std::max(max, value < 0 ? -value : value);
+		}
+	}
+	return max;
+}
+
+static_assert(WINDOWS * get_max_pattern_value(PATTERN_TABLES) <= SCORE_EVAL_MAX, "the pattern tables must stay within the heuristic scores");
+static_assert(WINDOWS * 4 * 4 * 4 * 4 <= SCORE_EVAL_MAX, "the hand-set weights must stay within the heuristic scores");
+
+/** Gather the bits of `bits` selected by `mask` into the low bits, in order. */
+inline uint64_t extract_bits(uint64_t bits, uint64_t mask)
+{
+#if defined(CON4_HAS_PEXT)
+	return _pext_u64(bits, mask);
+#else
+	uint64_t result = 0;
+	for (uint64_t target = 1; mask != 0; mask &= mask - 1, target <<= 1)
+	{
+		if (bits & mask & (0 - mask))
+		{
+			result |= target;
+		}
+	}
+	return result;
+#endif
+}
+
+/**
+ * Score the windows of a line, whose squares are the low bits of `first` and, shifted up by four, `second_high`.
+ * The window starting at square `window` of the line is of class `First_class + window * Class_step`.
+ * A template per number of windows unrolls the line into a lookup per window with constant shifts and offsets.
+ */
+template <int Windows, int First_class, int Class_step>
+struct Line_score
+{
+	static int get(uint64_t first, uint64_t second_high)
+	{
+		const int window = Windows - 1;
+		int pattern = (int) (((first >> window) & 15) | ((second_high >> window) & 0xF0));
+		return Line_score<window, First_class, Class_step>::get(first, second_high)
+			+ PATTERN_TABLES.values[First_class + window * Class_step][pattern];
+	}
+};
+
+template <int First_class, int Class_step>
+struct Line_score<0, First_class, Class_step>
+{
+	static int get(uint64_t, uint64_t)
+	{
+		return 0;
+	}
+};
+
+template <int Windows, int First_class, int Class_step>
+inline int score_line(uint64_t first, uint64_t second)
+{
+	return Line_score<Windows, First_class, Class_step>::get(first, second << 4);
+}
+
+/** Get the squares of the diagonal starting in the given square and going right, up (`row_step` 1) or down (-1). */
+constexpr uint64_t get_diagonal_mask(int row, int col, int row_step)
+{
+	uint64_t mask = 0;
+	for (int r = row, c = col; r >= 0 && r < (int) BOARD_HEIGHT && c < (int) BOARD_WIDTH; r += row_step, c++)
+	{
+		mask |= 1ULL << (c * H1 + r);
+	}
+	return mask;
+}
+
+/** Score the windows of the diagonal starting in the given square and going right, up (`Row_step` 1) or down (-1). */
+template <int Row, int Column, int Row_step>
+inline int score_diagonal(uint64_t first, uint64_t second)
+{
+	constexpr uint64_t mask = get_diagonal_mask(Row, Column, Row_step);
+	// a diagonal has as many squares as rows or columns it can reach, a window for every square from the fourth on
+	constexpr int length = Row_step == 1 ? (int) std::min(BOARD_HEIGHT - Row, BOARD_WIDTH - Column) : (int) std::min<uint64_t>(Row + 1, BOARD_WIDTH - Column);
+	constexpr int first_class = Row_step == 1 ? DIAGONAL_UP_CLASSES + Row : DIAGONAL_DOWN_CLASSES + Row - 3;
+	return score_line<length - 3, first_class, Row_step>(extract_bits(first, mask), extract_bits(second, mask));
+}
+
+/** Score the vertical windows of a column. */
+template <int Column>
+inline int score_column(uint64_t first, uint64_t second)
+{
+	// a column needs no gathering, its squares are adjacent bits
+	return score_line<3, VERTICAL_CLASSES, 1>((first >> Column * H1) & COL1, (second >> Column * H1) & COL1);
+}
+
+/** Score the horizontal windows of a row. */
+template <int Row>
+inline int score_row(uint64_t first, uint64_t second)
+{
+	return score_line<4, HORIZONTAL_CLASSES + Row, 0>(extract_bits(first, BOTTOM << Row), extract_bits(second, BOTTOM << Row));
+}
+
+} // namespace
+
+Eval_weights get_classic_weights()
+{
+	Eval_weights weights;
+	for (int direction = 0; direction < WINDOW_DIRECTIONS; direction++)
+	{
+		for (int tally = 1; tally <= 4; tally++)
+		{
+			weights.own[direction][tally - 1] = tally * tally * tally * tally;
+			weights.other[direction][tally - 1] = 0;
+		}
+	}
+	weights.player_to_move = false;
+	return weights;
+}
+
+uint32_t hash_eval_weights(const Eval_weights& weights)
+{
+	// FNV-1a over the weights and the view, leaving out the padding of the struct
+	uint32_t hash = 2166136261u;
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&weights.own[0][0]);
+	for (std::size_t i = 0; i < sizeof(weights.own) + sizeof(weights.other); i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return (hash ^ (weights.player_to_move ? 1u : 0u)) * 16777619u;
+}
+
+void count_windows(uint64_t own, uint64_t other, Window_counts& counts)
+{
+	for (int direction = 0; direction < WINDOW_DIRECTIONS; direction++)
+	{
+		int shift = DIRECTION_SHIFTS[direction];
+		uint64_t own_any = own | (own >> shift) | (own >> 2 * shift) | (own >> 3 * shift);
+		uint64_t other_any = other | (other >> shift) | (other >> 2 * shift) | (other >> 3 * shift);
+		count_tallies(own, WINDOW_STARTS[direction] & ~other_any, shift, counts.own[direction]);
+		count_tallies(other, WINDOW_STARTS[direction] & ~own_any, shift, counts.other[direction]);
+	}
+}
+
+int evaluate_windows(const Window_counts& counts, const Eval_weights& weights)
+{
+	int score = 0;
+	for (int direction = 0; direction < WINDOW_DIRECTIONS; direction++)
+	{
+		for (int tally = 0; tally < 4; tally++)
+		{
+			score += counts.own[direction][tally] * weights.own[direction][tally]
+				- counts.other[direction][tally] * weights.other[direction][tally];
+		}
+	}
+	// loaded weights are not bounded
+	return std::max(-SCORE_EVAL_MAX, std::min(SCORE_EVAL_MAX, score));
+}
+
+int evaluate_patterns(uint64_t first, uint64_t second)
+{
+	return score_column<0>(first, second) + score_column<1>(first, second) + score_column<2>(first, second)
+		+ score_column<3>(first, second) + score_column<4>(first, second) + score_column<5>(first, second)
+		+ score_column<6>(first, second)
+		+ score_row<0>(first, second) + score_row<1>(first, second) + score_row<2>(first, second)
+		+ score_row<3>(first, second) + score_row<4>(first, second) + score_row<5>(first, second)
+		+ score_diagonal<2, 0, 1>(first, second) + score_diagonal<1, 0, 1>(first, second)
+		+ score_diagonal<0, 0, 1>(first, second) + score_diagonal<0, 1, 1>(first, second)
+		+ score_diagonal<0, 2, 1>(first, second) + score_diagonal<0, 3, 1>(first, second)
+		+ score_diagonal<3, 0, -1>(first, second) + score_diagonal<4, 0, -1>(first, second)
+		+ score_diagonal<5, 0, -1>(first, second) + score_diagonal<5, 1, -1>(first, second)
+		+ score_diagonal<5, 2, -1>(first, second) + score_diagonal<5, 3, -1>(first, second);
+}
+
+bool save_eval_weights(const std::string& path, const Eval_weights& weights)
+{
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary);
+		if (!file)
+		{
+			return false;
+		}
+		file << "version " << WEIGHTS_VERSION << std::endl;
+		file << "view " << (weights.player_to_move ? "player_to_move" : "searching_player") << std::endl;
+		for (int side = 0; side < 2; side++)
+		{
+			for (int direction = 0; direction < WINDOW_DIRECTIONS; direction++)
+			{
+				const int32_t* values = side == 0 ? weights.own[direction] : weights.other[direction];
+				file << (side == 0 ? "own_" : "other_") << DIRECTION_NAMES[direction];
+				for (int tally = 0; tally < 4; tally++)
+				{
+					file << " " << values[tally];
+				}
+				file << std::endl;
+			}
+		}
+		if (!file)
+		{
+			return false;
+		}
+	}
+	return replace_file(temporary, path);
+}
+
+bool load_eval_weights(const std::string& path, Eval_weights& weights, std::string& error)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		error = path + ": cannot be opened";
+		return false;
+	}
+	Eval_weights loaded = weights;
+	std::string line;
+	int version = 0;
+	while (std::getline(file, line))
+	{
+		std::stringstream ss(line);
+		std::string key;
+		ss >> key;
+		if (key.empty())
+		{
+			continue;
+		}
+		if (key == "version")
+		{
+			ss >> version;
+			continue;
+		}
+		if (key == "view")
+		{
+			std::string view;
+			ss >> view;
+			if (view != "player_to_move" && view != "searching_player")
+			{
+				error = path + ": invalid line: " + line;
+				return false;
+			}
+			loaded.player_to_move = view == "player_to_move";
+			continue;
+		}
+		int32_t* values = nullptr;
+		for (int direction = 0; direction < WINDOW_DIRECTIONS; direction++)
+		{
+			if (key == std::string("own_") + DIRECTION_NAMES[direction])
+			{
+				values = loaded.own[direction];
+			}
+			else if (key == std::string("other_") + DIRECTION_NAMES[direction])
+			{
+				values = loaded.other[direction];
+			}
+		}
+		if (!values || !(ss >> values[0] >> values[1] >> values[2] >> values[3]))
+		{
+			error = path + ": invalid line: " + line;
+			return false;
+		}
+	}
+	if (version != WEIGHTS_VERSION)
+	{
+		error = path + ": weights format " + std::to_string(version) + " is not supported";
+		return false;
+	}
+	weights = loaded;
+	return true;
+}
+
+} // namespace con4game
@@ -2,9 +2,12 @@
 #include "game.h"
 #include "board.h"
 #include "asset.h"
+#include "log.h"
+#include "trace.h"
 
 #include <SFML/Graphics.hpp>
 
+#include <fstream>
 #include <numeric>
 #include <thread>
 #include <sstream>
@@ -12,6 +15,28 @@
 
 namespace con4game
 {
+namespace
+{
+
+/** Log how the computer chose its move. */
+void log_search_stats(int player, const Search_stats& stats)
+{
+	switch (stats.source)
+	{
+	case Move_source::IMMEDIATE_WIN:
+		Logger::get().write(Log_level::INFO, "player %d wins in 1 turn, column %d", player, stats.column);
+		break;
+	case Move_source::BLOCK:
+		Logger::get().write(Log_level::INFO, "player %d prevents the opponent from winning, column %d", player, stats.column);
+		break;
+	case Move_source::SEARCH:
+		Logger::get().write(Log_level::INFO, "player %d column %d score %d depth %d, %.0f nodes/s, ebf %.2f, %.3f s",
+			player, stats.column, stats.score, stats.depth, stats.nodes_per_second(), stats.branching_factor(), 1e-9 * stats.elapsed_ns);
+		break;
+	}
+}
+
+} // namespace
 
 Game::Game()
 : window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "Connect Four Game", sf::Style::Close, sf::ContextSettings(0, 0, 16))
@@ -32,6 +57,54 @@ Game::Game()
 	text.setFillColor(sf::Color::Black);
 	text.setCharacterSize(TEXT_SIZE);
 	text.setPosition(0, WINDOW_HEIGHT - TEXT_SIZE * 3); // 2 lines of text ++ offset
+	// warm start from the table of the previous session
+	if (std::ifstream(TRANSPOSITION_TABLE_FILE))
+	{
+		std::string error;
+		std::shared_ptr<Transposition_table> table = Transposition_table::load(TRANSPOSITION_TABLE_FILE, error);
+		if (table)
+		{
+			board.set_transposition_table(table);
+			Logger::get().write(Log_level::INFO, "loaded %s", TRANSPOSITION_TABLE_FILE);
+		}
+		else
+		{
+			Logger::get().write(Log_level::WARNING, "%s", error.c_str());
+		}
+	}
+	// evaluate with tuned weights if they are installed next to the game
+	if (std::ifstream(EVAL_WEIGHTS_FILE))
+	{
+		std::string error;
+		Eval_weights weights = get_classic_weights();
+		if (load_eval_weights(EVAL_WEIGHTS_FILE, weights, error))
+		{
+			board.set_eval_weights(weights);
+			Logger::get().write(Log_level::INFO, "loaded %s", EVAL_WEIGHTS_FILE);
+		}
+		else
+		{
+			Logger::get().write(Log_level::WARNING, "%s", error.c_str());
+		}
+	}
+	// evaluate with the trained network if one is installed next to the game
+	if (std::ifstream(NNUE_FILE))
+	{
+		std::string error;
+		std::shared_ptr<const Nnue> network = Nnue::load(NNUE_FILE, error);
+		if (network)
+		{
+			Search_options options = board.get_options();
+			options.evaluator = Evaluator::NNUE;
+			board.set_options(options);
+			board.set_network(network);
+			Logger::get().write(Log_level::INFO, "loaded %s", NNUE_FILE);
+		}
+		else
+		{
+			Logger::get().write(Log_level::WARNING, "%s", error.c_str());
+		}
+	}
 	state = Game_state::START;
 }
 
@@ -48,13 +121,19 @@ void Game::run()
 	{
 		start_clock = std::chrono::steady_clock::now();
 		// Process events.
-		sf::Event event;
-		while (window.pollEvent(event))
 		{
-			process_event(event);
+			CON4_TRACE_SCOPE("poll_events");
+			sf::Event event;
+			while (window.pollEvent(event))
+			{
+				process_event(event);
+			}
 		}
 		// Then render.
-		render();
+		{
+			CON4_TRACE_SCOPE("render");
+			render();
+		}
 		end_clock = std::chrono::steady_clock::now();
 		clock_diff = end_clock - start_clock;
 		samples.push_back(clock_diff.count());
@@ -73,6 +152,11 @@ void Game::run()
 			}
 		}
 	}
+	if (board.get_transposition_table() && !board.get_transposition_table()->save(TRANSPOSITION_TABLE_FILE))
+	{
+		Logger::get().write(Log_level::WARNING, "cannot save %s", TRANSPOSITION_TABLE_FILE);
+	}
+	CON4_TRACE_DUMP("connectfour_trace.json");
 }
 
 void Game::render()
@@ -142,6 +226,7 @@ void Game::render()
 	window.setView(window.getDefaultView());
 	window.draw(text);
 
+	CON4_TRACE_SCOPE("display");
 	window.display();
 }
 
@@ -189,6 +274,7 @@ void Game::process_event(const sf::Event & event)
 					[this]
 					{
 						board.place(board.find_best_move(turn));
+						log_search_stats(turn, board.get_search_stats());
 						int test = board.test_win();
 						if (test != 0)
 						{
@@ -198,6 +284,7 @@ void Game::process_event(const sf::Event & event)
 							{
 								draw = true;
 							}
+							Logger::get().write(Log_level::INFO, draw ? "draw" : "player %d won", turn);
 							return;
 						}
 						turn = 3 - turn;
@@ -228,6 +315,7 @@ void Game::process_event(const sf::Event & event)
 				return;
 			}
 			board.place(selected_column);
+			Logger::get().write(Log_level::INFO, "player %d column %d", turn, selected_column);
 			int test = board.test_win();
 			if (test != 0)
 			{
@@ -237,6 +325,7 @@ void Game::process_event(const sf::Event & event)
 				{
 					draw = true;
 				}
+				Logger::get().write(Log_level::INFO, draw ? "draw" : "player %d won", turn);
 				return;
 			}
 			turn = 3 - turn;
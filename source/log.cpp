@@ -0,0 +1,180 @@
+#include "log.h"
+
+#include <chrono>
+#include <cstdarg>
+
+namespace con4game
+{
+namespace
+{
+
+const char* level_names[] = { "DEBUG", "INFO", "WARNING", "CRITICAL" };
+
+int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+Logger& Logger::get()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger()
+: records(new std::array<Record, CAPACITY>())
+, head(0)
+, tail(0)
+, written(0)
+, queued(0)
+, dropped(0)
+, reported_dropped(0)
+#ifdef NDEBUG
+, level((int) Log_level::INFO)
+#else
+, level((int) Log_level::DEBUG)
+#endif
+, output(stdout)
+, running(true)
+{
+	for (int i = 0; i < CAPACITY; i++)
+	{
+		(*records)[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	worker = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+	running = false;
+	wake.notify_one();
+	worker.join();
+}
+
+void Logger::write(Log_level message_level, const char* format, ...)
+{
+	if (!is_enabled(message_level))
+	{
+		return;
+	}
+	// Claim a slot. A slot is free for position p when its sequence equals p,
+	// and holds a message for the reader when its sequence equals p + 1.
+	uint64_t position = head.load(std::memory_order_relaxed);
+	Record* record;
+	for (;;)
+	{
+		record = &(*records)[position & (CAPACITY - 1)];
+		uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+		if (sequence == position)
+		{
+			if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (sequence < position)
+		{
+			// full
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			position = head.load(std::memory_order_relaxed);
+		}
+	}
+	record->level = message_level;
+	record->time_ns = now_ns();
+	va_list args;
+	va_start(args, format);
+	std::vsnprintf(record->message, MESSAGE_SIZE, format, args);
+	va_end(args);
+	record->sequence.store(position + 1, std::memory_order_release);
+	queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Logger::is_enabled(Log_level message_level) const
+{
+	return (int) message_level >= level.load(std::memory_order_relaxed);
+}
+
+void Logger::set_level(Log_level new_level)
+{
+	level = (int) new_level;
+}
+
+void Logger::set_output(std::FILE* new_output)
+{
+	flush();
+	output = new_output;
+}
+
+void Logger::flush()
+{
+	uint64_t target = queued.load();
+	while (written.load() < target)
+	{
+		wake.notify_one();
+		std::this_thread::yield();
+	}
+	std::fflush(output.load());
+}
+
+uint64_t Logger::get_dropped() const
+{
+	return dropped.load(std::memory_order_relaxed);
+}
+
+bool Logger::pop()
+{
+	Record& record = (*records)[tail & (CAPACITY - 1)];
+	if (record.sequence.load(std::memory_order_acquire) != tail + 1)
+	{
+		return false;
+	}
+	std::FILE* file = output.load();
+	uint64_t total_dropped = dropped.load(std::memory_order_relaxed);
+	if (total_dropped != reported_dropped)
+	{
+		std::fprintf(file, "[WARNING] log buffer full, %llu messages dropped\n", (unsigned long long) (total_dropped - reported_dropped));
+		reported_dropped = total_dropped;
+	}
+	std::fprintf(file, "%.6f [%s] %s\n", 1e-9 * record.time_ns, level_names[(int) record.level], record.message);
+	// hand the slot back to the producers for the next lap
+	record.sequence.store(tail + CAPACITY, std::memory_order_release);
+	tail++;
+	written.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+void Logger::run()
+{
+	for (;;)
+	{
+		bool any = false;
+		while (pop())
+		{
+			any = true;
+		}
+		if (any)
+		{
+			std::fflush(output.load());
+		}
+		if (!running.load())
+		{
+			// drain what was queued before shutdown
+			while (pop())
+			{
+			}
+			std::fflush(output.load());
+			return;
+		}
+		// producers do not notify to stay cheap, the timeout bounds the delay
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		wake.wait_for(lock, std::chrono::milliseconds(10));
+	}
+}
+
+} // namespace con4game
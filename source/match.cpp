@@ -0,0 +1,501 @@
+#include "match.h"
+#include "platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace con4game
+{
+namespace
+{
+
+/** Depth-first enumeration of the openings below the current position. */
+void add_openings(Board& board, int plies, std::string& moves, std::vector<std::string>& openings)
+{
+	if (plies == 0)
+	{
+		openings.push_back(moves);
+		return;
+	}
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		if (!board.is_playable(col))
+		{
+			continue;
+		}
+		board.place(col);
+		if (board.test_win() == 0)
+		{
+			moves.push_back((char) ('1' + col));
+			add_openings(board, plies - 1, moves, openings);
+			moves.pop_back();
+		}
+		board.undo_last_move();
+	}
+}
+
+} // namespace
+
+long long Match_stats::games() const
+{
+	return wins + draws + losses;
+}
+
+void Match_stats::add(const Match_stats& other)
+{
+	wins += other.wins;
+	draws += other.draws;
+	losses += other.losses;
+	for (int i = 0; i < 2; i++)
+	{
+		moves[i] += other.moves[i];
+		time_ns[i] += other.time_ns[i];
+		leaf_evals[i] += other.leaf_evals[i];
+	}
+}
+
+bool parse_engine_config(const std::string& text, Engine_config& config, std::string& error)
+{
+	config = Engine_config();
+	config.name = text;
+	std::stringstream ss(text);
+	std::string item;
+	Numa_policy numa;
+	while (std::getline(ss, item, ','))
+	{
+		if (item.empty())
+		{
+			continue;
+		}
+		std::size_t separator = item.find('=');
+		if (separator == std::string::npos)
+		{
+			error = "expected key=value: " + item;
+			return false;
+		}
+		std::string key = item.substr(0, separator);
+		std::string value = item.substr(separator + 1);
+		char* end = nullptr;
+		long number = std::strtol(value.c_str(), &end, 10);
+		bool is_number = !value.empty() && *end == '\0';
+		if (key == "name")
+		{
+			config.name = value;
+		}
+		else if (key == "engine" && (value == "alphabeta" || value == "mcts"))
+		{
+			config.type = value == "mcts" ? Engine_type::MCTS : Engine_type::ALPHA_BETA;
+		}
+		else if (key == "depth" && is_number && number > 0 && number <= (long) SIZE)
+		{
+			config.limits.depth = (int) number;
+		}
+		else if (key == "time" && is_number && number >= 0)
+		{
+			config.limits.time_ms = (int) number;
+		}
+		else if (key == "playouts" && is_number && number > 0)
+		{
+			config.limits.playouts = number;
+		}
+		else if (key == "threads" && is_number && number > 0)
+		{
+			config.threads = (int) number;
+		}
+		else if (key == "batch" && is_number && number > 0 && number <= 4096)
+		{
+			config.playout_batch = (int) number;
+		}
+		else if (key == "tt" && is_number && (number == 0 || number == 1))
+		{
+			config.options.use_transposition_table = number == 1;
+		}
+		else if (key == "root" && (value == "alphabeta" || value == "mtdf"))
+		{
+			config.options.root_strategy = value == "mtdf" ? Root_strategy::MTDF : Root_strategy::ALPHA_BETA;
+		}
+		else if (key == "lmr" && is_number && (number == 0 || number == 1))
+		{
+			config.options.late_move_reductions = number == 1;
+		}
+		else if (key == "ext" && is_number && (number == 0 || number == 1))
+		{
+			config.options.threat_extensions = number == 1;
+		}
+		else if (key == "threats" && is_number && (number == 0 || number == 1))
+		{
+			config.options.use_threat_analysis = number == 1;
+		}
+		else if (key == "eval" && (value == "classic" || value == "nnue" || value == "pattern"))
+		{
+			config.options.evaluator = value == "nnue" ? Evaluator::NNUE : value == "pattern" ? Evaluator::PATTERN : Evaluator::CLASSIC;
+		}
+		else if (key == "nnue" && !value.empty())
+		{
+			config.network = Nnue::load(value, error);
+			if (!config.network)
+			{
+				return false;
+			}
+			config.options.evaluator = Evaluator::NNUE;
+		}
+		else if (key == "weights" && !value.empty())
+		{
+			if (!load_eval_weights(value, config.weights, error))
+			{
+				return false;
+			}
+		}
+		else if (key == "hash" && is_number && number > 0)
+		{
+			config.hash_mb = (int) number;
+		}
+		else if (key == "huge" && is_number && (number == 0 || number == 1))
+		{
+			config.memory.huge_pages = number == 1;
+		}
+		else if (key == "numa" && parse_numa_policy(value, numa))
+		{
+			config.memory.numa = numa;
+		}
+		else if (key == "shm" && !value.empty() && value.find('/') == std::string::npos)
+		{
+			config.shared_table = value;
+		}
+		else
+		{
+			error = "invalid option: " + item;
+			return false;
+		}
+	}
+	if (config.options.evaluator == Evaluator::NNUE && !config.network)
+	{
+		config.network = Nnue::load(NNUE_FILE, error);
+	}
+	return config.options.evaluator != Evaluator::NNUE || config.network;
+}
+
+std::vector<std::string> make_openings(int plies)
+{
+	std::vector<std::string> openings;
+	Board board;
+	std::string moves;
+	add_openings(board, plies, moves, openings);
+	return openings;
+}
+
+Elo_estimate estimate_elo(const Match_stats& stats)
+{
+	Elo_estimate estimate = { 0.5, 0, 0, 0 };
+	double n = (double) stats.games();
+	if (n == 0)
+	{
+		return estimate;
+	}
+	double score = (stats.wins + 0.5 * stats.draws) / n;
+	double variance = (stats.wins * (1 - score) * (1 - score)
+		+ stats.draws * (0.5 - score) * (0.5 - score)
+		+ stats.losses * score * score) / n;
+	double margin = 1.959964 * std::sqrt(variance / n);
+	auto to_elo = [](double p) -> double
+	{
+		if (p <= 0)
+		{
+			return -std::numeric_limits<double>::infinity();
+		}
+		if (p >= 1)
+		{
+			return std::numeric_limits<double>::infinity();
+		}
+		return -400.0 * std::log10(1.0 / p - 1.0);
+	};
+	estimate.score = score;
+	estimate.elo = to_elo(score);
+	estimate.lower = to_elo(score - margin);
+	estimate.upper = to_elo(score + margin);
+	return estimate;
+}
+
+double Sprt_config::lower_bound() const
+{
+	return std::log(beta / (1 - alpha));
+}
+
+double Sprt_config::upper_bound() const
+{
+	return std::log((1 - beta) / alpha);
+}
+
+double sprt_llr(const Match_stats& stats, const Sprt_config& sprt)
+{
+	double n = (double) stats.games();
+	if (n == 0)
+	{
+		return 0;
+	}
+	double score = (stats.wins + 0.5 * stats.draws) / n;
+	double variance = (stats.wins * (1 - score) * (1 - score)
+		+ stats.draws * (0.5 - score) * (0.5 - score)
+		+ stats.losses * score * score) / n;
+	if (variance <= 0)
+	{
+		return 0;
+	}
+	double score0 = 1 / (1 + std::pow(10.0, -sprt.elo0 / 400));
+	double score1 = 1 / (1 + std::pow(10.0, -sprt.elo1 / 400));
+	return 0.5 * n * (score1 - score0) * (2 * score - score0 - score1) / variance;
+}
+
+bool save_sprt_state(const std::string& path, const Sprt_state& state)
+{
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary);
+		if (!file)
+		{
+			return false;
+		}
+		file.precision(17);
+		file << "version 1" << std::endl
+			<< "first " << state.configs[0] << std::endl
+			<< "second " << state.configs[1] << std::endl
+			<< "opening_plies " << state.opening_plies << std::endl
+			<< "sprt " << state.sprt.elo0 << " " << state.sprt.elo1 << " " << state.sprt.alpha << " " << state.sprt.beta << std::endl
+			<< "results " << state.stats.wins << " " << state.stats.draws << " " << state.stats.losses << std::endl
+			<< "moves " << state.stats.moves[0] << " " << state.stats.moves[1] << std::endl
+			<< "time_ns " << state.stats.time_ns[0] << " " << state.stats.time_ns[1] << std::endl
+			<< "leaf_evals " << state.stats.leaf_evals[0] << " " << state.stats.leaf_evals[1] << std::endl
+			<< "next_game " << state.next_game << std::endl;
+		if (!file)
+		{
+			return false;
+		}
+	}
+	return replace_file(temporary, path);
+}
+
+bool load_sprt_state(const std::string& path, Sprt_state& state)
+{
+	std::ifstream file(path);
+	std::string line;
+	int version = 0;
+	while (std::getline(file, line))
+	{
+		std::size_t separator = line.find(' ');
+		std::string key = line.substr(0, separator);
+		std::string value = separator == std::string::npos ? "" : line.substr(separator + 1);
+		std::stringstream ss(value);
+		if (key == "version")
+		{
+			ss >> version;
+		}
+		else if (key == "first")
+		{
+			state.configs[0] = value;
+		}
+		else if (key == "second")
+		{
+			state.configs[1] = value;
+		}
+		else if (key == "opening_plies")
+		{
+			ss >> state.opening_plies;
+		}
+		else if (key == "sprt")
+		{
+			ss >> state.sprt.elo0 >> state.sprt.elo1 >> state.sprt.alpha >> state.sprt.beta;
+		}
+		else if (key == "results")
+		{
+			ss >> state.stats.wins >> state.stats.draws >> state.stats.losses;
+		}
+		else if (key == "moves")
+		{
+			ss >> state.stats.moves[0] >> state.stats.moves[1];
+		}
+		else if (key == "time_ns")
+		{
+			ss >> state.stats.time_ns[0] >> state.stats.time_ns[1];
+		}
+		else if (key == "leaf_evals")
+		{
+			ss >> state.stats.leaf_evals[0] >> state.stats.leaf_evals[1];
+		}
+		else if (key == "next_game")
+		{
+			ss >> state.next_game;
+		}
+		if (ss.fail())
+		{
+			return false;
+		}
+	}
+	return version == 1;
+}
+
+Match::Match(const Engine_config& first, const Engine_config& second, const std::vector<std::string>& openings, int threads, bool pin)
+: engines{ first, second }
+, openings(openings)
+, threads(threads < 1 ? 1 : threads)
+, pin(pin)
+, pinned_workers(0)
+{
+}
+
+bool Match::open_shared_tables(std::string& error)
+{
+	// a shared table is mapped once and used by every worker, and by other processes mapping the same name
+	for (int engine = 0; engine < 2; engine++)
+	{
+		if (engines[engine].type == Engine_type::ALPHA_BETA && engines[engine].options.use_transposition_table && !engines[engine].shared_table.empty())
+		{
+			shared_tables[engine] = Transposition_table::open_shared(engines[engine].shared_table, engines[engine].hash_mb, error);
+			if (!shared_tables[engine])
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+Match_stats Match::play(long long first_game, long long count) const
+{
+	Match_stats total;
+	std::mutex total_mutex;
+	std::atomic<long long> next_game(first_game);
+	long long end_game = first_game + count;
+	std::vector<std::thread> workers;
+	std::vector<int> cpus = pin ? get_cpu_order() : std::vector<int>();
+	pinned_workers = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(
+			[&, i]
+			{
+				// pin before allocating so that a local NUMA policy picks the worker's node
+				bool pinned = !cpus.empty() && pin_current_thread(cpus[i % cpus.size()]);
+				Match_stats local;
+				// every worker reuses one table or tree per engine
+				std::shared_ptr<Transposition_table> tables[2];
+				std::unique_ptr<Mcts> trees[2];
+				for (int engine = 0; engine < 2; engine++)
+				{
+					if (engines[engine].type == Engine_type::MCTS)
+					{
+						trees[engine].reset(new Mcts(engines[engine].hash_mb, engines[engine].threads));
+						trees[engine]->set_playout_batch(engines[engine].playout_batch);
+						continue;
+					}
+					tables[engine] = shared_tables[engine];
+					if (engines[engine].options.use_transposition_table && !tables[engine])
+					{
+						tables[engine] = std::make_shared<Transposition_table>(engines[engine].hash_mb, Transposition_table::Layout::BUCKETED, engines[engine].memory);
+					}
+				}
+				for (long long game = next_game++; game < end_game; game = next_game++)
+				{
+					play_game(game, local, tables, trees);
+				}
+				std::lock_guard<std::mutex> lock(total_mutex);
+				total.add(local);
+				pinned_workers += pinned ? 1 : 0;
+				for (int engine = 0; engine < 2; engine++)
+				{
+					memory_descriptions[engine] = trees[engine] ? "Monte Carlo tree, " + std::to_string(engines[engine].hash_mb) + " MB, "
+						+ std::to_string(trees[engine]->get_threads()) + " search threads"
+						: tables[engine] ? tables[engine]->get_memory_description() : "no transposition table";
+				}
+			}
+		));
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	return total;
+}
+
+std::string Match::get_memory_description(int engine) const
+{
+	std::string pinning = pin ? ", " + std::to_string(pinned_workers) + "/" + std::to_string(threads) + " workers pinned" : ", workers not pinned";
+	return memory_descriptions[engine] + pinning;
+}
+
+void Match::play_game(long long index, Match_stats& stats, const std::shared_ptr<Transposition_table> tables[2],
+	const std::unique_ptr<Mcts> trees[2]) const
+{
+	const std::string& opening = openings[(std::size_t) ((index / 2) % (long long) openings.size())];
+	// engine of player 1 and player 2
+	int engine_of[2] = { 0, 1 };
+	if (index % 2 == 1)
+	{
+		engine_of[0] = 1;
+		engine_of[1] = 0;
+	}
+	// each engine searches on its own board
+	Board boards[2];
+	for (int engine = 0; engine < 2; engine++)
+	{
+		boards[engine].set_options(engines[engine].options);
+		boards[engine].set_network(engines[engine].network);
+		boards[engine].set_eval_weights(engines[engine].weights);
+		if (tables[engine])
+		{
+			// clearing a shared table would throw away the work of every other process
+			if (!tables[engine]->is_shared())
+			{
+				tables[engine]->clear();
+			}
+			boards[engine].set_transposition_table(tables[engine]);
+		}
+		if (trees[engine])
+		{
+			trees[engine]->clear();
+		}
+	}
+	int player = 1;
+	for (char c : opening)
+	{
+		boards[0].place(c - '1');
+		boards[1].place(c - '1');
+		player = 3 - player;
+	}
+	int test = boards[0].test_win();
+	while (test == 0)
+	{
+		int engine = engine_of[player - 1];
+		std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+		int col = trees[engine] ? trees[engine]->find_best_move(boards[engine], player, engines[engine].limits)
+			: boards[engine].find_best_move(player, engines[engine].limits);
+		std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+		stats.moves[engine]++;
+		stats.time_ns[engine] += clock_diff.count();
+		stats.leaf_evals[engine] += trees[engine] ? trees[engine]->get_search_stats().leaf_evals : boards[engine].get_search_stats().leaf_evals;
+		boards[0].place(col);
+		boards[1].place(col);
+		test = boards[0].test_win();
+		player = 3 - player;
+	}
+	if (test == 3)
+	{
+		stats.draws++;
+	}
+	else if (engine_of[test - 1] == 0)
+	{
+		stats.wins++;
+	}
+	else
+	{
+		stats.losses++;
+	}
+}
+
+} // namespace con4game
@@ -0,0 +1,175 @@
+#include "log.h"
+#include "playout.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * Replay a move string on an empty board.
+ * @return true if the string is valid.
+ */
+bool replay(Board& board, const std::string& moves)
+{
+	board.reset();
+	for (char c : moves)
+	{
+		int col = c - '1';
+		if (col < 0 || col >= BOARD_WIDTH || !board.is_playable(col) || board.test_win() != 0)
+		{
+			return false;
+		}
+		board.place(col);
+	}
+	return true;
+}
+
+/** Score of a result for the player whose bitboard has the given index, from 0 (every game lost) to 1 (every game won). */
+double get_score(const Playout_counts& counts, int player)
+{
+	return counts.games() > 0 ? (counts.wins[player] + 0.5 * counts.draws) / counts.games() : 0.0;
+}
+
+bool parse_kernel(const char* name, Playout_kernel& kernel)
+{
+	for (Playout_kernel candidate : { Playout_kernel::SCALAR, Playout_kernel::AVX2, Playout_kernel::AVX512 })
+	{
+		if (std::strcmp(name, get_playout_kernel_name(candidate)) == 0)
+		{
+			kernel = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_mceval [--games N] [--kernel scalar|avx2|avx512] [--seed S] [MOVES...]" << std::endl
+		<< "  Evaluates each position and each of its moves by the results of random games." << std::endl
+		<< "  MOVES are 1-based column digits; without MOVES they are read from stdin, one per line." << std::endl
+		<< "  --games N      random games per position and per move (default 100000)" << std::endl
+		<< "  --kernel K     playout implementation (default the widest this build has: "
+		<< get_playout_kernel_name(get_best_playout_kernel()) << ")" << std::endl
+		<< "  --seed S       seed of the random games (default 1)" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Monte Carlo evaluation of positions given on the command line or on stdin.
+ * Prints the win, draw and loss rates of the player to move, the score of every move, and the playout speed.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	long long games = 100000;
+	uint64_t seed = 1;
+	Playout_kernel kernel = get_best_playout_kernel();
+	std::vector<std::string> positions;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--games") == 0 && i + 1 < argc)
+		{
+			games = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--kernel") == 0 && i + 1 < argc)
+		{
+			if (!parse_kernel(argv[++i], kernel) || !is_playout_kernel_available(kernel))
+			{
+				std::cerr << "kernel " << argv[i] << " is not available in this build" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (argv[i][0] != '-')
+		{
+			positions.push_back(argv[i]);
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (games <= 0)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	if (positions.empty())
+	{
+		std::string line;
+		while (std::getline(std::cin, line))
+		{
+			positions.push_back(line);
+		}
+	}
+
+	std::cerr << "kernel " << get_playout_kernel_name(kernel) << ", " << games << " games per evaluation" << std::endl;
+	Board board;
+	long long total_games = 0;
+	long long total_ns = 0;
+	for (const std::string& moves : positions)
+	{
+		if (!replay(board, moves) || board.test_win() != 0)
+		{
+			std::cerr << "invalid or finished position " << moves << std::endl;
+			return EXIT_FAILURE;
+		}
+		int mover = board.get_plies() & 1;
+		std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+		Playout_counts counts = play_random_games(board, games, seed, kernel);
+		// the score of each move, from the view of the player making it
+		double scores[BOARD_WIDTH];
+		for (int col = 0; col < BOARD_WIDTH; col++)
+		{
+			scores[col] = -1;
+			if (!board.is_playable(col))
+			{
+				continue;
+			}
+			board.place(col);
+			if (board.test_win() == 0)
+			{
+				scores[col] = get_score(play_random_games(board, games, seed + col + 1, kernel), mover);
+				total_games += games;
+			}
+			else
+			{
+				scores[col] = board.test_win() == 3 ? 0.5 : 1.0;
+			}
+			board.undo_last_move();
+		}
+		std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+		total_games += games;
+		total_ns += clock_diff.count();
+
+		std::cout << (moves.empty() ? "(empty)" : moves) << ": win " << 100.0 * counts.wins[mover] / games
+			<< "%, draw " << 100.0 * counts.draws / games << "%, loss " << 100.0 * counts.wins[mover ^ 1] / games << "%, moves";
+		for (int col = 0; col < BOARD_WIDTH; col++)
+		{
+			if (scores[col] >= 0)
+			{
+				std::cout << " " << col + 1 << ":" << scores[col];
+			}
+		}
+		std::cout << std::endl;
+	}
+	std::cout << positions.size() << " positions, " << total_games << " games, " << 1e-9 * total_ns << " s, "
+		<< (total_ns > 0 ? 1e9 * total_games / total_ns : 0.0) << " games/s" << std::endl;
+	return EXIT_SUCCESS;
+}
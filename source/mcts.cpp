@@ -0,0 +1,572 @@
+#include "mcts.h"
+#include "log.h"
+#include "playout.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/** Playouts of a search without a time budget or a playout limit. */
+const long long DEFAULT_PLAYOUTS = 50000;
+
+/** Exploration constant of the UCB1 formula. */
+const float EXPLORATION = 1.0f;
+
+/** Deepest path a search can take, the root plus a move per square. */
+const int MAX_PATH = SIZE + 1;
+
+/** Get a random number (xorshift64*). */
+uint64_t next_random(uint64_t& state)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DULL;
+}
+
+} // namespace
+
+struct Mcts::Search_state
+{
+	/** Playouts of the whole search, 0 for no limit. */
+	long long max_playouts;
+	/** Random games begun by all threads, counted only with a playout limit. */
+	std::atomic<long long> started;
+	/** Set by the first thread that reaches a limit. */
+	std::atomic<bool> done;
+	const std::atomic<bool>* stop;
+	bool has_deadline;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+Mcts::Mcts(std::size_t size_mb, int threads)
+: pools()
+, capacity(std::max<std::size_t>((size_mb << 20) / (2 * sizeof(Node)), MAX_PATH * BOARD_WIDTH))
+, active(0)
+, used(0)
+, root(NONE)
+, root_board()
+, reused_nodes(0)
+, threads(std::max(threads, 1))
+, playout_batch(1)
+, random_state(0x9E3779B97F4A7C15ULL)
+, stats()
+{
+	pools[0].reset(new Node[capacity]);
+	pools[1].reset(new Node[capacity]);
+}
+
+int Mcts::find_best_move(const Board& board, int player, const Search_limits& limits)
+{
+	CON4_TRACE_SCOPE("mcts");
+	stats = Search_stats();
+	reused_nodes = 0;
+	std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+	const uint64_t* bitboard = board.get_board();
+	uint64_t playable = board.playable_squares();
+
+	// The same rules as the negamax search: win in one move, otherwise block the opponent's win.
+	uint64_t wins = Board::winning_squares(bitboard[player - 1], bitboard[0] | bitboard[1]) & playable;
+	uint64_t threats = Board::winning_squares(bitboard[2 - player], bitboard[0] | bitboard[1]) & playable;
+	uint64_t rule_squares = wins ? wins : threats;
+	if (rule_squares)
+	{
+		for (int col = 0; col < BOARD_WIDTH; col++)
+		{
+			if (rule_squares & (COL1 << (col * H1)))
+			{
+				stats.column = col;
+				stats.source = wins ? Move_source::IMMEDIATE_WIN : Move_source::BLOCK;
+				return col;
+			}
+		}
+	}
+	if (playable == 0)
+	{
+		return -1;
+	}
+
+	reuse_tree(board);
+	std::size_t first_free = used;
+	if (pools[active][root].first_child.load(std::memory_order_relaxed) == NONE)
+	{
+		// expand the root before the threads start, which may prove it at once
+		Board position = board;
+		stats.proven_nodes += expand(pools[active][root], position);
+	}
+	Search_state state;
+	state.max_playouts = limits.playouts > 0 ? limits.playouts : limits.time_ms > 0 || limits.stop ? 0 : DEFAULT_PLAYOUTS;
+	state.started = 0;
+	state.done = false;
+	state.stop = limits.stop;
+	state.has_deadline = limits.time_ms > 0;
+	state.deadline = start_clock + std::chrono::milliseconds(limits.time_ms);
+
+	// the calling thread searches too
+	std::vector<Search_stats> thread_stats(threads);
+	std::vector<std::thread> helpers;
+	for (int i = 1; i < threads; i++)
+	{
+		uint64_t seed = next_random(random_state) | 1;
+		helpers.push_back(std::thread(
+			[&, i, seed]
+			{
+				search(board, state, seed, thread_stats[i]);
+			}
+		));
+	}
+	search(board, state, next_random(random_state) | 1, thread_stats[0]);
+	for (std::thread& helper : helpers)
+	{
+		helper.join();
+	}
+	for (const Search_stats& counts : thread_stats)
+	{
+		stats.leaf_evals += counts.leaf_evals;
+		stats.depth = std::max(stats.depth, counts.depth);
+		stats.proven_nodes += counts.proven_nodes;
+	}
+
+	// a won move if there is one, otherwise the most visited move that is not proven,
+	// unless a proven draw is better than that move's results
+	const Node* pool = pools[active].get();
+	const Node& root_node = pool[root];
+	uint32_t first_child = root_node.first_child.load(std::memory_order_relaxed);
+	const Node* best = nullptr;
+	const Node* drawn = nullptr;
+	const Node* most_visited = nullptr;
+	for (int i = 0; i < root_node.child_count && first_child < EXPANDING; i++)
+	{
+		const Node& child = pool[first_child + i];
+		uint8_t child_state = child.state.load(std::memory_order_relaxed);
+		if (child_state == WON)
+		{
+			best = &child;
+			break;
+		}
+		drawn = child_state == DRAWN ? &child : drawn;
+		if (child_state == OPEN && (!best || child.visits.load(std::memory_order_relaxed) > best->visits.load(std::memory_order_relaxed)))
+		{
+			best = &child;
+		}
+		if (!most_visited || child.visits.load(std::memory_order_relaxed) > most_visited->visits.load(std::memory_order_relaxed))
+		{
+			most_visited = &child;
+		}
+	}
+	if (drawn && (!best || (best->state.load(std::memory_order_relaxed) == OPEN
+		&& best->score.load(std::memory_order_relaxed) < best->visits.load(std::memory_order_relaxed))))
+	{
+		best = drawn;
+	}
+	// every move is lost
+	best = best ? best : most_visited;
+	if (!best)
+	{
+		// the pool was too full to expand the root
+		for (int col = 0; col < BOARD_WIDTH && stats.column < 0; col++)
+		{
+			stats.column = board.is_playable(col) ? col : -1;
+		}
+		return stats.column;
+	}
+	uint32_t visits = best->visits.load(std::memory_order_relaxed);
+	uint8_t best_state = best->state.load(std::memory_order_relaxed);
+	stats.column = best->move;
+	stats.score = best_state == WON ? 1000 : best_state == LOST ? -1000 : best_state == DRAWN ? 0
+		: visits > 0 ? (int) std::lround((double) best->score.load(std::memory_order_relaxed) / visits * 1000 - 1000) : 0;
+	stats.nodes = used - first_free;
+
+	std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+	stats.elapsed_ns = clock_diff.count();
+
+	Logger::get().write(Log_level::DEBUG, "mcts column %d score %d%s depth %d playouts %lld nodes %lld proven %lld reused %zu threads %d time %.3f s",
+		stats.column, stats.score, best_state == OPEN ? "" : " (proven)", stats.depth, stats.leaf_evals, stats.nodes, stats.proven_nodes,
+		reused_nodes, threads, 1e-9 * stats.elapsed_ns);
+	return stats.column;
+}
+
+const Search_stats& Mcts::get_search_stats() const
+{
+	return stats;
+}
+
+std::size_t Mcts::get_reused_nodes() const
+{
+	return reused_nodes;
+}
+
+std::size_t Mcts::get_tree_size() const
+{
+	return used;
+}
+
+int Mcts::get_threads() const
+{
+	return threads;
+}
+
+void Mcts::set_playout_batch(int games)
+{
+	playout_batch = std::max(games, 1);
+}
+
+void Mcts::clear()
+{
+	used = 0;
+	root = NONE;
+	reused_nodes = 0;
+}
+
+void Mcts::search(const Board& board, Search_state& state, uint64_t random_state, Search_stats& thread_stats)
+{
+	Node* pool = pools[active].get();
+	// one board per thread, taken back to the root after every iteration
+	Board position = board;
+	int root_plies = board.get_plies();
+	uint32_t path[MAX_PATH];
+	// a batch smaller than a vector would leave lanes idle
+	Playout_kernel kernel = playout_batch >= 4 ? get_best_playout_kernel() : Playout_kernel::SCALAR;
+	for (long long iteration = 0; !state.done.load(std::memory_order_relaxed); iteration++)
+	{
+		if (pool[root].state.load(std::memory_order_relaxed) != OPEN)
+		{
+			// the result is known
+			state.done.store(true, std::memory_order_relaxed);
+			break;
+		}
+		if (state.max_playouts > 0 && state.started.fetch_add(playout_batch, std::memory_order_relaxed) >= state.max_playouts)
+		{
+			break;
+		}
+		if ((iteration & 63) == 63
+			&& ((state.stop && state.stop->load(std::memory_order_relaxed))
+				|| (state.has_deadline && std::chrono::steady_clock::now() >= state.deadline)))
+		{
+			state.done.store(true, std::memory_order_relaxed);
+			break;
+		}
+
+		// selection, counting every visit on the way down as a loss until the playout is done
+		int length = 0;
+		uint32_t index = root;
+		pool[index].visits.fetch_add(1, std::memory_order_relaxed);
+		path[length++] = index;
+		while (pool[index].state.load(std::memory_order_relaxed) == OPEN)
+		{
+			Node& node = pool[index];
+			uint32_t first_child = node.first_child.load(std::memory_order_acquire);
+			if (first_child >= EXPANDING)
+			{
+				// expansion, once a leaf has been visited before
+				if (first_child == EXPANDING || node.visits.load(std::memory_order_relaxed) < 2)
+				{
+					break;
+				}
+				thread_stats.proven_nodes += expand(node, position);
+				first_child = node.first_child.load(std::memory_order_acquire);
+				if (first_child >= EXPANDING || node.state.load(std::memory_order_relaxed) != OPEN)
+				{
+					break;
+				}
+			}
+			uint32_t child = select(node, first_child);
+			if (child == NONE)
+			{
+				// every child is proven, which proves the node
+				thread_stats.proven_nodes += prove(node) ? 1 : 0;
+				break;
+			}
+			index = child;
+			pool[index].visits.fetch_add(1, std::memory_order_relaxed);
+			position.place(pool[index].move);
+			path[length++] = index;
+		}
+
+		// simulation, the results counted by the index of the winner's bitboard
+		Playout_counts counts;
+		int mover = (position.get_plies() - 1) & 1;
+		uint8_t leaf_state = pool[index].state.load(std::memory_order_relaxed);
+		if (leaf_state == WON)
+		{
+			counts.wins[mover] = 1;
+		}
+		else if (leaf_state == LOST)
+		{
+			counts.wins[mover ^ 1] = 1;
+		}
+		else if (leaf_state == DRAWN)
+		{
+			counts.draws = 1;
+		}
+		else
+		{
+			counts = play_random_games(position, playout_batch, next_random(random_state), kernel);
+			thread_stats.leaf_evals += counts.games();
+		}
+		uint32_t games = (uint32_t) counts.games();
+		thread_stats.depth = std::max(thread_stats.depth, length - 1);
+
+		// backpropagation, the node at distance d from the root was reached by a move of parity root_plies + d - 1,
+		// and a proof climbs as long as it decides the parent
+		bool proven = leaf_state != OPEN;
+		for (int d = length - 1; d >= 0; d--)
+		{
+			Node& node = pool[path[d]];
+			if (proven && d < length - 1)
+			{
+				thread_stats.proven_nodes += prove(node) ? 1 : 0;
+				proven = node.state.load(std::memory_order_relaxed) != OPEN;
+			}
+			// the descent counted one visit already
+			if (games > 1)
+			{
+				node.visits.fetch_add(games - 1, std::memory_order_relaxed);
+			}
+			uint32_t points = (uint32_t) (2 * counts.wins[(root_plies + d + 1) & 1] + counts.draws);
+			if (points)
+			{
+				node.score.fetch_add(points, std::memory_order_relaxed);
+			}
+		}
+		while (position.get_plies() > root_plies)
+		{
+			position.undo_last_move();
+		}
+	}
+}
+
+void Mcts::make_node(Node& node, int move, int state)
+{
+	node.first_child.store(NONE, std::memory_order_relaxed);
+	node.visits.store(0, std::memory_order_relaxed);
+	node.score.store(0, std::memory_order_relaxed);
+	node.move = (uint8_t) move;
+	node.child_count = 0;
+	node.state.store((uint8_t) state, std::memory_order_relaxed);
+}
+
+uint32_t Mcts::allocate(std::size_t count)
+{
+	std::size_t index = used.load(std::memory_order_relaxed);
+	do
+	{
+		if (index + count > capacity)
+		{
+			return NONE;
+		}
+	} while (!used.compare_exchange_weak(index, index + count, std::memory_order_relaxed));
+	return (uint32_t) index;
+}
+
+int Mcts::expand(Node& node, Board& board)
+{
+	uint32_t expected = NONE;
+	if (!node.first_child.compare_exchange_strong(expected, EXPANDING, std::memory_order_acquire))
+	{
+		// another thread got there first
+		return 0;
+	}
+	const uint64_t* bitboard = board.get_board();
+	int mover = board.get_plies() & 1;
+	uint64_t own = bitboard[mover];
+	uint64_t opponent = bitboard[mover ^ 1];
+	uint64_t playable = board.playable_squares();
+	int count = 0;
+	for (uint64_t squares = playable; squares; squares &= squares - 1)
+	{
+		count++;
+	}
+	uint32_t first = allocate(count);
+	if (first == NONE)
+	{
+		// the pool is full, the leaf stays a leaf
+		node.first_child.store(NONE, std::memory_order_release);
+		return 0;
+	}
+	Node* pool = pools[active].get();
+	bool last_square = board.get_plies() + 1 == (int) SIZE;
+	uint32_t child = first;
+	int proven = 0;
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		uint64_t square = playable & (COL1 << (col * H1));
+		if (!square)
+		{
+			continue;
+		}
+		// a move that wins, fills the board, or leaves the opponent a playable winning square
+		uint64_t occupied = own | opponent | square;
+		int result = OPEN;
+		if (Board::has_won(own | square))
+		{
+			result = WON;
+		}
+		else if (last_square)
+		{
+			result = DRAWN;
+		}
+		else if (Board::winning_squares(opponent, occupied) & (occupied + BOTTOM) & (ALL1 ^ TOP))
+		{
+			result = LOST;
+		}
+		proven += result != OPEN ? 1 : 0;
+		make_node(pool[child++], col, result);
+	}
+	node.child_count = (uint8_t) count;
+	// publishes the children to the threads that load first_child with acquire
+	node.first_child.store(first, std::memory_order_release);
+	return proven + (prove(node) ? 1 : 0);
+}
+
+bool Mcts::prove(Node& node)
+{
+	uint32_t first_child = node.first_child.load(std::memory_order_acquire);
+	if (first_child >= EXPANDING || node.state.load(std::memory_order_relaxed) != OPEN)
+	{
+		return false;
+	}
+	const Node* pool = pools[active].get();
+	bool all_lost = true;
+	bool all_proven = true;
+	uint8_t result = OPEN;
+	for (uint32_t i = first_child; i < first_child + node.child_count && result == OPEN; i++)
+	{
+		uint8_t child_state = pool[i].state.load(std::memory_order_relaxed);
+		// a won move for the player to move loses the move leading here
+		result = child_state == WON ? LOST : OPEN;
+		all_lost = all_lost && child_state == LOST;
+		all_proven = all_proven && child_state != OPEN;
+	}
+	if (result == OPEN)
+	{
+		result = all_lost ? WON : all_proven ? DRAWN : OPEN;
+	}
+	uint8_t expected = OPEN;
+	return result != OPEN && node.state.compare_exchange_strong(expected, result, std::memory_order_relaxed);
+}
+
+uint32_t Mcts::select(const Node& node, uint32_t first_child) const
+{
+	const Node* pool = pools[active].get();
+	float log_visits = std::log((float) std::max<uint32_t>(node.visits.load(std::memory_order_relaxed), 1));
+	uint32_t best = NONE;
+	float best_value = -1.0f;
+	for (uint32_t i = first_child; i < first_child + node.child_count; i++)
+	{
+		if (pool[i].state.load(std::memory_order_relaxed) != OPEN)
+		{
+			// proven subtrees need no more search
+			continue;
+		}
+		uint32_t visits = pool[i].visits.load(std::memory_order_relaxed);
+		if (visits == 0)
+		{
+			// try every move once first
+			return i;
+		}
+		float value = 0.5f * pool[i].score.load(std::memory_order_relaxed) / visits + EXPLORATION * std::sqrt(log_visits / visits);
+		if (value > best_value)
+		{
+			best_value = value;
+			best = i;
+		}
+	}
+	return best;
+}
+
+void Mcts::reuse_tree(const Board& board)
+{
+	reused_nodes = 0;
+	uint32_t new_root = NONE;
+	if (root != NONE)
+	{
+		// look for the position among the old root and the nodes up to two plies below it
+		const Node* pool = pools[active].get();
+		uint64_t key = board.get_key();
+		int plies = board.get_plies() - root_board.get_plies();
+		if (plies == 0 && root_board.get_key() == key)
+		{
+			new_root = root;
+		}
+		uint32_t first_child = pool[root].first_child.load(std::memory_order_relaxed);
+		for (int i = 0; first_child < EXPANDING && i < pool[root].child_count && new_root == NONE && plies > 0 && plies <= 2; i++)
+		{
+			uint32_t child = first_child + i;
+			Board position = root_board;
+			position.place(pool[child].move);
+			if (plies == 1 && position.get_key() == key)
+			{
+				new_root = child;
+			}
+			uint32_t first_grandchild = pool[child].first_child.load(std::memory_order_relaxed);
+			for (int j = 0; first_grandchild < EXPANDING && j < pool[child].child_count && new_root == NONE && plies == 2; j++)
+			{
+				uint32_t grandchild = first_grandchild + j;
+				position.place(pool[grandchild].move);
+				if (position.get_key() == key)
+				{
+					new_root = grandchild;
+				}
+				position.undo_last_move();
+			}
+		}
+	}
+
+	if (new_root == NONE)
+	{
+		used = 0;
+		root = allocate(1);
+		make_node(pools[active][root], 0, OPEN);
+	}
+	else if (new_root != root)
+	{
+		// copy the subtree breadth first, which keeps the children of every node contiguous
+		const Node* source = pools[active].get();
+		Node* target = pools[active ^ 1].get();
+		auto copy = [](const Node& from, Node& to)
+		{
+			to.first_child.store(from.first_child.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			to.visits.store(from.visits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			to.score.store(from.score.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			to.move = from.move;
+			to.child_count = from.child_count;
+			to.state.store(from.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		};
+		copy(source[new_root], target[0]);
+		std::size_t count = 1;
+		for (std::size_t i = 0; i < count; i++)
+		{
+			Node& node = target[i];
+			uint32_t first_child = node.first_child.load(std::memory_order_relaxed);
+			if (first_child < EXPANDING)
+			{
+				for (int j = 0; j < node.child_count; j++)
+				{
+					copy(source[first_child + j], target[count + j]);
+				}
+				node.first_child.store((uint32_t) count, std::memory_order_relaxed);
+				count += node.child_count;
+			}
+		}
+		active ^= 1;
+		used = count;
+		root = 0;
+		reused_nodes = count;
+	}
+	else
+	{
+		reused_nodes = used;
+	}
+	root_board = board;
+}
+
+} // namespace con4game
@@ -0,0 +1,381 @@
+#include "board.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * Exposes the protected evaluation function to the benchmark.
+ */
+class Bench_board : public Board
+{
+public:
+	using Board::evaluate;
+};
+
+/** Result of one measured primitive. */
+struct Measurement
+{
+	std::string name;
+	double ns_median;
+	double ns_min;
+	double ns_stddev;
+	double cycles_median;
+};
+
+/** Keeps the compiler from dropping the measured calls. */
+volatile uint64_t sink;
+
+uint64_t read_cycles()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Build reproducible random positions which are not yet decided
+ * and have at least one playable column.
+ */
+std::vector<Bench_board> make_positions(std::size_t count, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<Bench_board> positions;
+	while (positions.size() < count)
+	{
+		Bench_board board;
+		int plies = std::uniform_int_distribution<int>(1, SIZE - 2)(rng);
+		for (int i = 0; i < plies; i++)
+		{
+			int col = std::uniform_int_distribution<int>(0, BOARD_WIDTH - 1)(rng);
+			if (!board.is_playable(col))
+			{
+				continue;
+			}
+			board.place(col);
+			if (board.test_win() != 0)
+			{
+				board.undo_last_move();
+				break;
+			}
+		}
+		positions.push_back(board);
+	}
+	return positions;
+}
+
+/** Does nothing between passes. */
+struct No_restore
+{
+	void operator()(Bench_board&, std::size_t) const
+	{
+	}
+};
+
+/**
+ * Time `body` over all positions, repeated `samples` times after a warmup,
+ * and reduce the samples to per-operation statistics.
+ * `body` performs one operation on one position and returns a value to sink.
+ * `restore` runs untimed after every pass to bring the positions back to their original state.
+ */
+template <typename Body, typename Restore>
+Measurement measure(const std::string& name, std::vector<Bench_board>& positions, int samples, int rounds, Body body, Restore restore)
+{
+	uint64_t acc = 0;
+	std::vector<double> ns(samples);
+	std::vector<double> cycles(samples);
+	double ops = (double) positions.size() * rounds;
+	// the first sample is the warmup and is thrown away
+	for (int sample = -1; sample < samples; sample++)
+	{
+		long long total_ns = 0;
+		uint64_t total_cycles = 0;
+		for (int round = 0; round < rounds; round++)
+		{
+			std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+			uint64_t start_cycles = read_cycles();
+			for (std::size_t i = 0; i < positions.size(); i++)
+			{
+				acc += body(positions[i], i);
+			}
+			uint64_t end_cycles = read_cycles();
+			std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+			total_ns += clock_diff.count();
+			total_cycles += end_cycles - start_cycles;
+			for (std::size_t i = 0; i < positions.size(); i++)
+			{
+				restore(positions[i], i);
+			}
+		}
+		if (sample >= 0)
+		{
+			ns[sample] = total_ns / ops;
+			cycles[sample] = total_cycles / ops;
+		}
+	}
+	sink = acc;
+
+	double mean = 0;
+	for (double value : ns)
+	{
+		mean += value / samples;
+	}
+	double variance = 0;
+	for (double value : ns)
+	{
+		variance += (value - mean) * (value - mean) / samples;
+	}
+	std::sort(ns.begin(), ns.end());
+	std::sort(cycles.begin(), cycles.end());
+	return Measurement { name, ns[samples / 2], ns[0], std::sqrt(variance), cycles[samples / 2] };
+}
+
+/** Pick the first playable column of a position. */
+int first_playable(const Board& board)
+{
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		if (board.is_playable(col))
+		{
+			return col;
+		}
+	}
+	return -1;
+}
+
+/** Recover the column of the last move from the occupancy before and after undoing it. */
+int last_column(Bench_board board)
+{
+	const uint64_t* bitboard = board.get_board();
+	uint64_t before = bitboard[0] | bitboard[1];
+	board.undo_last_move();
+	uint64_t removed = before & ~(bitboard[0] | bitboard[1]);
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		if (removed & (COL1 << (col * H1)))
+		{
+			return col;
+		}
+	}
+	return -1;
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_microbench [--positions N] [--samples N] [--seed N] [--cpu N] [--nnue FILE]" << std::endl
+		<< "  --nnue  also measure the primitives with the network of FILE (default " << NNUE_FILE << " if it exists)" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Microbenchmark of the board primitives every search node pays for.
+ * Reports the median, minimum and standard deviation of ns/op and the median TSC cycles/op.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	int position_count = 4096;
+	int samples = 21;
+	unsigned seed = 42;
+	int cpu = 0;
+	std::string network_file = std::ifstream(NNUE_FILE) ? NNUE_FILE : "";
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--positions") == 0 && i + 1 < argc)
+		{
+			position_count = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+		{
+			samples = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = (unsigned) std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--cpu") == 0 && i + 1 < argc)
+		{
+			cpu = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--nnue") == 0 && i + 1 < argc)
+		{
+			network_file = argv[++i];
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (position_count <= 0 || samples <= 0)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	bool pinned = cpu >= 0 && pin_current_thread(cpu);
+
+	std::vector<Bench_board> positions = make_positions(position_count, seed);
+	std::vector<int> columns(positions.size());
+	std::vector<int> last_columns(positions.size());
+	for (std::size_t i = 0; i < positions.size(); i++)
+	{
+		columns[i] = first_playable(positions[i]);
+		last_columns[i] = last_column(positions[i]);
+	}
+
+	std::vector<Measurement> results;
+	// place and undo_last_move change the positions, so each is measured in its own pass and undone by the other.
+	results.push_back(measure("place", positions, samples, 16,
+		[&](Bench_board& board, std::size_t i)
+		{
+			board.place(columns[i]);
+			return board.get_board()[0];
+		},
+		[](Bench_board& board, std::size_t)
+		{
+			board.undo_last_move();
+		}));
+	results.push_back(measure("undo_last_move", positions, samples, 16,
+		[](Bench_board& board, std::size_t)
+		{
+			return (uint64_t) board.undo_last_move();
+		},
+		[&](Bench_board& board, std::size_t i)
+		{
+			board.place(last_columns[i]);
+		}));
+	results.push_back(measure("is_playable x7", positions, samples, 16,
+		[](Bench_board& board, std::size_t)
+		{
+			uint64_t playable = 0;
+			for (int col = 0; col < BOARD_WIDTH; col++)
+			{
+				playable += board.is_playable(col);
+			}
+			return playable;
+		}, No_restore()));
+	results.push_back(measure("has_won", positions, samples, 16,
+		[](Bench_board& board, std::size_t)
+		{
+			const uint64_t* bitboard = board.get_board();
+			return board.has_won(bitboard[0]) + board.has_won(bitboard[1]);
+		}, No_restore()));
+	results.push_back(measure("test_win", positions, samples, 16,
+		[](Bench_board& board, std::size_t)
+		{
+			return (uint64_t) board.test_win();
+		}, No_restore()));
+	results.push_back(measure("evaluate", positions, samples, 1,
+		[](Bench_board& board, std::size_t)
+		{
+			return (uint64_t) board.evaluate(1);
+		}, No_restore()));
+	{
+		std::vector<Bench_board> pattern_positions = positions;
+		Search_options options;
+		options.evaluator = Evaluator::PATTERN;
+		for (Bench_board& board : pattern_positions)
+		{
+			board.set_options(options);
+		}
+		results.push_back(measure("evaluate pattern", pattern_positions, samples, 1,
+			[](Bench_board& board, std::size_t)
+			{
+				return (uint64_t) board.evaluate(1);
+			}, No_restore()));
+	}
+	if (!network_file.empty())
+	{
+		std::string error;
+		std::shared_ptr<const Nnue> network = Nnue::load(network_file, error);
+		if (!network)
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+		// the same positions on boards that keep the network's accumulators up to date
+		std::vector<Bench_board> network_positions = positions;
+		Search_options options;
+		options.evaluator = Evaluator::NNUE;
+		for (Bench_board& board : network_positions)
+		{
+			board.set_options(options);
+			board.set_network(network);
+		}
+		results.push_back(measure("place nnue", network_positions, samples, 16,
+			[&](Bench_board& board, std::size_t i)
+			{
+				board.place(columns[i]);
+				return board.get_board()[0];
+			},
+			[](Bench_board& board, std::size_t)
+			{
+				board.undo_last_move();
+			}));
+		results.push_back(measure("undo_last_move nnue", network_positions, samples, 16,
+			[](Bench_board& board, std::size_t)
+			{
+				return (uint64_t) board.undo_last_move();
+			},
+			[&](Bench_board& board, std::size_t i)
+			{
+				board.place(last_columns[i]);
+			}));
+		results.push_back(measure("evaluate nnue", network_positions, samples, 16,
+			[](Bench_board& board, std::size_t)
+			{
+				return (uint64_t) board.evaluate(1);
+			}, No_restore()));
+		results.push_back(measure("nnue refresh", network_positions, samples, 16,
+			[&](Bench_board& board, std::size_t)
+			{
+				Nnue_accumulator accumulator;
+				network->refresh(accumulator, board.get_board());
+				return (uint64_t) accumulator.values[0][0];
+			}, No_restore()));
+	}
+	results.push_back(measure("get_markers", positions, samples, 1,
+		[](Bench_board& board, std::size_t)
+		{
+			return (uint64_t) board.get_markers().size();
+		}, No_restore()));
+
+	std::cout << "positions " << positions.size() << ", samples " << samples << ", seed " << seed
+		<< ", pinned " << (pinned ? "cpu " + std::to_string(cpu) : std::string("no")) << std::endl;
+	std::cout << std::left << std::setw(24) << "primitive" << std::right
+		<< std::setw(12) << "ns/op" << std::setw(12) << "min" << std::setw(12) << "stddev" << std::setw(12) << "cycles/op" << std::endl;
+	std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+	std::cout.precision(2);
+	for (const Measurement& result : results)
+	{
+		std::cout << std::left << std::setw(24) << result.name << std::right
+			<< std::setw(12) << result.ns_median << std::setw(12) << result.ns_min
+			<< std::setw(12) << result.ns_stddev << std::setw(12) << result.cycles_median << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+#include "nnue.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+const char NETWORK_MAGIC[8] = { 'C', 'O', 'N', '4', 'N', 'N', '\r', '\n' };
+/** Bump whenever the inputs, the layers or the quantisation change. */
+const uint32_t NETWORK_VERSION = 1;
+/** Written in native byte order, to detect a file of a machine with the other one. */
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/**
+ * Header of a network file, followed by Nnue_weights.
+ */
+struct Network_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t board_width;
+	uint32_t board_height;
+	uint32_t hidden;
+	uint32_t reserved;
+};
+
+#if defined(__AVX2__)
+
+/** Number of 16-bit values in a 256-bit register. */
+const int LANES = 16;
+static_assert(NNUE_HIDDEN % LANES == 0, "the first layer must fill whole registers");
+
+#endif
+
+} // namespace
+
+Nnue::Nnue(const Nnue_weights& weights)
+: weights(weights)
+, hash(2166136261u)
+{
+	// FNV-1a over the parameters
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&weights);
+	for (std::size_t i = 0; i < sizeof(Nnue_weights); i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+}
+
+std::shared_ptr<const Nnue> Nnue::load(const std::string& path, std::string& error)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		error = path + ": cannot be opened";
+		return nullptr;
+	}
+	Network_header header;
+	std::unique_ptr<Nnue_weights> weights(new Nnue_weights());
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, NETWORK_MAGIC, sizeof(NETWORK_MAGIC)) != 0)
+	{
+		error = path + ": not a network";
+	}
+	else if (header.version != NETWORK_VERSION || header.byte_order != BYTE_ORDER_MARK)
+	{
+		error = path + ": network format " + std::to_string(header.version) + " is not supported";
+	}
+	else if (header.board_width != BOARD_WIDTH || header.board_height != BOARD_HEIGHT || header.hidden != NNUE_HIDDEN)
+	{
+		error = path + ": network of a " + std::to_string(header.board_width) + "x" + std::to_string(header.board_height)
+			+ " board with " + std::to_string(header.hidden) + " neurons";
+	}
+	else if (!file.read(reinterpret_cast<char*>(weights.get()), sizeof(Nnue_weights)) || file.peek() != EOF)
+	{
+		error = path + ": network is damaged or truncated";
+	}
+	else
+	{
+		return std::make_shared<const Nnue>(*weights);
+	}
+	return nullptr;
+}
+
+bool Nnue::save(const std::string& path) const
+{
+	Network_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, NETWORK_MAGIC, sizeof(NETWORK_MAGIC));
+	header.version = NETWORK_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.board_width = (uint32_t) BOARD_WIDTH;
+	header.board_height = (uint32_t) BOARD_HEIGHT;
+	header.hidden = NNUE_HIDDEN;
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&weights), sizeof(weights));
+		if (!file.flush())
+		{
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	return replace_file(temporary, path);
+}
+
+const Nnue_weights& Nnue::get_weights() const
+{
+	return weights;
+}
+
+uint32_t Nnue::get_hash() const
+{
+	return hash;
+}
+
+int Nnue::get_input(int bit, bool own)
+{
+	// skip the unused top row of every column
+	return bit - bit / (int) H1 + (own ? 0 : (int) SIZE);
+}
+
+void Nnue::refresh(Nnue_accumulator& accumulator, const uint64_t bitboard[2]) const
+{
+	for (int view = 0; view < 2; view++)
+	{
+		std::copy(weights.input_biases, weights.input_biases + NNUE_HIDDEN, accumulator.values[view]);
+	}
+	for (int bit = 0; bit < (int) SIZE1; bit++)
+	{
+		for (int player = 0; player < 2; player++)
+		{
+			if ((bitboard[player] >> bit) & 1)
+			{
+				add(accumulator, bit, player);
+			}
+		}
+	}
+}
+
+void Nnue::add(Nnue_accumulator& accumulator, int bit, int player) const
+{
+	const int16_t* own = weights.input_weights[get_input(bit, true)];
+	const int16_t* other = weights.input_weights[get_input(bit, false)];
+	int16_t* own_view = accumulator.values[player];
+	int16_t* other_view = accumulator.values[player ^ 1];
+#if defined(__AVX2__)
+	for (int i = 0; i < NNUE_HIDDEN; i += LANES)
+	{
+		__m256i* own_values = reinterpret_cast<__m256i*>(own_view + i);
+		__m256i* other_values = reinterpret_cast<__m256i*>(other_view + i);
+		_mm256_storeu_si256(own_values, _mm256_add_epi16(_mm256_loadu_si256(own_values),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(own + i))));
+		_mm256_storeu_si256(other_values, _mm256_add_epi16(_mm256_loadu_si256(other_values),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i))));
+	}
+#else
+	for (int i = 0; i < NNUE_HIDDEN; i++)
+	{
+		own_view[i] += own[i];
+		other_view[i] += other[i];
+	}
+#endif
+}
+
+void Nnue::remove(Nnue_accumulator& accumulator, int bit, int player) const
+{
+	const int16_t* own = weights.input_weights[get_input(bit, true)];
+	const int16_t* other = weights.input_weights[get_input(bit, false)];
+	int16_t* own_view = accumulator.values[player];
+	int16_t* other_view = accumulator.values[player ^ 1];
+#if defined(__AVX2__)
+	for (int i = 0; i < NNUE_HIDDEN; i += LANES)
+	{
+		__m256i* own_values = reinterpret_cast<__m256i*>(own_view + i);
+		__m256i* other_values = reinterpret_cast<__m256i*>(other_view + i);
+		_mm256_storeu_si256(own_values, _mm256_sub_epi16(_mm256_loadu_si256(own_values),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(own + i))));
+		_mm256_storeu_si256(other_values, _mm256_sub_epi16(_mm256_loadu_si256(other_values),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i))));
+	}
+#else
+	for (int i = 0; i < NNUE_HIDDEN; i++)
+	{
+		own_view[i] -= own[i];
+		other_view[i] -= other[i];
+	}
+#endif
+}
+
+int Nnue::evaluate(const Nnue_accumulator& accumulator, int player) const
+{
+	int32_t sum = weights.output_bias;
+#if defined(__AVX2__)
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(NNUE_ACTIVATION_SCALE);
+	__m256i sums = _mm256_setzero_si256();
+	for (int view = 0; view < 2; view++)
+	{
+		const int16_t* values = accumulator.values[player ^ view];
+		const int8_t* output = weights.output_weights + view * NNUE_HIDDEN;
+		for (int i = 0; i < NNUE_HIDDEN; i += LANES)
+		{
+			__m256i activation = _mm256_min_epi16(_mm256_max_epi16(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)), zero), one);
+			__m256i output_weights = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(output + i)));
+			// products of neighbouring pairs added into 32-bit lanes
+			sums = _mm256_add_epi32(sums, _mm256_madd_epi16(activation, output_weights));
+		}
+	}
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum += _mm_cvtsi128_si32(half);
+#else
+	for (int view = 0; view < 2; view++)
+	{
+		const int16_t* values = accumulator.values[player ^ view];
+		const int8_t* output = weights.output_weights + view * NNUE_HIDDEN;
+		for (int i = 0; i < NNUE_HIDDEN; i++)
+		{
+			int activation = std::min(std::max((int) values[i], 0), NNUE_ACTIVATION_SCALE);
+			sum += activation * output[i];
+		}
+	}
+#endif
+	// all 64 activations at the output weight limit score about 50800 before the bias, twice SCORE_EVAL_MAX
+	int64_t score = (int64_t) sum * NNUE_SCORE_SCALE / (NNUE_ACTIVATION_SCALE * NNUE_OUTPUT_SCALE);
+	return (int) std::max<int64_t>(-SCORE_EVAL_MAX, std::min<int64_t>(SCORE_EVAL_MAX, score));
+}
+
+} // namespace con4game
@@ -0,0 +1,497 @@
+#include "board.h"
+#include "dataset.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * A training position from the view of the player to move.
+ */
+struct Sample
+{
+	/** The counters of the player to move and of the opponent. */
+	uint64_t own;
+	uint64_t other;
+	/** The expected result of the player to move, from 0 (lost) to 1 (won). */
+	float target;
+};
+
+/**
+ * The network in floating point, with the Adam moments of every parameter.
+ * The parameters are one array in the order of Nnue_weights.
+ */
+class Trainer
+{
+public:
+	static const int INPUT_WEIGHTS = NNUE_INPUTS * NNUE_HIDDEN;
+	static const int INPUT_BIASES = INPUT_WEIGHTS;
+	static const int OUTPUT_WEIGHTS = INPUT_BIASES + NNUE_HIDDEN;
+	static const int OUTPUT_BIAS = OUTPUT_WEIGHTS + 2 * NNUE_HIDDEN;
+	static const int PARAMETERS = OUTPUT_BIAS + 1;
+
+	explicit Trainer(unsigned seed)
+	: parameters(PARAMETERS)
+	, gradients(PARAMETERS)
+	, first_moments(PARAMETERS)
+	, second_moments(PARAMETERS)
+	, steps(0)
+	{
+		std::mt19937 rng(seed);
+		// inputs are sparse: about a quarter of them are set
+		std::normal_distribution<float> input(0.f, 0.25f);
+		std::normal_distribution<float> output(0.f, 0.3f);
+		for (int i = 0; i < INPUT_WEIGHTS; i++)
+		{
+			parameters[i] = input(rng);
+		}
+		for (int i = 0; i < NNUE_HIDDEN; i++)
+		{
+			parameters[INPUT_BIASES + i] = 0.5f;
+		}
+		for (int i = 0; i < 2 * NNUE_HIDDEN; i++)
+		{
+			parameters[OUTPUT_WEIGHTS + i] = output(rng);
+		}
+	}
+
+	/** Start from a quantised network. */
+	void set_weights(const Nnue_weights& weights)
+	{
+		for (int i = 0; i < INPUT_WEIGHTS; i++)
+		{
+			parameters[i] = weights.input_weights[i / NNUE_HIDDEN][i % NNUE_HIDDEN] / (float) NNUE_ACTIVATION_SCALE;
+		}
+		for (int i = 0; i < NNUE_HIDDEN; i++)
+		{
+			parameters[INPUT_BIASES + i] = weights.input_biases[i] / (float) NNUE_ACTIVATION_SCALE;
+		}
+		for (int i = 0; i < 2 * NNUE_HIDDEN; i++)
+		{
+			parameters[OUTPUT_WEIGHTS + i] = weights.output_weights[i] / (float) NNUE_OUTPUT_SCALE;
+		}
+		parameters[OUTPUT_BIAS] = weights.output_bias / (float) (NNUE_ACTIVATION_SCALE * NNUE_OUTPUT_SCALE);
+	}
+
+	/** Round the parameters to the integers of the network file. */
+	Nnue_weights get_weights() const
+	{
+		Nnue_weights weights;
+		for (int i = 0; i < INPUT_WEIGHTS; i++)
+		{
+			weights.input_weights[i / NNUE_HIDDEN][i % NNUE_HIDDEN] = (int16_t) quantise(parameters[i], NNUE_ACTIVATION_SCALE, 32767);
+		}
+		for (int i = 0; i < NNUE_HIDDEN; i++)
+		{
+			weights.input_biases[i] = (int16_t) quantise(parameters[INPUT_BIASES + i], NNUE_ACTIVATION_SCALE, 32767);
+		}
+		for (int i = 0; i < 2 * NNUE_HIDDEN; i++)
+		{
+			weights.output_weights[i] = (int8_t) quantise(parameters[OUTPUT_WEIGHTS + i], NNUE_OUTPUT_SCALE, 127);
+		}
+		weights.output_bias = (int32_t) quantise(parameters[OUTPUT_BIAS], NNUE_ACTIVATION_SCALE * NNUE_OUTPUT_SCALE, 1 << 30);
+		return weights;
+	}
+
+	/**
+	 * Compute the output logit of a sample, and if `scale` is not 0, add the gradient of the squared error
+	 * of the predicted result, times `scale`, to the gradients.
+	 * @return the squared error
+	 */
+	float train(const Sample& sample, float scale)
+	{
+		float accumulators[2][NNUE_HIDDEN];
+		const uint64_t counters[2] = { sample.own, sample.other };
+		int inputs[2][SIZE];
+		int count = 0;
+		for (int bit = 0; bit < (int) SIZE1; bit++)
+		{
+			for (int player = 0; player < 2; player++)
+			{
+				if ((counters[player] >> bit) & 1)
+				{
+					inputs[0][count] = Nnue::get_input(bit, player == 0);
+					inputs[1][count] = Nnue::get_input(bit, player == 1);
+					count++;
+				}
+			}
+		}
+		float logit = parameters[OUTPUT_BIAS];
+		for (int view = 0; view < 2; view++)
+		{
+			std::copy(&parameters[INPUT_BIASES], &parameters[INPUT_BIASES] + NNUE_HIDDEN, accumulators[view]);
+			for (int j = 0; j < count; j++)
+			{
+				const float* column = &parameters[inputs[view][j] * NNUE_HIDDEN];
+				for (int i = 0; i < NNUE_HIDDEN; i++)
+				{
+					accumulators[view][i] += column[i];
+				}
+			}
+			for (int i = 0; i < NNUE_HIDDEN; i++)
+			{
+				logit += clip(accumulators[view][i]) * parameters[OUTPUT_WEIGHTS + view * NNUE_HIDDEN + i];
+			}
+		}
+		float predicted = 1.f / (1.f + std::exp(-logit));
+		float error = predicted - sample.target;
+		if (scale == 0)
+		{
+			return error * error;
+		}
+		float delta = scale * 2.f * error * predicted * (1.f - predicted);
+		gradients[OUTPUT_BIAS] += delta;
+		for (int view = 0; view < 2; view++)
+		{
+			float hidden_deltas[NNUE_HIDDEN];
+			for (int i = 0; i < NNUE_HIDDEN; i++)
+			{
+				float value = accumulators[view][i];
+				gradients[OUTPUT_WEIGHTS + view * NNUE_HIDDEN + i] += delta * clip(value);
+				// the clipped activation passes the gradient only between its bounds
+				hidden_deltas[i] = value > 0 && value < 1 ? delta * parameters[OUTPUT_WEIGHTS + view * NNUE_HIDDEN + i] : 0.f;
+				gradients[INPUT_BIASES + i] += hidden_deltas[i];
+			}
+			for (int j = 0; j < count; j++)
+			{
+				float* column = &gradients[inputs[view][j] * NNUE_HIDDEN];
+				for (int i = 0; i < NNUE_HIDDEN; i++)
+				{
+					column[i] += hidden_deltas[i];
+				}
+			}
+		}
+		return error * error;
+	}
+
+	/** Apply the gradients of a batch with Adam and clear them. */
+	void step(float learning_rate)
+	{
+		const float beta1 = 0.9f;
+		const float beta2 = 0.999f;
+		steps++;
+		float correction1 = 1.f - std::pow(beta1, (float) steps);
+		float correction2 = 1.f - std::pow(beta2, (float) steps);
+		for (int i = 0; i < PARAMETERS; i++)
+		{
+			first_moments[i] = beta1 * first_moments[i] + (1.f - beta1) * gradients[i];
+			second_moments[i] = beta2 * second_moments[i] + (1.f - beta2) * gradients[i] * gradients[i];
+			parameters[i] -= learning_rate * (first_moments[i] / correction1) / (std::sqrt(second_moments[i] / correction2) + 1e-8f);
+			gradients[i] = 0.f;
+		}
+		// keep the output weights within the range of their 8-bit integers
+		const float bound = 127.f / NNUE_OUTPUT_SCALE;
+		for (int i = 0; i < 2 * NNUE_HIDDEN; i++)
+		{
+			parameters[OUTPUT_WEIGHTS + i] = std::min(std::max(parameters[OUTPUT_WEIGHTS + i], -bound), bound);
+		}
+	}
+
+private:
+	static float clip(float value)
+	{
+		return std::min(std::max(value, 0.f), 1.f);
+	}
+
+	static long quantise(float value, int scale, long bound)
+	{
+		return std::min(std::max(std::lround(value * scale), -bound), bound);
+	}
+
+	std::vector<float> parameters;
+	std::vector<float> gradients;
+	std::vector<float> first_moments;
+	std::vector<float> second_moments;
+	long long steps;
+};
+
+/** Mirror the counters of a bitboard from left to right. */
+uint64_t mirror(uint64_t counters)
+{
+	uint64_t mirrored = 0;
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		mirrored |= ((counters >> (col * H1)) & COL1) << ((BOARD_WIDTH - 1 - col) * H1);
+	}
+	return mirrored;
+}
+
+/**
+ * Read "MOVES RESULT" lines, the moves as 1-based column digits and the result of the player to move from 0 to 1.
+ * @return false on the first invalid line
+ */
+bool read_samples(std::istream& in, std::vector<Sample>& samples, std::string& error)
+{
+	std::string line;
+	long long number = 0;
+	while (std::getline(in, line))
+	{
+		number++;
+		std::istringstream fields(line);
+		std::string moves;
+		float target = -1;
+		if (line.empty())
+		{
+			continue;
+		}
+		// the empty position has no moves to list
+		if (line[0] == ' ')
+		{
+			fields >> target;
+		}
+		else
+		{
+			fields >> moves >> target;
+		}
+		Board board;
+		bool valid = fields && target >= 0 && target <= 1;
+		for (std::size_t i = 0; valid && i < moves.size(); i++)
+		{
+			int col = moves[i] - '1';
+			valid = col >= 0 && col < BOARD_WIDTH && board.is_playable(col) && board.test_win() == 0;
+			if (valid)
+			{
+				board.place(col);
+			}
+		}
+		if (!valid)
+		{
+			error = "line " + std::to_string(number) + ": expected MOVES RESULT: " + line;
+			return false;
+		}
+		const uint64_t* bitboard = board.get_board();
+		int mover = board.get_plies() & 1;
+		samples.push_back(Sample { bitboard[mover], bitboard[mover ^ 1], target });
+	}
+	return true;
+}
+
+/**
+ * Read the records of a shard written by connectfour_datagen.
+ * The target is the exact result if it is known, otherwise the result of the game.
+ */
+bool read_records(const std::string& path, std::vector<Sample>& samples, std::string& error)
+{
+	std::unique_ptr<Record_file> file = Record_file::open(path, error);
+	if (!file)
+	{
+		return false;
+	}
+	const Training_record* records = file->get_records();
+	for (std::size_t i = 0; i < file->get_count(); i++)
+	{
+		const Training_record& record = records[i];
+		int result = record.exact != Training_record::UNKNOWN ? record.exact : record.outcome;
+		if (result == Training_record::UNKNOWN || record.side > 1)
+		{
+			continue;
+		}
+		samples.push_back(Sample { record.bitboard[record.side], record.bitboard[record.side ^ 1], 0.5f * result });
+	}
+	return true;
+}
+
+/** Mean squared error of the quantised network on a set of positions. */
+double get_quantised_error(const Nnue& network, const std::vector<Sample>& samples)
+{
+	double sum = 0;
+	Nnue_accumulator accumulator;
+	for (const Sample& sample : samples)
+	{
+		const uint64_t bitboard[2] = { sample.own, sample.other };
+		network.refresh(accumulator, bitboard);
+		double logit = (double) network.evaluate(accumulator, 0) / NNUE_SCORE_SCALE;
+		double error = 1.0 / (1.0 + std::exp(-logit)) - sample.target;
+		sum += error * error;
+	}
+	return samples.empty() ? 0.0 : sum / samples.size();
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_nnue_train [--epochs N] [--batch N] [--rate R] [--validation F] [--seed S]" << std::endl
+		<< "                             [--init FILE] [--output FILE] [DATA...]" << std::endl
+		<< "  Trains the network of Evaluator::NNUE on positions labelled with the result of the player to move." << std::endl
+		<< "  DATA files hold one position per line, MOVES RESULT: 1-based column digits (a space for the empty board)" << std::endl
+		<< "  and a result from 0 (lost) to 1 (won); without DATA the lines are read from stdin." << std::endl
+		<< "  DATA files ending in .c4r are shards of connectfour_datagen, learned with the exact result if it is known," << std::endl
+		<< "  otherwise with the result of the game." << std::endl
+		<< "  Every position is also learned mirrored." << std::endl
+		<< "  --epochs N      passes over the training positions (default 20)" << std::endl
+		<< "  --batch N       positions per step (default 256)" << std::endl
+		<< "  --rate R        Adam learning rate (default 0.001)" << std::endl
+		<< "  --validation F  fraction of the positions held out to measure the error (default 0.1)" << std::endl
+		<< "  --seed S        seed of the initial weights and the shuffles (default 1)" << std::endl
+		<< "  --init FILE     continue training a network file" << std::endl
+		<< "  --output FILE   where to write the network (default " << NNUE_FILE << ")" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Train the network of Evaluator::NNUE in floating point with Adam and write it quantised.
+ * Prints the training and validation errors after every epoch, and the validation error of the quantised network.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	int epochs = 20;
+	int batch = 256;
+	float learning_rate = 0.001f;
+	double validation = 0.1;
+	unsigned seed = 1;
+	std::string init_file;
+	std::string output_file = NNUE_FILE;
+	std::vector<std::string> data_files;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--epochs") == 0 && i + 1 < argc)
+		{
+			epochs = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			batch = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+		{
+			learning_rate = (float) std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--validation") == 0 && i + 1 < argc)
+		{
+			validation = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = (unsigned) std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--init") == 0 && i + 1 < argc)
+		{
+			init_file = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			output_file = argv[++i];
+		}
+		else if (argv[i][0] != '-')
+		{
+			data_files.push_back(argv[i]);
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (epochs < 0 || batch <= 0 || learning_rate <= 0 || validation < 0 || validation >= 1)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Sample> samples;
+	std::string error;
+	bool valid = true;
+	if (data_files.empty())
+	{
+		valid = read_samples(std::cin, samples, error);
+	}
+	const std::string extension = ".c4r";
+	for (std::size_t i = 0; valid && i < data_files.size(); i++)
+	{
+		const std::string& path = data_files[i];
+		if (path.size() > extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+		{
+			valid = read_records(path, samples, error);
+			continue;
+		}
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cerr << path << ": cannot be opened" << std::endl;
+			return EXIT_FAILURE;
+		}
+		valid = read_samples(file, samples, error);
+		if (!valid)
+		{
+			error = path + ": " + error;
+		}
+	}
+	if (!valid || samples.empty())
+	{
+		std::cerr << (valid ? "no positions" : error) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Trainer trainer(seed);
+	if (!init_file.empty())
+	{
+		std::shared_ptr<const Nnue> network = Nnue::load(init_file, error);
+		if (!network)
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+		trainer.set_weights(network->get_weights());
+	}
+
+	// hold out whole positions, their mirror images go with them
+	std::mt19937 rng(seed);
+	std::shuffle(samples.begin(), samples.end(), rng);
+	std::size_t training_size = samples.size() - (std::size_t) (validation * samples.size());
+	std::vector<Sample> validation_samples(samples.begin() + training_size, samples.end());
+	samples.resize(training_size);
+	for (std::size_t i = 0; i < training_size; i++)
+	{
+		samples.push_back(Sample { mirror(samples[i].own), mirror(samples[i].other), samples[i].target });
+	}
+	std::cerr << samples.size() << " training positions with their mirror images, "
+		<< validation_samples.size() << " validation positions" << std::endl;
+
+	for (int epoch = 1; epoch <= epochs; epoch++)
+	{
+		std::shuffle(samples.begin(), samples.end(), rng);
+		double training_error = 0;
+		for (std::size_t first = 0; first < samples.size(); first += batch)
+		{
+			std::size_t last = std::min(samples.size(), first + batch);
+			for (std::size_t i = first; i < last; i++)
+			{
+				training_error += trainer.train(samples[i], 1.f / (last - first));
+			}
+			trainer.step(learning_rate);
+		}
+		double validation_error = 0;
+		for (const Sample& sample : validation_samples)
+		{
+			validation_error += trainer.train(sample, 0);
+		}
+		std::cout << "epoch " << epoch << ": training error " << training_error / samples.size()
+			<< ", validation error " << (validation_samples.empty() ? 0.0 : validation_error / validation_samples.size()) << std::endl;
+	}
+
+	Nnue network(trainer.get_weights());
+	std::cout << "quantised validation error " << get_quantised_error(network, validation_samples) << std::endl;
+	if (!network.save(output_file))
+	{
+		std::cerr << output_file << ": cannot be written" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "wrote " << output_file << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+const char* event_names[] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+
+#if defined(__linux__)
+int open_counter(uint32_t type, uint64_t config)
+{
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// this thread, any CPU
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+} // namespace
+
+Perf_counters::Perf_counters()
+{
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		fds[i] = -1;
+		counts[i] = 0;
+	}
+#if defined(__linux__)
+	const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	const uint32_t types[EVENT_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+	const uint64_t configs[EVENT_COUNT] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_L1D | cache_read_miss,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		fds[i] = open_counter(types[i], configs[i]);
+		if (fds[i] < 0)
+		{
+			error += std::string(error.empty() ? "" : ", ") + event_names[i] + ": " + std::strerror(errno);
+		}
+	}
+#else
+	error = "hardware counters are only supported on Linux";
+#endif
+}
+
+Perf_counters::~Perf_counters()
+{
+#if defined(__linux__)
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		if (fds[i] >= 0)
+		{
+			close(fds[i]);
+		}
+	}
+#endif
+}
+
+bool Perf_counters::is_available() const
+{
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		if (fds[i] >= 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Perf_counters::is_available(Event event) const
+{
+	return fds[event] >= 0;
+}
+
+const std::string& Perf_counters::get_error() const
+{
+	return error;
+}
+
+void Perf_counters::start()
+{
+#if defined(__linux__)
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		if (fds[i] >= 0)
+		{
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+void Perf_counters::stop()
+{
+#if defined(__linux__)
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		if (fds[i] >= 0)
+		{
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (int i = 0; i < EVENT_COUNT; i++)
+	{
+		counts[i] = 0;
+		// value, time enabled, time running
+		uint64_t values[3];
+		if (fds[i] >= 0 && read(fds[i], values, sizeof(values)) == (ssize_t) sizeof(values))
+		{
+			counts[i] = values[2] > 0 && values[2] < values[1] ? (uint64_t) ((double) values[0] * values[1] / values[2]) : values[0];
+		}
+	}
+#endif
+}
+
+uint64_t Perf_counters::get(Event event) const
+{
+	return counts[event];
+}
+
+const char* Perf_counters::get_name(Event event)
+{
+	return event_names[event];
+}
+
+} // namespace con4game
@@ -0,0 +1,602 @@
+#include "platform.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+const std::size_t CACHE_LINE = 64;
+const std::size_t HUGE_PAGE = 2 << 20;
+
+/** How a block was allocated. */
+enum Kind { KIND_NEW, KIND_MMAP, KIND_VIRTUAL, KIND_VIEW };
+
+std::size_t round_up(std::size_t value, std::size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+#if defined(__linux__)
+// memory policies of <linux/mempolicy.h>, which not every libc exposes
+const int MPOL_PREFERRED_MODE = 1;
+const int MPOL_INTERLEAVE_MODE = 3;
+const int MAX_NODES = 1024;
+
+/**
+ * Parse a kernel CPU or node list such as "0-3,8,10-11".
+ */
+std::vector<int> read_list(const std::string& path)
+{
+	std::vector<int> items;
+	std::ifstream file(path);
+	std::string text;
+	if (!std::getline(file, text))
+	{
+		return items;
+	}
+	std::size_t pos = 0;
+	while (pos < text.size())
+	{
+		std::size_t end = text.find(',', pos);
+		std::string range = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+		std::size_t dash = range.find('-');
+		int first = std::atoi(range.c_str());
+		int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+		for (int i = first; i <= last && !range.empty(); i++)
+		{
+			items.push_back(i);
+		}
+		pos = end == std::string::npos ? text.size() : end + 1;
+	}
+	return items;
+}
+
+std::vector<int> get_memory_nodes()
+{
+	std::vector<int> nodes = read_list("/sys/devices/system/node/has_memory");
+	if (nodes.empty())
+	{
+		nodes.push_back(0);
+	}
+	return nodes;
+}
+
+bool transparent_huge_pages_enabled()
+{
+	std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+	std::string text;
+	return std::getline(file, text) && text.find("[never]") == std::string::npos;
+}
+
+/**
+ * Set the NUMA policy of a range which has not been touched yet.
+ * @return an empty string if successful, otherwise the reason
+ */
+std::string bind_pages(void* address, std::size_t bytes, Numa_policy policy)
+{
+	unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {};
+	int mode = MPOL_INTERLEAVE_MODE;
+	if (policy == Numa_policy::INTERLEAVE)
+	{
+		for (int node : get_memory_nodes())
+		{
+			mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		}
+	}
+	else
+	{
+		unsigned cpu = 0;
+		unsigned node = 0;
+		if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		{
+			return std::strerror(errno);
+		}
+		mode = MPOL_PREFERRED_MODE;
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	}
+	if (syscall(SYS_mbind, address, bytes, mode, mask, (unsigned long) MAX_NODES, 0) != 0)
+	{
+		return std::strerror(errno);
+	}
+	return "";
+}
+#endif
+
+#if defined(_MSC_VER)
+/**
+ * Allow this process to allocate large pages, which needs the "Lock pages in memory" user right.
+ */
+bool enable_lock_memory_privilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+		&& GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+#endif
+
+std::string describe_numa(Numa_policy policy, const std::string& error)
+{
+	int nodes = get_numa_node_count();
+	if (nodes <= 1)
+	{
+		return "single NUMA node";
+	}
+	if (!error.empty())
+	{
+		return std::string("NUMA policy ") + get_numa_policy_name(policy) + " failed (" + error + ")";
+	}
+	switch (policy)
+	{
+	case Numa_policy::INTERLEAVE:
+		return "interleaved over " + std::to_string(nodes) + " nodes";
+	case Numa_policy::LOCAL:
+		return "local to the allocating thread's node";
+	default:
+		return "default NUMA placement on " + std::to_string(nodes) + " nodes";
+	}
+}
+
+} // namespace
+
+Large_memory::Large_memory(std::size_t bytes, const Memory_options& options)
+: base(nullptr)
+, mapped(0)
+, size(bytes)
+, offset(0)
+, huge(false)
+, kind(KIND_NEW)
+{
+	std::string pages = "normal pages";
+	std::string numa_error;
+	bool want_huge = options.huge_pages && bytes >= HUGE_PAGE;
+#if defined(__linux__)
+	if (want_huge)
+	{
+		// reserved huge pages, only if the administrator set some aside
+		mapped = round_up(bytes, HUGE_PAGE);
+		base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED)
+		{
+			huge = true;
+			pages = "huge pages (hugetlb)";
+		}
+	}
+	if (!huge)
+	{
+		// over-allocate to start on a huge page boundary so that transparent huge pages can back all of it
+		mapped = want_huge ? round_up(bytes, HUGE_PAGE) + HUGE_PAGE : bytes;
+		base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED && want_huge)
+		{
+			offset = round_up(reinterpret_cast<std::uintptr_t>(base), HUGE_PAGE) - reinterpret_cast<std::uintptr_t>(base);
+			if (madvise(static_cast<char*>(base) + offset, round_up(bytes, HUGE_PAGE), MADV_HUGEPAGE) == 0 && transparent_huge_pages_enabled())
+			{
+				huge = true;
+				pages = "transparent huge pages";
+			}
+			else
+			{
+				pages = "normal pages (transparent huge pages unavailable)";
+			}
+		}
+	}
+	if (base != MAP_FAILED)
+	{
+		kind = KIND_MMAP;
+		if (options.numa != Numa_policy::DEFAULT && get_numa_node_count() > 1)
+		{
+			numa_error = bind_pages(static_cast<char*>(base) + offset, bytes, options.numa);
+		}
+	}
+	else
+	{
+		base = nullptr;
+	}
+#elif defined(_MSC_VER)
+	SIZE_T large_page = GetLargePageMinimum();
+	UCHAR node = 0;
+	bool local = options.numa == Numa_policy::LOCAL && GetNumaProcessorNode((UCHAR) GetCurrentProcessorNumber(), &node);
+	if (options.numa == Numa_policy::INTERLEAVE && get_numa_node_count() > 1)
+	{
+		numa_error = "interleaving is not supported on Windows";
+	}
+	if (want_huge && large_page > 0 && enable_lock_memory_privilege())
+	{
+		mapped = round_up(bytes, large_page);
+		DWORD type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+		base = local ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, mapped, type, PAGE_READWRITE, node)
+			: VirtualAlloc(nullptr, mapped, type, PAGE_READWRITE);
+		if (base)
+		{
+			huge = true;
+			pages = "large pages";
+		}
+	}
+	if (!base)
+	{
+		mapped = bytes;
+		DWORD type = MEM_RESERVE | MEM_COMMIT;
+		base = local ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, mapped, type, PAGE_READWRITE, node)
+			: VirtualAlloc(nullptr, mapped, type, PAGE_READWRITE);
+		if (base && want_huge)
+		{
+			pages = "normal pages (large pages need the Lock pages in memory right)";
+		}
+	}
+	if (base)
+	{
+		kind = KIND_VIRTUAL;
+	}
+#endif
+	if (!base)
+	{
+		// plain heap memory, aligned to a cache line by hand
+		mapped = bytes + CACHE_LINE;
+		base = new char[mapped]();
+		offset = round_up(reinterpret_cast<std::uintptr_t>(base), CACHE_LINE) - reinterpret_cast<std::uintptr_t>(base);
+		kind = KIND_NEW;
+		pages = "heap memory";
+	}
+	description = pages + ", " + describe_numa(kind == KIND_NEW ? Numa_policy::DEFAULT : options.numa, numa_error);
+}
+
+Large_memory::Large_memory()
+: base(nullptr)
+, mapped(0)
+, size(0)
+, offset(0)
+, huge(false)
+, kind(KIND_NEW)
+{
+}
+
+std::unique_ptr<Large_memory> Large_memory::map_file(const std::string& path, std::string& error)
+{
+	std::unique_ptr<Large_memory> memory(new Large_memory());
+#if defined(__linux__)
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0)
+	{
+		error = path + ": " + std::strerror(errno);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return nullptr;
+	}
+	memory->mapped = (std::size_t) status.st_size;
+	void* base = memory->mapped > 0 ? mmap(nullptr, memory->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	error = base == MAP_FAILED ? path + ": " + std::strerror(memory->mapped > 0 ? errno : EINVAL) : "";
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	memory->base = base;
+	memory->kind = KIND_MMAP;
+#elif defined(_MSC_VER)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		error = path + ": cannot open";
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		return nullptr;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	void* base = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (!base)
+	{
+		error = path + ": cannot map";
+		return nullptr;
+	}
+	memory->base = base;
+	memory->mapped = (std::size_t) file_size.QuadPart;
+	memory->kind = KIND_VIEW;
+#else
+	// no mapping, read the whole file
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	std::streamoff length = file ? (std::streamoff) file.tellg() : 0;
+	if (length <= 0)
+	{
+		error = path + ": cannot open";
+		return nullptr;
+	}
+	memory->mapped = (std::size_t) length;
+	memory->base = new char[memory->mapped];
+	file.seekg(0);
+	if (!file.read(static_cast<char*>(memory->base), length))
+	{
+		error = path + ": cannot read";
+		return nullptr;
+	}
+#endif
+	memory->size = memory->mapped;
+	memory->description = "copy-on-write mapping of " + path;
+	return memory;
+}
+
+std::unique_ptr<Large_memory> Large_memory::open_shared(const std::string& name, std::size_t bytes, bool& created, std::string& error)
+{
+	std::unique_ptr<Large_memory> memory(new Large_memory());
+	created = false;
+#if defined(__linux__)
+	std::string shm_name = "/" + name;
+	int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	created = fd >= 0;
+	if (!created && errno == EEXIST)
+	{
+		fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+	}
+	if (fd < 0)
+	{
+		error = name + ": " + std::strerror(errno);
+		return nullptr;
+	}
+	struct stat status;
+	status.st_size = 0;
+	if (created)
+	{
+		// new pages read as zero
+		if (ftruncate(fd, (off_t) bytes) != 0)
+		{
+			error = name + ": " + std::strerror(errno);
+			close(fd);
+			shm_unlink(shm_name.c_str());
+			return nullptr;
+		}
+		status.st_size = (off_t) bytes;
+	}
+	else
+	{
+		// the creator may not have sized the segment yet
+		std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (fstat(fd, &status) == 0 && status.st_size == 0 && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	memory->mapped = (std::size_t) status.st_size;
+	void* base = memory->mapped > 0 ? mmap(nullptr, memory->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	error = base == MAP_FAILED ? name + ": " + (memory->mapped > 0 ? std::strerror(errno) : "segment is empty") : "";
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	memory->base = base;
+	memory->kind = KIND_MMAP;
+#elif defined(_MSC_VER)
+	std::string mapping_name = "Local\\" + name;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		(DWORD) ((unsigned long long) bytes >> 32), (DWORD) bytes, mapping_name.c_str());
+	if (!mapping)
+	{
+		error = name + ": cannot create the segment";
+		return nullptr;
+	}
+	created = GetLastError() != ERROR_ALREADY_EXISTS;
+	// a view keeps the segment alive after the handle is closed
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	CloseHandle(mapping);
+	MEMORY_BASIC_INFORMATION info;
+	if (!base || VirtualQuery(base, &info, sizeof(info)) == 0)
+	{
+		error = name + ": cannot map the segment";
+		if (base)
+		{
+			UnmapViewOfFile(base);
+		}
+		return nullptr;
+	}
+	memory->base = base;
+	memory->mapped = created ? bytes : (std::size_t) info.RegionSize;
+	memory->kind = KIND_VIEW;
+#else
+	error = "shared memory segments are not supported on this platform";
+	return nullptr;
+#endif
+	memory->size = memory->mapped;
+	memory->description = "shared memory segment " + name + (created ? " (created)" : " (attached)");
+	return memory;
+}
+
+bool Large_memory::remove_shared(const std::string& name)
+{
+#if defined(__linux__)
+	return shm_unlink(("/" + name).c_str()) == 0;
+#else
+	// Windows removes the segment when the last process detaches
+	return true;
+#endif
+}
+
+Large_memory::~Large_memory()
+{
+	switch (kind)
+	{
+#if defined(__linux__)
+	case KIND_MMAP:
+		munmap(base, mapped);
+		break;
+#elif defined(_MSC_VER)
+	case KIND_VIRTUAL:
+		VirtualFree(base, 0, MEM_RELEASE);
+		break;
+	case KIND_VIEW:
+		UnmapViewOfFile(base);
+		break;
+#endif
+	default:
+		delete[] static_cast<char*>(base);
+		break;
+	}
+}
+
+void* Large_memory::get() const
+{
+	return static_cast<char*>(base) + offset;
+}
+
+std::size_t Large_memory::get_size() const
+{
+	return size;
+}
+
+bool Large_memory::has_huge_pages() const
+{
+	return huge;
+}
+
+const std::string& Large_memory::get_description() const
+{
+	return description;
+}
+
+int get_numa_node_count()
+{
+#if defined(__linux__)
+	return (int) get_memory_nodes().size();
+#elif defined(_MSC_VER)
+	ULONG highest = 0;
+	return GetNumaHighestNodeNumber(&highest) ? (int) highest + 1 : 1;
+#else
+	return 1;
+#endif
+}
+
+int get_numa_node(int cpu)
+{
+#if defined(__linux__)
+	for (int node : get_memory_nodes())
+	{
+		for (int node_cpu : read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+		{
+			if (node_cpu == cpu)
+			{
+				return node;
+			}
+		}
+	}
+	return 0;
+#elif defined(_MSC_VER)
+	UCHAR node = 0;
+	return GetNumaProcessorNode((UCHAR) cpu, &node) ? node : 0;
+#else
+	return 0;
+#endif
+}
+
+std::vector<int> get_cpu_order()
+{
+	int cpus = (int) std::thread::hardware_concurrency();
+	int nodes = get_numa_node_count();
+	std::vector<std::vector<int>> by_node(nodes);
+	for (int cpu = 0; cpu < cpus; cpu++)
+	{
+		by_node[get_numa_node(cpu) % nodes].push_back(cpu);
+	}
+	std::vector<int> order;
+	for (std::size_t i = 0; (int) order.size() < cpus; i++)
+	{
+		for (const std::vector<int>& node_cpus : by_node)
+		{
+			if (i < node_cpus.size())
+			{
+				order.push_back(node_cpus[i]);
+			}
+		}
+	}
+	return order;
+}
+
+bool pin_current_thread(int cpu)
+{
+#if defined(_MSC_VER)
+	return SetThreadAffinityMask(GetCurrentThread(), 1ULL << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+bool replace_file(const std::string& from, const std::string& to)
+{
+#if defined(_MSC_VER)
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+const char* get_numa_policy_name(Numa_policy policy)
+{
+	switch (policy)
+	{
+	case Numa_policy::INTERLEAVE:
+		return "interleave";
+	case Numa_policy::LOCAL:
+		return "local";
+	default:
+		return "default";
+	}
+}
+
+bool parse_numa_policy(const std::string& name, Numa_policy& policy)
+{
+	for (Numa_policy candidate : { Numa_policy::DEFAULT, Numa_policy::INTERLEAVE, Numa_policy::LOCAL })
+	{
+		if (name == get_numa_policy_name(candidate))
+		{
+			policy = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace con4game
@@ -0,0 +1,382 @@
+#include "playout.h"
+#include "trace.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+/** The board without its top row, the squares a counter can occupy. */
+const uint64_t SQUARES = ALL1 ^ TOP;
+
+/** Get the first state of the generator of a game (splitmix64), never 0. */
+uint64_t get_game_seed(uint64_t seed, long long game)
+{
+	uint64_t z = seed + (uint64_t) (game + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return z ? z : 1;
+}
+
+/**
+ * Advance the generator of a game (xorshift64). It needs only shifts and exclusive ors,
+ * which the vector kernels have for 64-bit lanes.
+ */
+uint64_t next_random(uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/** Map the high half of a random number to a column, by a multiplication instead of a division. */
+uint64_t get_random_column(uint64_t random)
+{
+	return ((random >> 32) * BOARD_WIDTH) >> 32;
+}
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+
+int count_bits(unsigned mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+#endif
+
+/**
+ * Play one game.
+ * @param own     the counters of the player to move
+ * @param other   the counters of the opponent
+ * @param plies   the number of counters on the board
+ * @return the parity of the plies of the winner's moves, -1 for a draw
+ */
+int play_random_game(uint64_t own, uint64_t other, int plies, uint64_t state)
+{
+	for (; plies < (int) SIZE; plies++)
+	{
+		uint64_t playable = ((own | other) + BOTTOM) & SQUARES;
+		uint64_t square;
+		do
+		{
+			square = playable & (COL1 << (get_random_column(next_random(state)) * H1));
+		} while (!square);
+		own |= square;
+		if (Board::has_won(own))
+		{
+			return plies & 1;
+		}
+		uint64_t swap = own;
+		own = other;
+		other = swap;
+	}
+	return -1;
+}
+
+void play_scalar(uint64_t own, uint64_t other, int plies, long long games, uint64_t seed, Playout_counts& counts)
+{
+	for (long long game = 0; game < games; game++)
+	{
+		int winner = play_random_game(own, other, plies, get_game_seed(seed, game));
+		if (winner < 0)
+		{
+			counts.draws++;
+		}
+		else
+		{
+			counts.wins[winner]++;
+		}
+	}
+}
+
+#if defined(__AVX2__)
+
+/** The lanes of x that are zero as all ones, the others as zero. */
+inline __m256i is_zero(__m256i x)
+{
+	return _mm256_cmpeq_epi64(x, _mm256_setzero_si256());
+}
+
+/** Board::has_won of every lane, non-zero if the lane's counters connect four. */
+inline __m256i has_won(__m256i b)
+{
+	__m256i diag1 = _mm256_and_si256(b, _mm256_srli_epi64(b, BOARD_HEIGHT));
+	__m256i hori = _mm256_and_si256(b, _mm256_srli_epi64(b, H1));
+	__m256i diag2 = _mm256_and_si256(b, _mm256_srli_epi64(b, H2));
+	__m256i vert = _mm256_and_si256(b, _mm256_srli_epi64(b, 1));
+	return _mm256_or_si256(
+		_mm256_or_si256(_mm256_and_si256(diag1, _mm256_srli_epi64(diag1, 2 * BOARD_HEIGHT)), _mm256_and_si256(hori, _mm256_srli_epi64(hori, 2 * H1))),
+		_mm256_or_si256(_mm256_and_si256(diag2, _mm256_srli_epi64(diag2, 2 * H2)), _mm256_and_si256(vert, _mm256_srli_epi64(vert, 2))));
+}
+
+void play_avx2(uint64_t start_own, uint64_t start_other, int start_plies, long long games, uint64_t seed, Playout_counts& counts)
+{
+	const __m256i bottom = _mm256_set1_epi64x((long long) BOTTOM);
+	const __m256i squares = _mm256_set1_epi64x((long long) SQUARES);
+	const __m256i column = _mm256_set1_epi64x((long long) COL1);
+	const __m256i width = _mm256_set1_epi64x((long long) BOARD_WIDTH);
+	const __m256i stride = _mm256_set1_epi64x((long long) H1);
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256i size = _mm256_set1_epi64x((long long) SIZE);
+	// the lanes of every vector, for refilling the lanes whose game is over
+	alignas(32) long long lanes[4][4];
+	long long next_game = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		bool used = next_game < games;
+		lanes[0][lane] = used ? -1 : 0;
+		lanes[1][lane] = (long long) start_own;
+		lanes[2][lane] = (long long) start_other;
+		lanes[3][lane] = (long long) get_game_seed(seed, used ? next_game++ : 0);
+	}
+	__m256i active = _mm256_load_si256((const __m256i*) lanes[0]);
+	__m256i own = _mm256_load_si256((const __m256i*) lanes[1]);
+	__m256i other = _mm256_load_si256((const __m256i*) lanes[2]);
+	__m256i state = _mm256_load_si256((const __m256i*) lanes[3]);
+	__m256i plies = _mm256_set1_epi64x(start_plies);
+	while (!_mm256_testz_si256(active, active))
+	{
+		__m256i playable = _mm256_and_si256(_mm256_add_epi64(_mm256_or_si256(own, other), bottom), squares);
+		__m256i square = _mm256_setzero_si256();
+		// every game draws until it hits a column with room, the games that have one keep their generator
+		__m256i draw = active;
+		while (!_mm256_testz_si256(draw, draw))
+		{
+			__m256i next = state;
+			next = _mm256_xor_si256(next, _mm256_slli_epi64(next, 13));
+			next = _mm256_xor_si256(next, _mm256_srli_epi64(next, 7));
+			next = _mm256_xor_si256(next, _mm256_slli_epi64(next, 17));
+			state = _mm256_blendv_epi8(state, next, draw);
+			// the low 32 bits of each lane multiplied to 64 bits: the column, and its shift
+			__m256i col = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(state, 32), width), 32);
+			__m256i drawn = _mm256_and_si256(playable, _mm256_sllv_epi64(column, _mm256_mul_epu32(col, stride)));
+			square = _mm256_blendv_epi8(square, drawn, draw);
+			draw = _mm256_and_si256(draw, is_zero(drawn));
+		}
+		own = _mm256_or_si256(own, square);
+		unsigned odd = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(plies, 63)));
+		plies = _mm256_add_epi64(plies, one);
+		unsigned won = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_andnot_si256(is_zero(has_won(own)), active)));
+		unsigned full = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_and_si256(_mm256_cmpeq_epi64(plies, size), active))) & ~won;
+		counts.wins[0] += count_bits(won & ~odd);
+		counts.wins[1] += count_bits(won & odd);
+		counts.draws += count_bits(full);
+		__m256i swap = own;
+		own = other;
+		other = swap;
+		if (won | full)
+		{
+			// start the next games in the lanes that are done
+			_mm256_store_si256((__m256i*) lanes[0], active);
+			_mm256_store_si256((__m256i*) lanes[1], own);
+			_mm256_store_si256((__m256i*) lanes[2], other);
+			_mm256_store_si256((__m256i*) lanes[3], state);
+			alignas(32) long long lane_plies[4];
+			_mm256_store_si256((__m256i*) lane_plies, plies);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if ((won | full) & (1u << lane))
+				{
+					bool used = next_game < games;
+					lanes[0][lane] = used ? -1 : 0;
+					lanes[1][lane] = (long long) start_own;
+					lanes[2][lane] = (long long) start_other;
+					lanes[3][lane] = (long long) get_game_seed(seed, used ? next_game++ : 0);
+					lane_plies[lane] = start_plies;
+				}
+			}
+			active = _mm256_load_si256((const __m256i*) lanes[0]);
+			own = _mm256_load_si256((const __m256i*) lanes[1]);
+			other = _mm256_load_si256((const __m256i*) lanes[2]);
+			state = _mm256_load_si256((const __m256i*) lanes[3]);
+			plies = _mm256_load_si256((const __m256i*) lane_plies);
+		}
+	}
+}
+
+#endif
+
+#if defined(__AVX512F__)
+
+/** Board::has_won of every lane, non-zero if the lane's counters connect four. */
+inline __m512i has_won(__m512i b)
+{
+	__m512i diag1 = _mm512_and_si512(b, _mm512_srli_epi64(b, BOARD_HEIGHT));
+	__m512i hori = _mm512_and_si512(b, _mm512_srli_epi64(b, H1));
+	__m512i diag2 = _mm512_and_si512(b, _mm512_srli_epi64(b, H2));
+	__m512i vert = _mm512_and_si512(b, _mm512_srli_epi64(b, 1));
+	return _mm512_or_si512(
+		_mm512_or_si512(_mm512_and_si512(diag1, _mm512_srli_epi64(diag1, 2 * BOARD_HEIGHT)), _mm512_and_si512(hori, _mm512_srli_epi64(hori, 2 * H1))),
+		_mm512_or_si512(_mm512_and_si512(diag2, _mm512_srli_epi64(diag2, 2 * H2)), _mm512_and_si512(vert, _mm512_srli_epi64(vert, 2))));
+}
+
+void play_avx512(uint64_t start_own, uint64_t start_other, int start_plies, long long games, uint64_t seed, Playout_counts& counts)
+{
+	const __m512i bottom = _mm512_set1_epi64((long long) BOTTOM);
+	const __m512i squares = _mm512_set1_epi64((long long) SQUARES);
+	const __m512i column = _mm512_set1_epi64((long long) COL1);
+	const __m512i width = _mm512_set1_epi64((long long) BOARD_WIDTH);
+	const __m512i stride = _mm512_set1_epi64((long long) H1);
+	const __m512i one = _mm512_set1_epi64(1);
+	const __m512i size = _mm512_set1_epi64((long long) SIZE);
+	const __m512i first_own = _mm512_set1_epi64((long long) start_own);
+	const __m512i first_other = _mm512_set1_epi64((long long) start_other);
+	const __m512i first_plies = _mm512_set1_epi64(start_plies);
+	alignas(64) uint64_t seeds[8];
+	long long next_game = 0;
+	__mmask8 active = 0;
+	for (int lane = 0; lane < 8; lane++)
+	{
+		active |= next_game < games ? 1u << lane : 0;
+		seeds[lane] = get_game_seed(seed, next_game < games ? next_game++ : 0);
+	}
+	__m512i own = first_own;
+	__m512i other = first_other;
+	__m512i state = _mm512_load_si512(seeds);
+	__m512i plies = first_plies;
+	while (active)
+	{
+		__m512i playable = _mm512_and_si512(_mm512_add_epi64(_mm512_or_si512(own, other), bottom), squares);
+		__m512i square = _mm512_setzero_si512();
+		// every game draws until it hits a column with room, the games that have one keep their generator
+		__mmask8 draw = active;
+		while (draw)
+		{
+			__m512i next = state;
+			next = _mm512_xor_si512(next, _mm512_slli_epi64(next, 13));
+			next = _mm512_xor_si512(next, _mm512_srli_epi64(next, 7));
+			next = _mm512_xor_si512(next, _mm512_slli_epi64(next, 17));
+			state = _mm512_mask_mov_epi64(state, draw, next);
+			__m512i col = _mm512_srli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(state, 32), width), 32);
+			__m512i drawn = _mm512_and_si512(playable, _mm512_sllv_epi64(column, _mm512_mul_epu32(col, stride)));
+			square = _mm512_mask_mov_epi64(square, draw, drawn);
+			draw = _mm512_mask_testn_epi64_mask(draw, drawn, drawn);
+		}
+		own = _mm512_or_si512(own, square);
+		__mmask8 odd = _mm512_test_epi64_mask(plies, one);
+		plies = _mm512_add_epi64(plies, one);
+		__m512i lines = has_won(own);
+		__mmask8 won = _mm512_mask_test_epi64_mask(active, lines, lines);
+		__mmask8 full = (__mmask8) (_mm512_mask_cmpeq_epi64_mask(active, plies, size) & ~won);
+		counts.wins[0] += count_bits(won & ~odd & 0xff);
+		counts.wins[1] += count_bits(won & odd);
+		counts.draws += count_bits(full);
+		__m512i swap = own;
+		own = other;
+		other = swap;
+		__mmask8 done = (__mmask8) (won | full);
+		if (done)
+		{
+			// start the next games in the lanes that are done
+			_mm512_store_si512(seeds, state);
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (done & (1u << lane))
+				{
+					if (next_game < games)
+					{
+						seeds[lane] = get_game_seed(seed, next_game++);
+					}
+					else
+					{
+						active = (__mmask8) (active & ~(1u << lane));
+					}
+				}
+			}
+			state = _mm512_load_si512(seeds);
+			own = _mm512_mask_mov_epi64(own, done, first_own);
+			other = _mm512_mask_mov_epi64(other, done, first_other);
+			plies = _mm512_mask_mov_epi64(plies, done, first_plies);
+		}
+	}
+}
+
+#endif
+
+} // namespace
+
+long long Playout_counts::games() const
+{
+	return wins[0] + wins[1] + draws;
+}
+
+bool is_playout_kernel_available(Playout_kernel kernel)
+{
+	switch (kernel)
+	{
+	case Playout_kernel::SCALAR:
+		return true;
+	case Playout_kernel::AVX2:
+#if defined(__AVX2__)
+		return true;
+#else
+		return false;
+#endif
+	case Playout_kernel::AVX512:
+#if defined(__AVX512F__)
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+Playout_kernel get_best_playout_kernel()
+{
+	return is_playout_kernel_available(Playout_kernel::AVX512) ? Playout_kernel::AVX512
+		: is_playout_kernel_available(Playout_kernel::AVX2) ? Playout_kernel::AVX2 : Playout_kernel::SCALAR;
+}
+
+const char* get_playout_kernel_name(Playout_kernel kernel)
+{
+	switch (kernel)
+	{
+	case Playout_kernel::AVX2:
+		return "avx2";
+	case Playout_kernel::AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
+
+Playout_counts play_random_games(const Board& board, long long games, uint64_t seed, Playout_kernel kernel)
+{
+	CON4_TRACE_SCOPE("random_games");
+	Playout_counts counts;
+	const uint64_t* bitboard = board.get_board();
+	int plies = board.get_plies();
+	uint64_t own = bitboard[plies & 1];
+	uint64_t other = bitboard[(plies & 1) ^ 1];
+	switch (kernel)
+	{
+#if defined(__AVX2__)
+	case Playout_kernel::AVX2:
+		play_avx2(own, other, plies, games, seed, counts);
+		break;
+#endif
+#if defined(__AVX512F__)
+	case Playout_kernel::AVX512:
+		play_avx512(own, other, plies, games, seed, counts);
+		break;
+#endif
+	default:
+		play_scalar(own, other, plies, games, seed, counts);
+		break;
+	}
+	return counts;
+}
+
+} // namespace con4game
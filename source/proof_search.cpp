@@ -0,0 +1,416 @@
+#include "proof_search.h"
+#include "log.h"
+#include "trace.h"
+
+#include <algorithm>
+
+namespace con4game
+{
+namespace
+{
+
+/** Proof or disproof number of a decided position. */
+const uint32_t INFINITE = 0x3fffffff;
+
+/** Columns from the centre outwards, the order in which moves are tried. */
+const int move_order[BOARD_WIDTH] = { 3, 2, 4, 1, 5, 0, 6 };
+
+/** Get the column of a single square. */
+int get_column(uint64_t square)
+{
+	for (int col = 0; col < BOARD_WIDTH; col++)
+	{
+		if (square & (COL1 << (col * H1)))
+		{
+			return col;
+		}
+	}
+	return -1;
+}
+
+} // namespace
+
+Proof_search::Proof_search(std::size_t size_mb)
+: entries()
+, bucket_shift(64)
+, used(0)
+, attacker_parity(0)
+, stats()
+, limits()
+, deadline()
+, aborted(false)
+{
+	std::size_t buckets = 2;
+	bucket_shift = 63;
+	while (buckets * 2 * BUCKET_SIZE * sizeof(Entry) <= (size_mb << 20))
+	{
+		buckets *= 2;
+		bucket_shift--;
+	}
+	entries.resize(buckets * BUCKET_SIZE);
+}
+
+Proof_search::Result Proof_search::solve(const Board& position, const Proof_limits& new_limits)
+{
+	CON4_TRACE_SCOPE("prove");
+	std::chrono::time_point<std::chrono::steady_clock> start_clock = std::chrono::steady_clock::now();
+	Stats previous = stats;
+	stats = Stats();
+	stats.gc_runs = previous.gc_runs;
+	stats.gc_freed = previous.gc_freed;
+	stats.replacements = previous.replacements;
+	limits = new_limits;
+	deadline = start_clock + std::chrono::milliseconds(limits.time_ms);
+	aborted = false;
+
+	Board board = position;
+	attacker_parity = board.get_plies() & 1;
+
+	if (board.test_win() != 0)
+	{
+		stats.result = Result::NO_WIN;
+	}
+	else
+	{
+		Node root;
+		classify(board, root);
+		if (!root.terminal)
+		{
+			mid(board, INFINITE, INFINITE);
+		}
+		uint32_t phi;
+		uint32_t delta;
+		lookup(board, phi, delta);
+		stats.result = phi == 0 ? Result::WIN : delta == 0 ? Result::NO_WIN : Result::UNKNOWN;
+	}
+	std::chrono::duration<long long, std::nano> clock_diff = std::chrono::steady_clock::now() - start_clock;
+	stats.elapsed_ns = clock_diff.count();
+
+	if (stats.result != Result::UNKNOWN && board.test_win() == 0)
+	{
+		// counting may have to solve again positions that were dropped from the table
+		std::unordered_set<uint64_t> visited;
+		int column;
+		long long proof_size = count_proof(board, visited, column);
+		stats.proof_size = aborted ? 0 : proof_size;
+		stats.column = stats.result == Result::WIN ? column : -1;
+	}
+	stats.entries = used;
+
+	Logger::get().write(Log_level::DEBUG, "prove %s column %d proof %lld nodes %lld time %.3f s",
+		stats.result == Result::WIN ? "win" : stats.result == Result::NO_WIN ? "no win" : "unknown",
+		stats.column, stats.proof_size, stats.nodes, 1e-9 * stats.elapsed_ns);
+	return stats.result;
+}
+
+const Proof_search::Stats& Proof_search::get_stats() const
+{
+	return stats;
+}
+
+void Proof_search::clear()
+{
+	std::fill(entries.begin(), entries.end(), Entry());
+	used = 0;
+}
+
+std::size_t Proof_search::get_capacity() const
+{
+	return entries.size();
+}
+
+void Proof_search::classify(Board& board, Node& node) const
+{
+	const uint64_t* bitboard = board.get_board();
+	int mover = board.get_plies() & 1;
+	uint64_t occupied = bitboard[0] | bitboard[1];
+	uint64_t playable = board.playable_squares();
+	node.terminal = true;
+	node.win_column = -1;
+	node.move_count = 0;
+	node.phi = INFINITE;
+	node.delta = 0;
+
+	uint64_t wins = Board::winning_squares(bitboard[mover], occupied) & playable;
+	if (wins)
+	{
+		node.phi = 0;
+		node.delta = INFINITE;
+		node.win_column = get_column(wins & (0 - wins));
+		return;
+	}
+	if (playable == 0)
+	{
+		// a draw is a success for the defender only
+		bool attacker = mover == attacker_parity;
+		node.phi = attacker ? INFINITE : 0;
+		node.delta = attacker ? 0 : INFINITE;
+		return;
+	}
+	uint64_t opponent_wins = Board::winning_squares(bitboard[mover ^ 1], occupied);
+	uint64_t threats = opponent_wins & playable;
+	if (threats & (threats - 1))
+	{
+		// only one of two threats can be blocked
+		return;
+	}
+	// block a threat, otherwise avoid the squares right below the opponent's winning squares
+	uint64_t candidates = threats ? threats : playable & ~(opponent_wins >> 1);
+	for (int col : move_order)
+	{
+		if (candidates & (COL1 << (col * H1)))
+		{
+			node.moves[node.move_count++] = col;
+		}
+	}
+	if (node.move_count == 0)
+	{
+		// every move gives the opponent a winning square
+		return;
+	}
+	node.terminal = false;
+	node.phi = 1;
+	node.delta = node.move_count;
+}
+
+void Proof_search::lookup(Board& board, uint32_t& phi, uint32_t& delta)
+{
+	const Entry* entry = find(get_key(board));
+	if (entry)
+	{
+		phi = entry->phi;
+		delta = entry->delta;
+		return;
+	}
+	Node node;
+	classify(board, node);
+	phi = node.phi;
+	delta = node.delta;
+}
+
+uint64_t Proof_search::get_key(const Board& board) const
+{
+	// the numbers depend on who attacks, so each attacker has its own entries
+	return board.get_key() | (uint64_t) attacker_parity << 63;
+}
+
+std::size_t Proof_search::get_bucket(uint64_t key) const
+{
+	// the high bits of the product depend on every bit of the key
+	return (std::size_t) ((key * 0x9E3779B97F4A7C15ULL) >> bucket_shift);
+}
+
+const Proof_search::Entry* Proof_search::find(uint64_t key) const
+{
+	const Entry* bucket = &entries[get_bucket(key) * BUCKET_SIZE];
+	for (int i = 0; i < BUCKET_SIZE; i++)
+	{
+		if (bucket[i].key == key)
+		{
+			return &bucket[i];
+		}
+	}
+	return nullptr;
+}
+
+void Proof_search::store(uint64_t key, uint32_t phi, uint32_t delta, long long work)
+{
+	Entry* bucket = &entries[get_bucket(key) * BUCKET_SIZE];
+	Entry* slot = &bucket[0];
+	for (int i = 0; i < BUCKET_SIZE; i++)
+	{
+		if (bucket[i].key == key || bucket[i].key == 0)
+		{
+			slot = &bucket[i];
+			break;
+		}
+		if (bucket[i].work < slot->work)
+		{
+			slot = &bucket[i];
+		}
+	}
+	if (slot->key == 0)
+	{
+		used++;
+	}
+	else if (slot->key != key)
+	{
+		stats.replacements++;
+	}
+	slot->key = key;
+	slot->phi = phi;
+	slot->delta = delta;
+	slot->work = (uint32_t) std::min<long long>(work, UINT32_MAX);
+	if (used * 10 >= entries.size() * 9)
+	{
+		collect_garbage();
+	}
+}
+
+void Proof_search::collect_garbage()
+{
+	CON4_TRACE_SCOPE("prove_gc");
+	// histogram of the subtree sizes by their bit length
+	std::size_t histogram[33] = {};
+	for (const Entry& entry : entries)
+	{
+		if (entry.key != 0)
+		{
+			int bits = 0;
+			for (uint32_t work = entry.work; work; work >>= 1)
+			{
+				bits++;
+			}
+			histogram[bits]++;
+		}
+	}
+	int limit = 0;
+	std::size_t dropped = histogram[0];
+	while (limit < 32 && dropped < used / 2)
+	{
+		dropped += histogram[++limit];
+	}
+	for (Entry& entry : entries)
+	{
+		if (entry.key != 0 && entry.work < (1ULL << limit))
+		{
+			entry = Entry();
+			used--;
+			stats.gc_freed++;
+		}
+	}
+	stats.gc_runs++;
+}
+
+void Proof_search::mid(Board& board, uint32_t phi_limit, uint32_t delta_limit)
+{
+	stats.nodes++;
+	if (aborted || ((stats.nodes & 1023) == 0 && should_stop()))
+	{
+		aborted = true;
+		return;
+	}
+	long long first_node = stats.nodes;
+	uint64_t key = get_key(board);
+	Node node;
+	classify(board, node);
+	if (node.terminal)
+	{
+		store(key, node.phi, node.delta, 1);
+		return;
+	}
+
+	uint32_t phi = node.phi;
+	uint32_t delta = node.delta;
+	uint32_t child_phi[BOARD_WIDTH];
+	uint32_t child_delta[BOARD_WIDTH];
+	while (!aborted)
+	{
+		// phi is the smallest disproof number of a child, delta the sum of their proof numbers
+		phi = INFINITE;
+		uint64_t sum = 0;
+		int best = 0;
+		uint32_t second_delta = INFINITE;
+		for (int i = 0; i < node.move_count; i++)
+		{
+			board.place(node.moves[i]);
+			lookup(board, child_phi[i], child_delta[i]);
+			board.undo_last_move();
+			sum += child_phi[i];
+			if (child_delta[i] < phi)
+			{
+				second_delta = phi;
+				phi = child_delta[i];
+				best = i;
+			}
+			else if (child_delta[i] < second_delta)
+			{
+				second_delta = child_delta[i];
+			}
+		}
+		bool child_lost = std::find(child_phi, child_phi + node.move_count, INFINITE) != child_phi + node.move_count;
+		delta = child_lost ? INFINITE : (uint32_t) std::min<uint64_t>(sum, INFINITE - 1);
+		if (phi >= phi_limit || delta >= delta_limit)
+		{
+			break;
+		}
+		// search the easiest child until it is no longer the easiest, or this position reaches a limit
+		uint64_t best_phi_limit = (uint64_t) delta_limit - delta + child_phi[best];
+		uint64_t best_delta_limit = std::min<uint64_t>(phi_limit, (uint64_t) second_delta + 1);
+		board.place(node.moves[best]);
+		mid(board, (uint32_t) std::min<uint64_t>(best_phi_limit, INFINITE), (uint32_t) best_delta_limit);
+		board.undo_last_move();
+	}
+	store(key, phi, delta, stats.nodes - first_node + 1);
+}
+
+long long Proof_search::count_proof(Board& board, std::unordered_set<uint64_t>& visited, int& column)
+{
+	column = -1;
+	if (aborted || !visited.insert(get_key(board)).second)
+	{
+		return 0;
+	}
+	Node node;
+	classify(board, node);
+	column = node.win_column;
+	if (node.terminal)
+	{
+		return 1;
+	}
+	uint32_t phi;
+	uint32_t delta;
+	lookup(board, phi, delta);
+	for (int attempt = 0; attempt < 2 && !aborted; attempt++)
+	{
+		// the player to move needs one child the opponent loses, the opponent has to answer every child
+		uint32_t child_phi[BOARD_WIDTH];
+		uint32_t child_delta[BOARD_WIDTH];
+		int chosen = -1;
+		bool complete = phi == 0 || delta == 0;
+		for (int i = 0; i < node.move_count && complete; i++)
+		{
+			board.place(node.moves[i]);
+			lookup(board, child_phi[i], child_delta[i]);
+			board.undo_last_move();
+			chosen = chosen < 0 && child_delta[i] == 0 ? i : chosen;
+		}
+		complete = complete && (phi != 0 || chosen >= 0);
+		if (!complete)
+		{
+			// the position or its proving child were dropped by the garbage collector, solve it again
+			mid(board, INFINITE, INFINITE);
+			lookup(board, phi, delta);
+			continue;
+		}
+		long long size = 1;
+		int child_column;
+		for (int i = 0; i < node.move_count; i++)
+		{
+			if (phi != 0 || i == chosen)
+			{
+				board.place(node.moves[i]);
+				size += count_proof(board, visited, child_column);
+				board.undo_last_move();
+			}
+		}
+		column = phi == 0 ? node.moves[chosen] : -1;
+		return size;
+	}
+	return 0;
+}
+
+bool Proof_search::should_stop()
+{
+	if (limits.max_nodes > 0 && stats.nodes >= limits.max_nodes)
+	{
+		return true;
+	}
+	if (limits.stop && limits.stop->load(std::memory_order_relaxed))
+	{
+		return true;
+	}
+	return limits.time_ms > 0 && std::chrono::steady_clock::now() >= deadline;
+}
+
+} // namespace con4game
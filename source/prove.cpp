@@ -0,0 +1,161 @@
+#include "bench_positions.h"
+#include "log.h"
+#include "proof_search.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * Replay a move string on an empty board.
+ * @return true if the string is valid.
+ */
+bool replay(Board& board, const std::string& moves)
+{
+	board.reset();
+	for (char c : moves)
+	{
+		int col = c - '1';
+		if (col < 0 || col >= BOARD_WIDTH || !board.is_playable(col) || board.test_win() != 0)
+		{
+			return false;
+		}
+		board.place(col);
+	}
+	return true;
+}
+
+const char* get_result_name(Proof_search::Result result)
+{
+	switch (result)
+	{
+	case Proof_search::Result::WIN:
+		return "win";
+	case Proof_search::Result::NO_WIN:
+		return "no win";
+	default:
+		return "unknown";
+	}
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_prove [--hash MB] [--nodes N] [--time MS] [--set NAME] [MOVES...]" << std::endl
+		<< "  Decides whether the player to move in each position can force a win." << std::endl
+		<< "  MOVES are 1-based column digits; without MOVES or --set they are read from stdin, one per line." << std::endl
+		<< "  --hash MB      proof table size (default 64)" << std::endl
+		<< "  --nodes N      give up on a position after N nodes (default no limit)" << std::endl
+		<< "  --time MS      give up on a position after MS milliseconds (default no limit)" << std::endl
+		<< "  --set NAME     prove the positions of a bench set (endgame_easy, midgame_hard, opening)" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Proof-number search over positions given on the command line, on stdin, or from a bench set.
+ * Prints the result, proof size, nodes and time of each position and a summary.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	int hash_mb = 64;
+	Proof_limits limits;
+	std::vector<std::string> positions;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--hash") == 0 && i + 1 < argc)
+		{
+			hash_mb = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--nodes") == 0 && i + 1 < argc)
+		{
+			limits.max_nodes = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+		{
+			limits.time_ms = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--set") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			bool found = false;
+			for (const Bench_set& set : bench_sets)
+			{
+				if (std::strcmp(set.name, name) == 0)
+				{
+					for (std::size_t j = 0; j < set.count; j++)
+					{
+						positions.push_back(set.positions[j].moves);
+					}
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (argv[i][0] != '-')
+		{
+			positions.push_back(argv[i]);
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (positions.empty())
+	{
+		std::string line;
+		while (std::getline(std::cin, line))
+		{
+			if (!line.empty())
+			{
+				positions.push_back(line);
+			}
+		}
+	}
+
+	Proof_search search(hash_mb);
+	std::cerr << "proof table " << hash_mb << " MB, " << search.get_capacity() << " entries" << std::endl;
+	Board board;
+	int counts[3] = {};
+	long long total_nodes = 0;
+	long long total_ns = 0;
+	for (const std::string& moves : positions)
+	{
+		if (!replay(board, moves))
+		{
+			std::cerr << "invalid position " << moves << std::endl;
+			return EXIT_FAILURE;
+		}
+		Proof_search::Result result = search.solve(board, limits);
+		const Proof_search::Stats& stats = search.get_stats();
+		counts[(int) result]++;
+		total_nodes += stats.nodes;
+		total_ns += stats.elapsed_ns;
+		std::cout << (moves.empty() ? "(empty)" : moves) << ": " << get_result_name(result);
+		if (result == Proof_search::Result::WIN)
+		{
+			std::cout << " column " << stats.column + 1;
+		}
+		std::cout << ", proof " << stats.proof_size << ", nodes " << stats.nodes
+			<< ", " << 1e-9 * stats.elapsed_ns << " s, table " << stats.entries << " entries" << std::endl;
+	}
+	const Proof_search::Stats& stats = search.get_stats();
+	std::cout << positions.size() << " positions: " << counts[0] << " win, " << counts[1] << " no win, " << counts[2] << " unknown, "
+		<< total_nodes << " nodes, " << 1e-9 * total_ns << " s, " << (total_ns > 0 ? 1e9 * total_nodes / total_ns : 0.0) << " nodes/s, "
+		<< stats.gc_runs << " garbage collections freeing " << stats.gc_freed << " entries, " << stats.replacements << " replacements" << std::endl;
+	return EXIT_SUCCESS;
+}
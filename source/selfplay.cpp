@@ -0,0 +1,284 @@
+#include "log.h"
+#include "match.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace con4game
+{
+namespace
+{
+
+/**
+ * Parse "elo0,elo1[,alpha,beta]".
+ * @return true if successful
+ */
+bool parse_sprt(const std::string& text, Sprt_config& sprt)
+{
+	double values[4] = { sprt.elo0, sprt.elo1, sprt.alpha, sprt.beta };
+	std::stringstream ss(text);
+	std::string item;
+	int count = 0;
+	while (std::getline(ss, item, ','))
+	{
+		if (count == 4)
+		{
+			return false;
+		}
+		char* end = nullptr;
+		values[count++] = std::strtod(item.c_str(), &end);
+		if (item.empty() || *end != '\0')
+		{
+			return false;
+		}
+	}
+	sprt.elo0 = values[0];
+	sprt.elo1 = values[1];
+	sprt.alpha = values[2];
+	sprt.beta = values[3];
+	return (count == 2 || count == 4) && sprt.elo0 < sprt.elo1
+		&& sprt.alpha > 0 && sprt.alpha < 1 && sprt.beta > 0 && sprt.beta < 1;
+}
+
+void print_report(const Engine_config engines[2], const Match& match, const Match_stats& stats, std::size_t openings, int threads)
+{
+	Elo_estimate elo = estimate_elo(stats);
+	std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+	std::cout.precision(1);
+	std::cout << engines[0].name << " vs " << engines[1].name << std::endl
+		<< "games " << stats.games() << ", openings " << openings << ", threads " << threads << std::endl
+		<< "W/D/L " << stats.wins << "/" << stats.draws << "/" << stats.losses
+		<< ", score " << 100 * elo.score << "%" << std::endl
+		<< "elo " << elo.elo << " [" << elo.lower << ", " << elo.upper << "] (95%)" << std::endl;
+	std::cout.precision(3);
+	for (int i = 0; i < 2; i++)
+	{
+		std::cout << engines[i].name << ": " << stats.moves[i] << " moves, "
+			<< (stats.moves[i] ? 1e-6 * stats.time_ns[i] / stats.moves[i] : 0.0) << " ms/move, ";
+		if (engines[i].type == Engine_type::MCTS)
+		{
+			std::cout << (stats.time_ns[i] ? (long long) (1e9 * stats.leaf_evals[i] / stats.time_ns[i]) : 0) << " playouts/s, ";
+		}
+		std::cout << match.get_memory_description(i) << std::endl;
+	}
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_selfplay --first CONFIG --second CONFIG [--games N] [--threads N] [--opening-plies N] [--pin]" << std::endl
+		<< "                            [--sprt ELO0,ELO1[,ALPHA,BETA]] [--state FILE] [--batch N]" << std::endl
+		<< "  CONFIG is a comma separated list of key=value pairs:" << std::endl
+		<< "    engine=E  search: alphabeta (default) or mcts" << std::endl
+		<< "    depth=N   maximum search depth" << std::endl
+		<< "    time=MS   time per move in milliseconds, 0 for none" << std::endl
+		<< "    playouts=N  MCTS playouts per move (default 50000 without a time limit)" << std::endl
+		<< "    threads=N   MCTS search threads sharing the tree (default 1)" << std::endl
+		<< "    batch=N     MCTS random games per leaf, played several at a time with SIMD (default 1)" << std::endl
+		<< "    tt=0|1    use the transposition table (default 1)" << std::endl
+		<< "    root=R    root search: alphabeta (default) or mtdf" << std::endl
+		<< "    lmr=0|1   late move reductions (default 0)" << std::endl
+		<< "    ext=0|1   extend forced blocks and threats (default 0)" << std::endl
+		<< "    threats=0|1  score won and zugzwang-decided positions as wins (default 0)" << std::endl
+		<< "    eval=E    horizon evaluation: classic (default), nnue or pattern" << std::endl
+		<< "    nnue=FILE network of eval=nnue (default " << NNUE_FILE << "), implies eval=nnue" << std::endl
+		<< "    weights=FILE  weights of eval=classic, as written by connectfour_tune" << std::endl
+		<< "    hash=MB   transposition table size, or the MCTS node pool size" << std::endl
+		<< "    huge=0|1  allocate the table on huge pages if possible (default 1)" << std::endl
+		<< "    numa=P    NUMA placement of the table: default, interleave or local" << std::endl
+		<< "    shm=NAME  share the table with every worker and process using NAME" << std::endl
+		<< "    name=S    name shown in the report" << std::endl
+		<< "  --pin       pin every worker thread to its own CPU, spread over the NUMA nodes" << std::endl
+		<< "  --sprt      stop as soon as H0 (elo0) or H1 (elo1) is accepted; --games caps the test" << std::endl
+		<< "  --state     save the SPRT state after every batch and resume from it if it exists" << std::endl
+		<< "  --batch     games played between SPRT checks (default 4 per thread)" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Engine-versus-engine match runner.
+ * Plays every opening of --opening-plies plies twice with colours swapped, in parallel,
+ * and reports the results of the first engine.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	std::string configs[2] = { "", "" };
+	long long games = 0;
+	int threads = (int) std::thread::hardware_concurrency();
+	int opening_plies = 2;
+	bool use_sprt = false;
+	Sprt_config sprt;
+	std::string state_path;
+	long long batch = 0;
+	bool pin = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--first") == 0 && i + 1 < argc)
+		{
+			configs[0] = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--second") == 0 && i + 1 < argc)
+		{
+			configs[1] = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--games") == 0 && i + 1 < argc)
+		{
+			games = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threads = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--opening-plies") == 0 && i + 1 < argc)
+		{
+			opening_plies = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--sprt") == 0 && i + 1 < argc)
+		{
+			use_sprt = true;
+			if (!parse_sprt(argv[++i], sprt))
+			{
+				std::cerr << "invalid SPRT parameters: " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (std::strcmp(argv[i], "--state") == 0 && i + 1 < argc)
+		{
+			state_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			batch = std::atoll(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--pin") == 0)
+		{
+			pin = true;
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (!state_path.empty() && !use_sprt)
+	{
+		std::cerr << "--state requires --sprt" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Engine_config engines[2];
+	for (int i = 0; i < 2; i++)
+	{
+		std::string error;
+		if (!parse_engine_config(configs[i], engines[i], error))
+		{
+			std::cerr << error << std::endl;
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (opening_plies < 0 || opening_plies > 6)
+	{
+		std::cerr << "--opening-plies must be between 0 and 6" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	std::vector<std::string> openings = make_openings(opening_plies);
+
+	Match match(engines[0], engines[1], openings, threads, pin);
+	std::string error;
+	if (!match.open_shared_tables(error))
+	{
+		std::cerr << error << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (!use_sprt)
+	{
+		if (games <= 0)
+		{
+			games = 2 * (long long) openings.size();
+		}
+		print_report(engines, match, match.play(0, games), openings.size(), threads);
+		return EXIT_SUCCESS;
+	}
+
+	Sprt_state state;
+	state.configs[0] = configs[0];
+	state.configs[1] = configs[1];
+	state.opening_plies = opening_plies;
+	state.sprt = sprt;
+	if (!state_path.empty() && std::ifstream(state_path))
+	{
+		Sprt_state saved;
+		if (!load_sprt_state(state_path, saved))
+		{
+			std::cerr << "cannot read SPRT state " << state_path << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (saved.configs[0] != state.configs[0] || saved.configs[1] != state.configs[1] || saved.opening_plies != opening_plies)
+		{
+			std::cerr << "SPRT state " << state_path << " belongs to a different test" << std::endl;
+			return EXIT_FAILURE;
+		}
+		// the bounds are written with enough digits to read back exactly
+		if (saved.sprt.elo0 != sprt.elo0 || saved.sprt.elo1 != sprt.elo1 || saved.sprt.alpha != sprt.alpha || saved.sprt.beta != sprt.beta)
+		{
+			std::cerr << "SPRT state " << state_path << " was started with --sprt " << saved.sprt.elo0 << "," << saved.sprt.elo1
+				<< "," << saved.sprt.alpha << "," << saved.sprt.beta << std::endl;
+			return EXIT_FAILURE;
+		}
+		state = saved;
+		std::cerr << "resuming after " << state.next_game << " games" << std::endl;
+	}
+	if (batch <= 0)
+	{
+		batch = 4 * (long long) threads;
+	}
+	// keep colour-swapped pairs in the same batch
+	batch += batch % 2;
+
+	double llr = sprt_llr(state.stats, state.sprt);
+	while (llr > state.sprt.lower_bound() && llr < state.sprt.upper_bound() && (games <= 0 || state.next_game < games))
+	{
+		long long count = games > 0 ? std::min(batch, games - state.next_game) : batch;
+		state.stats.add(match.play(state.next_game, count));
+		state.next_game += count;
+		if (!state_path.empty() && !save_sprt_state(state_path, state))
+		{
+			std::cerr << "cannot write SPRT state " << state_path << std::endl;
+			return EXIT_FAILURE;
+		}
+		llr = sprt_llr(state.stats, state.sprt);
+		std::cerr << "games " << state.next_game << ", W/D/L " << state.stats.wins << "/" << state.stats.draws << "/" << state.stats.losses
+			<< ", llr " << llr << " [" << state.sprt.lower_bound() << ", " << state.sprt.upper_bound() << "]" << std::endl;
+	}
+
+	print_report(engines, match, state.stats, openings.size(), threads);
+	std::cout << "sprt elo0 " << state.sprt.elo0 << " elo1 " << state.sprt.elo1
+		<< " alpha " << state.sprt.alpha << " beta " << state.sprt.beta << ": llr " << llr << ", ";
+	if (llr >= state.sprt.upper_bound())
+	{
+		std::cout << "H1 accepted" << std::endl;
+	}
+	else if (llr <= state.sprt.lower_bound())
+	{
+		std::cout << "H0 accepted" << std::endl;
+	}
+	else
+	{
+		std::cout << "inconclusive" << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#include "threat_analysis.h"
+
+namespace con4game
+{
+
+Threat_analysis analyse_threats(const Board& board)
+{
+	Threat_analysis analysis = {};
+	const uint64_t* bitboard = board.get_board();
+	uint64_t occupied = bitboard[0] | bitboard[1];
+	uint64_t empty = (ALL1 ^ TOP) & ~occupied;
+	for (int side = 0; side < 2; side++)
+	{
+		uint64_t threats = Board::winning_squares(bitboard[side], occupied);
+		analysis.odd_threats[side] = threats & ODD_ROWS;
+		analysis.even_threats[side] = threats & EVEN_ROWS;
+	}
+
+	// a column holding an odd number of counters has its next square on an even row
+	uint64_t odd_columns = board.playable_squares() & EVEN_ROWS;
+	if ((board.get_plies() & 1) == 0)
+	{
+		// claimeven: player 1 only gets odd squares, player 2 all even squares
+		if (odd_columns == 0 && !Board::has_won(bitboard[0] | (empty & ODD_ROWS))
+			&& Board::has_won(bitboard[1] | (empty & EVEN_ROWS)))
+		{
+			analysis.winner = 2;
+		}
+	}
+	else if (odd_columns != 0 && (odd_columns & (odd_columns - 1)) == 0)
+	{
+		// odd threat: every empty square of the column is above its next square
+		uint64_t column = 0;
+		for (int col = 0; col < BOARD_WIDTH; col++)
+		{
+			column |= odd_columns & (COL1 << (col * H1)) ? COL1 << (col * H1) : 0;
+		}
+		uint64_t threats = analysis.odd_threats[0] & column;
+		uint64_t lowest = threats & (0 - threats);
+		// player 2 gets the odd squares of the other columns and the even squares below the threat
+		uint64_t player2 = bitboard[1] | (empty & ODD_ROWS & ~column) | (empty & EVEN_ROWS & column & (lowest - 1));
+		if (lowest != 0 && !Board::has_won(player2))
+		{
+			analysis.winner = 1;
+		}
+	}
+	return analysis;
+}
+
+} // namespace con4game
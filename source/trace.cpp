@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#ifdef CON4_TRACE
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/** A completed span. */
+struct Trace_event
+{
+	const char* name;
+	int64_t arg;
+	int64_t start_ns;
+	int64_t duration_ns;
+};
+
+/** Spans of one thread. Only its thread appends to it. */
+struct Trace_buffer
+{
+	int thread_id;
+	std::vector<Trace_event> events;
+};
+
+/** Owns the buffers of all threads so they outlive their threads. */
+struct Trace_registry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Trace_buffer>> buffers;
+};
+
+Trace_registry& registry()
+{
+	static Trace_registry instance;
+	return instance;
+}
+
+Trace_buffer& thread_buffer()
+{
+	thread_local Trace_buffer* buffer = nullptr;
+	if (!buffer)
+	{
+		Trace_registry& traces = registry();
+		std::lock_guard<std::mutex> lock(traces.mutex);
+		traces.buffers.emplace_back(new Trace_buffer());
+		buffer = traces.buffers.back().get();
+		buffer->thread_id = (int) traces.buffers.size();
+		buffer->events.reserve(1 << 16);
+	}
+	return *buffer;
+}
+
+} // namespace
+
+Trace_scope::~Trace_scope()
+{
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	Trace_event event;
+	event.name = name;
+	event.arg = arg;
+	event.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+	event.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	thread_buffer().events.push_back(event);
+}
+
+bool trace_dump(const char* path)
+{
+	std::FILE* file = std::fopen(path, "w");
+	if (!file)
+	{
+		return false;
+	}
+	Trace_registry& traces = registry();
+	std::lock_guard<std::mutex> lock(traces.mutex);
+	// timestamps are written relative to the earliest span
+	int64_t epoch_ns = INT64_MAX;
+	for (const std::unique_ptr<Trace_buffer>& buffer : traces.buffers)
+	{
+		for (const Trace_event& event : buffer->events)
+		{
+			epoch_ns = event.start_ns < epoch_ns ? event.start_ns : epoch_ns;
+		}
+	}
+	std::fprintf(file, "{\"traceEvents\":[");
+	bool first = true;
+	for (const std::unique_ptr<Trace_buffer>& buffer : traces.buffers)
+	{
+		for (const Trace_event& event : buffer->events)
+		{
+			std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				first ? "" : ",", event.name, buffer->thread_id, 1e-3 * (event.start_ns - epoch_ns), 1e-3 * event.duration_ns);
+			if (event.arg != INT64_MIN)
+			{
+				std::fprintf(file, ",\"args\":{\"value\":%lld}", (long long) event.arg);
+			}
+			std::fprintf(file, "}");
+			first = false;
+		}
+	}
+	std::fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return std::fclose(file) == 0;
+}
+
+} // namespace con4game
+
+#endif
@@ -0,0 +1,499 @@
+#include "transposition_table.h"
+#include "disk_store.h"
+#include "global.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+namespace con4game
+{
+namespace
+{
+
+const int CACHE_LINE = 64;
+const int NO_MOVE = 7;
+const int GENERATIONS = 8;
+
+int get_bound(uint8_t meta)
+{
+	return meta & 3;
+}
+
+int get_move(uint8_t meta)
+{
+	return (meta >> 2) & 7;
+}
+
+int get_generation(uint8_t meta)
+{
+	return meta >> 5;
+}
+
+uint8_t make_meta(int bound, int move, int generation)
+{
+	return (uint8_t) (bound | ((move < 0 ? NO_MOVE : move) << 2) | (generation << 5));
+}
+
+const char SNAPSHOT_MAGIC[8] = { 'C', 'O', 'N', '4', 'T', 'T', '\r', '\n' };
+/** Bump whenever the header, the entry format, the key, the hash function or the score scale changes. */
+const uint32_t SNAPSHOT_VERSION = 4;
+/** Written in native byte order, to detect a snapshot of a machine with the other one. */
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/**
+ * Header of a snapshot file or shared memory segment, one cache line so that the buckets behind it stay aligned.
+ */
+struct Table_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t board_width;
+	uint32_t board_height;
+	uint32_t entry_size;
+	uint32_t bucket_size;
+	uint32_t layout;
+	uint32_t bucket_bits;
+	uint32_t generation;
+	/** Set last by the creator of a shared segment, once the header is complete. */
+	uint32_t ready;
+	/** The evaluation the stored scores come from, see Transposition_table::set_evaluation(). */
+	uint64_t evaluation;
+	uint32_t reserved[2];
+};
+
+void fill_header(Table_header& header, int layout, int bucket_bits, int generation, std::size_t entry_size, int bucket_size)
+{
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.board_width = (uint32_t) BOARD_WIDTH;
+	header.board_height = (uint32_t) BOARD_HEIGHT;
+	header.entry_size = (uint32_t) entry_size;
+	header.bucket_size = (uint32_t) bucket_size;
+	header.layout = (uint32_t) layout;
+	header.bucket_bits = (uint32_t) bucket_bits;
+	header.generation = (uint32_t) generation;
+	header.ready = 1;
+}
+
+/**
+ * Check that a header was written by this build for this board.
+ * @param size          the size of the file or segment including the header
+ * @param entry_size    the size of an entry in bytes
+ * @param bucket_size   the number of entries per bucket
+ * @param bucket_bytes  the size of a bucket in bytes
+ * @return an empty string if valid, otherwise the reason
+ */
+std::string check_header(const Table_header& header, std::size_t size, std::size_t entry_size, int bucket_size, std::size_t bucket_bytes)
+{
+	if (size < sizeof(Table_header) || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+	{
+		return "not a transposition table";
+	}
+	if (header.version != SNAPSHOT_VERSION || header.byte_order != BYTE_ORDER_MARK
+		|| header.entry_size != entry_size || header.bucket_size != (uint32_t) bucket_size)
+	{
+		return "table format " + std::to_string(header.version) + " is not supported";
+	}
+	if (header.board_width != BOARD_WIDTH || header.board_height != BOARD_HEIGHT)
+	{
+		return "table of a " + std::to_string(header.board_width) + "x" + std::to_string(header.board_height) + " board";
+	}
+	// shared segments may be rounded up to whole pages
+	if (header.layout > 1 || header.bucket_bits > 40 || header.generation >= GENERATIONS
+		|| size < sizeof(Table_header) + (bucket_bytes << header.bucket_bits))
+	{
+		return "table is damaged or truncated";
+	}
+	return "";
+}
+
+} // namespace
+
+Transposition_table::Transposition_table(std::size_t size_mb, Layout layout, const Memory_options& memory_options)
+: buckets(nullptr)
+, bucket_bits(get_bucket_bits(size_mb))
+, layout(layout)
+, generation(0)
+, shared(false)
+, disk_min_depth(0)
+, own_evaluation(0)
+, evaluation(&own_evaluation)
+{
+	static_assert(sizeof(Bucket) == CACHE_LINE, "a bucket must fill one cache line");
+	memory.reset(new Large_memory(sizeof(Bucket) << bucket_bits, memory_options));
+	buckets = static_cast<Bucket*>(memory->get());
+	// touching every page here places it according to the NUMA policy
+	clear();
+}
+
+Transposition_table::Transposition_table(std::unique_ptr<Large_memory> memory, std::size_t offset, int bucket_bits, Layout layout, uint8_t generation)
+: memory(std::move(memory))
+, buckets(nullptr)
+, bucket_bits(bucket_bits)
+, layout(layout)
+, generation(generation)
+, shared(false)
+, disk_min_depth(0)
+, own_evaluation(0)
+, evaluation(&own_evaluation)
+{
+	buckets = reinterpret_cast<Bucket*>(static_cast<char*>(this->memory->get()) + offset);
+}
+
+Transposition_table::~Transposition_table()
+{
+	attach_disk(nullptr, 0);
+}
+
+std::shared_ptr<Transposition_table> Transposition_table::load(const std::string& path, std::string& error)
+{
+	CON4_TRACE_SCOPE("tt_load");
+	static_assert(sizeof(Table_header) == CACHE_LINE, "the table header must fill one cache line");
+	std::unique_ptr<Large_memory> memory = Large_memory::map_file(path, error);
+	if (!memory)
+	{
+		return nullptr;
+	}
+	const Table_header* header = static_cast<const Table_header*>(memory->get());
+	error = check_header(*header, memory->get_size(), sizeof(Entry), BUCKET_SIZE, sizeof(Bucket));
+	if (error.empty() && memory->get_size() != sizeof(Table_header) + (sizeof(Bucket) << header->bucket_bits))
+	{
+		error = "table is damaged or truncated";
+	}
+	if (!error.empty())
+	{
+		error = path + ": " + error;
+		return nullptr;
+	}
+	std::size_t offset = sizeof(Table_header);
+	int bits = (int) header->bucket_bits;
+	Layout layout = (Layout) header->layout;
+	uint8_t generation = (uint8_t) header->generation;
+	uint64_t evaluation = header->evaluation;
+#if defined(_MSC_VER)
+	// Windows cannot replace a file while a view of it is mapped, so save() could never update the snapshot
+	std::unique_ptr<Large_memory> copy(new Large_memory(sizeof(Bucket) << bits, Memory_options()));
+	std::memcpy(copy->get(), static_cast<const char*>(memory->get()) + offset, sizeof(Bucket) << bits);
+	memory = std::move(copy);
+	offset = 0;
+#endif
+	std::shared_ptr<Transposition_table> table(new Transposition_table(std::move(memory), offset, bits, layout, generation));
+	table->own_evaluation.store(evaluation, std::memory_order_relaxed);
+	return table;
+}
+
+std::shared_ptr<Transposition_table> Transposition_table::open_shared(const std::string& name, std::size_t size_mb, std::string& error)
+{
+	int bits = get_bucket_bits(size_mb);
+	bool created = false;
+	std::unique_ptr<Large_memory> memory = Large_memory::open_shared(name, sizeof(Table_header) + (sizeof(Bucket) << bits), created, error);
+	if (!memory)
+	{
+		return nullptr;
+	}
+	Table_header* header = static_cast<Table_header*>(memory->get());
+	std::atomic<uint32_t>* ready = reinterpret_cast<std::atomic<uint32_t>*>(&header->ready);
+	if (created)
+	{
+		Table_header filled;
+		fill_header(filled, (int) Layout::BUCKETED, bits, 0, sizeof(Entry), BUCKET_SIZE);
+		filled.ready = 0;
+		std::memcpy(header, &filled, sizeof(filled));
+		ready->store(1, std::memory_order_release);
+	}
+	else
+	{
+		// the creator may still be writing the header
+		std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (ready->load(std::memory_order_acquire) == 0 && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		error = ready->load(std::memory_order_acquire) == 0 ? "segment was never initialised"
+			: check_header(*header, memory->get_size(), sizeof(Entry), BUCKET_SIZE, sizeof(Bucket));
+		if (!error.empty())
+		{
+			error = name + ": " + error;
+			return nullptr;
+		}
+		bits = (int) header->bucket_bits;
+	}
+	std::shared_ptr<Transposition_table> table(new Transposition_table(std::move(memory), sizeof(Table_header), bits, Layout::BUCKETED, 0));
+	table->shared = true;
+	// every process tags and checks the scores in the segment
+	table->evaluation = reinterpret_cast<std::atomic<uint64_t>*>(&header->evaluation);
+	return table;
+}
+
+bool Transposition_table::remove_shared(const std::string& name)
+{
+	return Large_memory::remove_shared(name);
+}
+
+bool Transposition_table::save(const std::string& path) const
+{
+	CON4_TRACE_SCOPE("tt_save");
+	Table_header header;
+	fill_header(header, (int) layout, bucket_bits, generation.load(std::memory_order_relaxed), sizeof(Entry), BUCKET_SIZE);
+	header.evaluation = get_evaluation();
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(buckets), (std::streamsize) get_size());
+		if (!file.flush())
+		{
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	return replace_file(temporary, path);
+}
+
+void Transposition_table::attach_disk(const std::shared_ptr<Disk_store>& store, int min_depth)
+{
+	if (disk)
+	{
+		// the I/O thread must not copy entries into this table any more
+		disk->bind(nullptr, bucket_bits);
+	}
+	disk = layout == Layout::BUCKETED ? store : nullptr;
+	disk_min_depth = min_depth;
+	if (disk)
+	{
+		disk->bind(this, bucket_bits);
+	}
+}
+
+Disk_store* Transposition_table::get_disk() const
+{
+	return disk.get();
+}
+
+void Transposition_table::clear()
+{
+	CON4_TRACE_SCOPE("tt_clear");
+	std::memset(static_cast<void*>(buckets), 0, sizeof(Bucket) << bucket_bits);
+	generation.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Transposition_table::get_evaluation() const
+{
+	return evaluation->load(std::memory_order_relaxed);
+}
+
+void Transposition_table::set_evaluation(uint64_t id)
+{
+	uint64_t previous = evaluation->exchange(id, std::memory_order_relaxed);
+	if (previous != 0 && previous != id)
+	{
+		clear();
+	}
+}
+
+void Transposition_table::new_search()
+{
+	// searches on other threads may bump it at the same time, which only ages entries a little faster
+	generation.store((uint8_t) ((generation.load(std::memory_order_relaxed) + 1) % GENERATIONS), std::memory_order_relaxed);
+}
+
+// pack() keeps the low 16 bits of a score and unpack() sign-extends them, which must give back a decided game unchanged
+static_assert((int16_t) (uint16_t) SCORE_WIN == SCORE_WIN && (int16_t) (uint16_t) -SCORE_WIN == -SCORE_WIN, "a decided game must survive the 16-bit score of an entry");
+
+uint64_t Transposition_table::pack(const Entry& entry)
+{
+	uint64_t data = (uint16_t) entry.score | ((uint64_t) entry.depth << 16) | ((uint64_t) entry.meta << 24);
+	return (data << 32) | (entry.check ^ data);
+}
+
+Transposition_table::Entry Transposition_table::unpack(uint64_t word)
+{
+	uint32_t data = (uint32_t) (word >> 32);
+	Entry entry;
+	entry.check = (uint32_t) word ^ data;
+	entry.score = (int16_t) (data & 0xFFFF);
+	entry.depth = (uint8_t) (data >> 16);
+	entry.meta = (uint8_t) (data >> 24);
+	return entry;
+}
+
+int Transposition_table::get_bucket_bits(std::size_t size_mb)
+{
+	std::size_t bytes = (size_mb < 1 ? 1 : size_mb) << 20;
+	int bits = 0;
+	while ((sizeof(Bucket) << (bits + 1)) <= bytes)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+uint64_t Transposition_table::hash(uint64_t key)
+{
+	// splitmix64 finalizer
+	key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+	return key ^ (key >> 31);
+}
+
+uint64_t Transposition_table::bucket_index(uint64_t hashed) const
+{
+	// high bits select the bucket, low bits are the check
+	return bucket_bits == 0 ? 0 : hashed >> (64 - bucket_bits);
+}
+
+Transposition_table::Bucket& Transposition_table::bucket_of(uint64_t hashed) const
+{
+	return buckets[bucket_index(hashed)];
+}
+
+std::atomic<uint64_t>& Transposition_table::slot_of(uint64_t hashed) const
+{
+	int bits = bucket_bits + 3;
+	std::size_t index = (std::size_t) (hashed >> (64 - bits));
+	return buckets[index / BUCKET_SIZE].entries[index % BUCKET_SIZE];
+}
+
+bool Transposition_table::probe(uint64_t key, Probe_result& result, int depth) const
+{
+	uint64_t hashed = hash(key);
+	uint32_t check = (uint32_t) hashed;
+	Entry entry;
+	bool found = false;
+	if (layout == Layout::SINGLE_SLOT)
+	{
+		entry = unpack(slot_of(hashed).load(std::memory_order_relaxed));
+		found = entry.check == check && get_bound(entry.meta) != (int) Bound::NONE;
+	}
+	else
+	{
+		const Bucket& bucket = bucket_of(hashed);
+		for (int i = 0; i < BUCKET_SIZE && !found; i++)
+		{
+			entry = unpack(bucket.entries[i].load(std::memory_order_relaxed));
+			found = entry.check == check && get_bound(entry.meta) != (int) Bound::NONE;
+		}
+	}
+	if (!found)
+	{
+		if (disk && depth >= disk_min_depth)
+		{
+			disk->request(bucket_index(hashed), check);
+		}
+		return false;
+	}
+	result.score = entry.score;
+	result.depth = entry.depth;
+	result.bound = (Bound) get_bound(entry.meta);
+	result.move = get_move(entry.meta) == NO_MOVE ? -1 : get_move(entry.meta);
+	return true;
+}
+
+void Transposition_table::store(uint64_t key, int score, int depth, Bound bound, int move)
+{
+	uint64_t hashed = hash(key);
+	Entry entry;
+	entry.check = (uint32_t) hashed;
+	entry.score = (int16_t) score;
+	entry.depth = (uint8_t) depth;
+	entry.meta = make_meta((int) bound, move, generation.load(std::memory_order_relaxed));
+	if (layout == Layout::SINGLE_SLOT)
+	{
+		slot_of(hashed).store(pack(entry), std::memory_order_relaxed);
+		return;
+	}
+	place(bucket_index(hashed), entry);
+}
+
+void Transposition_table::place(uint64_t index, const Entry& entry)
+{
+	Bucket& bucket = buckets[index];
+	int generation = this->generation.load(std::memory_order_relaxed);
+	std::atomic<uint64_t>* target = nullptr;
+	// the least valuable depth-preferred entry: empty, then old, then shallow
+	int worst = 0;
+	int worst_value = 1 << 30;
+	for (int i = 0; i < BUCKET_SIZE; i++)
+	{
+		Entry other = unpack(bucket.entries[i].load(std::memory_order_relaxed));
+		// an entry of the same position is overwritten unless it holds a deeper result of this search
+		if (other.check == entry.check && get_bound(other.meta) != (int) Bound::NONE)
+		{
+			if (entry.depth < other.depth && get_generation(other.meta) == generation && get_bound(entry.meta) != (int) Bound::EXACT)
+			{
+				return;
+			}
+			target = &bucket.entries[i];
+			break;
+		}
+		int age = (generation - get_generation(other.meta) + GENERATIONS) % GENERATIONS;
+		int value = get_bound(other.meta) == (int) Bound::NONE ? -(1 << 20) : other.depth - 8 * age;
+		if (i < BUCKET_SIZE - 1 && value < worst_value)
+		{
+			worst = i;
+			worst_value = value;
+		}
+	}
+	if (!target)
+	{
+		// results shallower than every depth-preferred entry go to the always-replace entry
+		target = entry.depth >= worst_value ? &bucket.entries[worst] : &bucket.entries[BUCKET_SIZE - 1];
+	}
+	// another writer may have replaced the entry since it was read, then one of the results is lost
+	if (!disk)
+	{
+		target->store(pack(entry), std::memory_order_relaxed);
+		return;
+	}
+	// exchanged, so that the I/O thread and the search never spill the same entry twice
+	Entry victim = unpack(target->exchange(pack(entry), std::memory_order_relaxed));
+	if (victim.check != entry.check && get_bound(victim.meta) != (int) Bound::NONE && victim.depth >= disk_min_depth)
+	{
+		disk->spill(index, pack(victim));
+	}
+}
+
+void Transposition_table::prefetch(uint64_t key) const
+{
+	uint64_t hashed = hash(key);
+	const void* address = layout == Layout::SINGLE_SLOT ? (const void*) &slot_of(hashed) : (const void*) &bucket_of(hashed);
+#if defined(_MSC_VER)
+	_mm_prefetch((const char*) address, _MM_HINT_T0);
+#else
+	__builtin_prefetch(address);
+#endif
+}
+
+std::size_t Transposition_table::get_size() const
+{
+	return sizeof(Bucket) << bucket_bits;
+}
+
+Transposition_table::Layout Transposition_table::get_layout() const
+{
+	return layout;
+}
+
+bool Transposition_table::is_shared() const
+{
+	return shared;
+}
+
+const std::string& Transposition_table::get_memory_description() const
+{
+	return memory->get_description();
+}
+
+} // namespace con4game
@@ -0,0 +1,390 @@
+#include "dataset.h"
+#include "evaluation.h"
+#include "global.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace con4game
+{
+namespace
+{
+
+/** The weights of Eval_weights as one array, `own` first; `other` features count negatively. */
+const int FEATURES = 2 * WINDOW_DIRECTIONS * 4;
+
+/**
+ * The records of all shards, which stay mapped while the tuner runs.
+ */
+class Record_set
+{
+public:
+	bool add(const std::string& path, std::string& error)
+	{
+		std::unique_ptr<Record_file> file = Record_file::open(path, error);
+		if (!file)
+		{
+			return false;
+		}
+		total += file->get_count();
+		files.push_back(std::move(file));
+		return true;
+	}
+
+	std::size_t get_count() const
+	{
+		return total;
+	}
+
+	/**
+	 * Call `visit` with every record of the index range [first, last) over the concatenated shards.
+	 */
+	template <typename Visitor>
+	void for_each(std::size_t first, std::size_t last, Visitor&& visit) const
+	{
+		std::size_t offset = 0;
+		for (const std::unique_ptr<Record_file>& file : files)
+		{
+			std::size_t count = file->get_count();
+			std::size_t begin = std::max(first, offset);
+			std::size_t end = std::min(last, offset + count);
+			const Training_record* records = file->get_records();
+			for (std::size_t i = begin; i < end; i++)
+			{
+				visit(records[i - offset]);
+			}
+			offset += count;
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<Record_file>> files;
+	std::size_t total = 0;
+};
+
+/** The squared error and its gradient over a range of records. */
+struct Pass_result
+{
+	double error = 0;
+	long long positions = 0;
+	double gradient[FEATURES] = {};
+};
+
+/**
+ * Get the features of a record from the view of the player to move and its expected result, from 0 (lost) to 1 (won).
+ * @return false if the record has no known result
+ */
+bool get_features(const Training_record& record, float features[FEATURES], float& target)
+{
+	int result = record.exact != Training_record::UNKNOWN ? record.exact : record.outcome;
+	if (result == Training_record::UNKNOWN || record.side > 1)
+	{
+		return false;
+	}
+	Window_counts counts;
+	count_windows(record.bitboard[record.side], record.bitboard[record.side ^ 1], counts);
+	for (int i = 0; i < FEATURES / 2; i++)
+	{
+		features[i] = (&counts.own[0][0])[i];
+		features[FEATURES / 2 + i] = -(float) (&counts.other[0][0])[i];
+	}
+	target = 0.5f * result;
+	return true;
+}
+
+/** Records whose features are computed before they are scored, so that every loop runs over contiguous floats. */
+const int BATCH_SIZE = 256;
+
+/**
+ * A batch of positions, with the sums of its error and gradient.
+ */
+struct Batch
+{
+	float features[BATCH_SIZE][FEATURES];
+	float targets[BATCH_SIZE];
+	int size = 0;
+	double error = 0;
+	long long positions = 0;
+	double gradient[FEATURES] = {};
+
+	/** Score the positions, add their error and, if `with_gradient` is set, its gradient, and empty the batch. */
+	void flush(const float weights[FEATURES], float scale, bool with_gradient)
+	{
+		float deltas[BATCH_SIZE];
+		for (int j = 0; j < size; j++)
+		{
+			float score = 0;
+			for (int i = 0; i < FEATURES; i++)
+			{
+				score += weights[i] * features[j][i];
+			}
+			float predicted = 1.f / (1.f + std::exp(-scale * score));
+			float difference = predicted - targets[j];
+			error += difference * difference;
+			deltas[j] = 2.f * difference * predicted * (1.f - predicted) * scale;
+		}
+		if (with_gradient)
+		{
+			// a batch is summed in single precision, the batches in double precision
+			float sums[FEATURES] = {};
+			for (int j = 0; j < size; j++)
+			{
+				for (int i = 0; i < FEATURES; i++)
+				{
+					sums[i] += deltas[j] * features[j][i];
+				}
+			}
+			for (int i = 0; i < FEATURES; i++)
+			{
+				gradient[i] += sums[i];
+			}
+		}
+		positions += size;
+		size = 0;
+	}
+};
+
+/**
+ * Compute the mean squared error of the predicted results, sigmoid(scale * score), over all records,
+ * and if `with_gradient` is set its gradient by the weights. The records are split evenly among the threads.
+ */
+Pass_result run_pass(const Record_set& records, const float weights[FEATURES], float scale, bool with_gradient, int threads)
+{
+	std::vector<Pass_result> results(threads);
+	std::vector<std::thread> workers;
+	std::size_t count = records.get_count();
+	for (int t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread(
+			[&, t]
+			{
+				std::unique_ptr<Batch> batch(new Batch());
+				records.for_each(count * t / threads, count * (t + 1) / threads,
+					[&](const Training_record& record)
+					{
+						if (get_features(record, batch->features[batch->size], batch->targets[batch->size])
+							&& ++batch->size == BATCH_SIZE)
+						{
+							batch->flush(weights, scale, with_gradient);
+						}
+					});
+				batch->flush(weights, scale, with_gradient);
+				results[t].error = batch->error;
+				results[t].positions = batch->positions;
+				std::copy(batch->gradient, batch->gradient + FEATURES, results[t].gradient);
+			}));
+	}
+	Pass_result total;
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].join();
+		total.error += results[t].error;
+		total.positions += results[t].positions;
+		for (int i = 0; i < FEATURES; i++)
+		{
+			total.gradient[i] += results[t].gradient[i];
+		}
+	}
+	if (total.positions > 0)
+	{
+		total.error /= total.positions;
+		for (int i = 0; i < FEATURES; i++)
+		{
+			total.gradient[i] /= total.positions;
+		}
+	}
+	return total;
+}
+
+/**
+ * Find the scale of scores to logits that predicts the results best with the given weights,
+ * by a golden section search over its logarithm.
+ */
+float fit_scale(const Record_set& records, const float weights[FEATURES], int threads)
+{
+	const double ratio = (std::sqrt(5.0) - 1) / 2;
+	double low = std::log(1e-5);
+	double high = std::log(1.0);
+	double a = high - ratio * (high - low);
+	double b = low + ratio * (high - low);
+	double error_a = run_pass(records, weights, (float) std::exp(a), false, threads).error;
+	double error_b = run_pass(records, weights, (float) std::exp(b), false, threads).error;
+	for (int i = 0; i < 30; i++)
+	{
+		if (error_a < error_b)
+		{
+			high = b;
+			b = a;
+			error_b = error_a;
+			a = high - ratio * (high - low);
+			error_a = run_pass(records, weights, (float) std::exp(a), false, threads).error;
+		}
+		else
+		{
+			low = a;
+			a = b;
+			error_a = error_b;
+			b = low + ratio * (high - low);
+			error_b = run_pass(records, weights, (float) std::exp(b), false, threads).error;
+		}
+	}
+	return (float) std::exp((low + high) / 2);
+}
+
+void print_usage()
+{
+	std::cerr << "usage: connectfour_tune [--iterations N] [--rate R] [--threads N] [--scale K] [--init FILE] [--output FILE] SHARD..." << std::endl
+		<< "  Tunes the weights of the classic evaluation on shards of connectfour_datagen (Texel's method):" << std::endl
+		<< "  the result of the player to move, the exact one if it is known, otherwise the result of the game," << std::endl
+		<< "  is predicted as sigmoid(K * score) and the mean squared error is minimised with Adam." << std::endl
+		<< "  The shards are mapped into memory and every iteration makes one pass over all records." << std::endl
+		<< "  --iterations N  gradient steps (default 500)" << std::endl
+		<< "  --rate R        Adam learning rate in score units (default 4)" << std::endl
+		<< "  --threads N     threads sharing every pass (default all CPUs)" << std::endl
+		<< "  --scale K       scale of scores to logits (default: fitted to the starting weights)" << std::endl
+		<< "  --init FILE     start from a weights file instead of get_classic_weights()" << std::endl
+		<< "  --output FILE   where to write the weights (default " << EVAL_WEIGHTS_FILE << ")" << std::endl;
+}
+
+} // namespace
+} // namespace con4game
+
+/**
+ * Texel tuning of the classic evaluation weights. Prints the error and the time of every iteration.
+ */
+int main(int argc, char** argv)
+{
+	using namespace con4game;
+	Logger::get().set_level(Log_level::WARNING);
+	int iterations = 500;
+	float learning_rate = 4.f;
+	int threads = (int) std::thread::hardware_concurrency();
+	float scale = 0;
+	std::string init_file;
+	std::string output_file = EVAL_WEIGHTS_FILE;
+	std::vector<std::string> shards;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+		{
+			learning_rate = (float) std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threads = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+		{
+			scale = (float) std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--init") == 0 && i + 1 < argc)
+		{
+			init_file = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			output_file = argv[++i];
+		}
+		else if (argv[i][0] != '-')
+		{
+			shards.push_back(argv[i]);
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (iterations < 0 || learning_rate <= 0 || scale < 0 || shards.empty())
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+
+	Record_set records;
+	std::string error;
+	for (const std::string& path : shards)
+	{
+		if (!records.add(path, error))
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	Eval_weights start = get_classic_weights();
+	if (!init_file.empty() && !load_eval_weights(init_file, start, error))
+	{
+		std::cerr << error << std::endl;
+		return EXIT_FAILURE;
+	}
+	float weights[FEATURES];
+	for (int i = 0; i < FEATURES / 2; i++)
+	{
+		weights[i] = (float) (&start.own[0][0])[i];
+		weights[FEATURES / 2 + i] = (float) (&start.other[0][0])[i];
+	}
+	std::cerr << records.get_count() << " records in " << shards.size() << " shards, " << threads << " threads" << std::endl;
+	if (scale == 0)
+	{
+		// fix the scale once, so that the tuned weights stay in the units of the starting ones
+		scale = fit_scale(records, weights, threads);
+	}
+	std::cout << "scale " << scale << std::endl;
+
+	const float beta1 = 0.9f;
+	const float beta2 = 0.999f;
+	float first_moments[FEATURES] = {};
+	float second_moments[FEATURES] = {};
+	for (int iteration = 1; iteration <= iterations; iteration++)
+	{
+		std::chrono::steady_clock::time_point start_clock = std::chrono::steady_clock::now();
+		Pass_result pass = run_pass(records, weights, scale, true, threads);
+		float correction1 = 1.f - std::pow(beta1, (float) iteration);
+		float correction2 = 1.f - std::pow(beta2, (float) iteration);
+		for (int i = 0; i < FEATURES; i++)
+		{
+			float gradient = (float) pass.gradient[i];
+			first_moments[i] = beta1 * first_moments[i] + (1.f - beta1) * gradient;
+			second_moments[i] = beta2 * second_moments[i] + (1.f - beta2) * gradient * gradient;
+			weights[i] -= learning_rate * (first_moments[i] / correction1) / (std::sqrt(second_moments[i] / correction2) + 1e-12f);
+		}
+		long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_clock).count();
+		std::cout << "iteration " << iteration << ": error " << std::setprecision(8) << pass.error
+			<< ", " << pass.positions << " positions, " << elapsed_ms << " ms" << std::endl;
+	}
+
+	Eval_weights tuned;
+	for (int i = 0; i < FEATURES / 2; i++)
+	{
+		(&tuned.own[0][0])[i] = (int32_t) std::lround(weights[i]);
+		(&tuned.other[0][0])[i] = (int32_t) std::lround(weights[FEATURES / 2 + i]);
+	}
+	// the features are counted for the player to move, so the engine has to evaluate for that player
+	tuned.player_to_move = true;
+	std::cout << "final error " << std::setprecision(8) << run_pass(records, weights, scale, false, threads).error << std::endl;
+	if (!save_eval_weights(output_file, tuned))
+	{
+		std::cerr << output_file << ": cannot be written" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "wrote " << output_file << std::endl;
+	return EXIT_SUCCESS;
+}